@@ -1,5 +1,20 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sched.h>
 
 struct piece_list
 {
@@ -25,6 +40,24 @@ struct fen
     int full_moves;
 };
 
+//keys of the positions played so far, indexed by ply modulo the size. Copies of a game share
+//the history, so a depth first search overwrites a line's keys only after leaving it. The
+//fifty-move rule bounds how far back a repetition can be, which bounds the size.
+#define HISTORY_SIZE 128
+
+struct key_history
+{
+    uint64_t keys[HISTORY_SIZE];
+};
+
+//who attacks every square, kept up to date by make_move once enable_attack_maps is called.
+//attackers holds the squares of the pieces of either color attacking a square.
+struct attack_map
+{
+    uint64_t attackers[64];
+    uint8_t counts[2][64];
+};
+
 struct chess_game
 {
     int board[64];
@@ -39,6 +72,12 @@ struct chess_game
     int distance_to_borders[64][8];
     int en_passant;
     struct captured_pieces captured_piece_list;
+    uint64_t hash;
+    uint64_t pawn_hash;
+    struct key_history *history;
+    int history_ply;
+    int track_attacks;
+    struct attack_map attacks;
 };
 
 struct move
@@ -67,6 +106,7 @@ void generate_sliding_moves(struct chess_game *game, int positon, struct queue *
 void generate_knight_moves(struct chess_game *game, int positon, struct queue *q);
 void generate_king_moves(struct chess_game *game, int position, struct queue *q);
 void generate_pawn_moves(struct chess_game *game, int position, struct queue *q);
+void generate_steps_to_edges(int array[][8]);
 
 const int EMPTY = 0, KING = 1, QUEEN = 2, ROOK = 3, BISHOP = 4, KNIGHT = 5, PAWN = 6;
 const int WHITE = 8, BLACK = 16;
@@ -77,211 +117,893 @@ ENPASSANT_CAPTURE = 5, KNIGHT_PROMOTION = 8, BISHOP_PROMOTION = 9, ROOK_PROMOTIO
 KNIGHT_PROMO_CAPTURE = 12, BISHOP_PROMO_CAPTURE = 13, ROOK_PROMO_CAPTURE = 14, QUEEN_PROMO_CAPTURE = 15;
 const char PIECE_SYMBOLS[] = {'\0', 'k', 'q', 'r', 'b', 'n', 'p'};
 
-int piece_color(int piece)
+//hot path counters, compiled in with -DCHESS_STATS (and cycle timers with -DCHESS_STATS_TIMERS).
+//Without them every STAT_ macro expands to nothing.
+#ifdef CHESS_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+const int TIMER_MOVEGEN = 0, TIMER_MAKE_MOVE = 1, TIMER_EVALUATE = 2;
+
+struct hot_counters
 {
-    return piece & 24;
-}
+    long long generate_moves_calls;
+    long long moves_generated[16];
+    long long make_move_calls[16];
+    long long piece_list_updates;
+    long long piece_list_adds;
+    long long piece_list_removes;
+    long long evaluate_calls;
+    long long search_nodes;
+    long long qsearch_nodes;
+    long long tt_probes;
+    long long tt_hits;
+    long long beta_cutoffs;
+    long long cutoffs_by_index[8];
+    long long cycles[3];
+    struct hot_counters *next;
+};
 
-int piece_type(int piece)
+struct hot_counters *counters_registry = NULL;
+pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local struct hot_counters *local_counters = NULL;
+
+//each thread gets its own block on first use, blocks outlive their thread so they can be merged later
+struct hot_counters* register_thread_counters()
 {
-    return piece & 7;
+    local_counters = (struct hot_counters*)calloc(1, sizeof(struct hot_counters));
+    if(local_counters == NULL)
+    {
+        printf("memory not allocated\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&counters_lock);
+    local_counters->next = counters_registry;
+    counters_registry = local_counters;
+    pthread_mutex_unlock(&counters_lock);
+    return local_counters;
 }
 
-int is_valid_position(int position)
+static inline struct hot_counters* thread_counters()
 {
-    return position >= 0 && position <= 63;
+    return local_counters != NULL ? local_counters : register_thread_counters();
 }
 
-int file(int position)
+static inline uint64_t read_cycles()
 {
-    return position % 8;
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
 
-int rank(int position)
+void merge_counters(struct hot_counters *total)
 {
-    return position / 8;
+    memset(total, 0, sizeof(struct hot_counters));
+    pthread_mutex_lock(&counters_lock);
+    for(struct hot_counters *c = counters_registry; c != NULL; c = c->next)
+    {
+        total->generate_moves_calls += c->generate_moves_calls;
+        for(int type = 0; type < 16; type++)
+        {
+            total->moves_generated[type] += c->moves_generated[type];
+            total->make_move_calls[type] += c->make_move_calls[type];
+        }
+        total->piece_list_updates += c->piece_list_updates;
+        total->piece_list_adds += c->piece_list_adds;
+        total->piece_list_removes += c->piece_list_removes;
+        total->evaluate_calls += c->evaluate_calls;
+        total->search_nodes += c->search_nodes;
+        total->qsearch_nodes += c->qsearch_nodes;
+        total->tt_probes += c->tt_probes;
+        total->tt_hits += c->tt_hits;
+        total->beta_cutoffs += c->beta_cutoffs;
+        for(int i = 0; i < 8; i++)
+        {
+            total->cutoffs_by_index[i] += c->cutoffs_by_index[i];
+        }
+        for(int i = 0; i < 3; i++)
+        {
+            total->cycles[i] += c->cycles[i];
+        }
+    }
+    pthread_mutex_unlock(&counters_lock);
 }
 
-struct move* init_move(int source, int dest, int type)
+void write_counter_array(FILE *fp, char *name, long long *values, int count)
 {
-    struct move *new = (struct move*)malloc(sizeof(struct move));
-    if(new == NULL)
+    fprintf(fp, "  \"%s\": [", name);
+    for(int i = 0; i < count; i++)
     {
-        printf("memory not allocated\n");
-        return NULL;
+        fprintf(fp, "%s%lld", i == 0 ? "" : ", ", values[i]);
     }
-    new->src = source;
-    new->dest = dest;
-    new->type = type;
-    return new;
+    fprintf(fp, "],\n");
 }
 
-struct node* init_node(struct move *mv)
+void dump_counters_json(FILE *fp)
 {
-    struct node *new = (struct node*)malloc(sizeof(struct node));
-    if(mv == NULL)
+    struct hot_counters total;
+    merge_counters(&total);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"generate_moves_calls\": %lld,\n", total.generate_moves_calls);
+    write_counter_array(fp, "moves_generated_by_type", total.moves_generated, 16);
+    write_counter_array(fp, "make_move_calls_by_type", total.make_move_calls, 16);
+    fprintf(fp, "  \"piece_list_updates\": %lld,\n", total.piece_list_updates);
+    fprintf(fp, "  \"piece_list_adds\": %lld,\n", total.piece_list_adds);
+    fprintf(fp, "  \"piece_list_removes\": %lld,\n", total.piece_list_removes);
+    fprintf(fp, "  \"evaluate_calls\": %lld,\n", total.evaluate_calls);
+    fprintf(fp, "  \"search_nodes\": %lld,\n", total.search_nodes);
+    fprintf(fp, "  \"qsearch_nodes\": %lld,\n", total.qsearch_nodes);
+    fprintf(fp, "  \"tt_probes\": %lld,\n", total.tt_probes);
+    fprintf(fp, "  \"tt_hits\": %lld,\n", total.tt_hits);
+    fprintf(fp, "  \"beta_cutoffs\": %lld,\n", total.beta_cutoffs);
+    write_counter_array(fp, "cutoffs_by_move_index", total.cutoffs_by_index, 8);
+    fprintf(fp, "  \"cycles\": {\"movegen\": %lld, \"make_move\": %lld, \"evaluate\": %lld}\n",
+        total.cycles[TIMER_MOVEGEN], total.cycles[TIMER_MAKE_MOVE], total.cycles[TIMER_EVALUATE]);
+    fprintf(fp, "}\n");
+}
+
+//written to the file named by CHESS_STATS_JSON, or stderr
+void dump_counters_at_exit()
+{
+    char *path = getenv("CHESS_STATS_JSON");
+    FILE *fp = path != NULL ? fopen(path, "w") : stderr;
+    if(fp == NULL)
     {
-        return NULL;
+        printf("cannot open %s\n", path);
+        return;
     }
-    if(new == NULL)
+    dump_counters_json(fp);
+    if(fp != stderr)
     {
-        printf("memory not allocated\n");
-        return NULL;
+        fclose(fp);
     }
+}
 
-    new->mv = mv;
-    new->next = NULL;
-    return new;
+#define STAT_INC(field) (thread_counters()->field++)
+#define STAT_ADD(field, value) (thread_counters()->field += (value))
+#else
+#define STAT_INC(field) ((void)0)
+#define STAT_ADD(field, value) ((void)0)
+#endif
+
+#if defined(CHESS_STATS) && defined(CHESS_STATS_TIMERS)
+#define TIMER_START(name) uint64_t name = read_cycles()
+#define TIMER_STOP(name, slot) (thread_counters()->cycles[slot] += read_cycles() - name)
+#else
+#define TIMER_START(name) ((void)0)
+#define TIMER_STOP(name, slot) ((void)0)
+#endif
+
+//search trace, compiled in with -DCHESS_TRACE. A thread records search events in a ring buffer
+//allocated on its first event (CHESS_TRACE_EVENTS events, 1M by default), the newest overwriting
+//the oldest. At exit every ring is written to CHESS_TRACE_FILE (chess.trace by default): a
+//header, then for each thread its event count and events, oldest first. "trace <file>"
+//summarizes one. Without CHESS_TRACE every TRACE_ macro expands to nothing.
+const int TRACE_ENTER = 1, TRACE_EXIT = 2, TRACE_QUIESCENCE = 3, TRACE_NULL_MOVE = 4;
+const int TRACE_TT_MISS = 0, TRACE_TT_HIT = 1, TRACE_TT_CUTOFF = 2;
+const char TRACE_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'T', 'R', '1'};
+#define TRACE_CLOCK_SHIFT 4
+
+//enter: bounds, table move, table outcome in index and the check extension as a negative reduction.
+//exit: best score in alpha, best move, index of the move that cut off (255 for none) and moves
+//searched. null move: its score in alpha, the reduction and index 1 when it cut off.
+struct trace_event
+{
+    uint32_t time;
+    int16_t alpha;
+    int16_t beta;
+    uint16_t move;
+    uint8_t kind;
+    uint8_t ply;
+    int8_t depth;
+    int8_t reduction;
+    uint8_t index;
+    uint8_t moves;
+};
+
+struct trace_file_header
+{
+    char magic[8];
+    uint32_t event_size;
+    uint32_t no_of_threads;
+    double ticks_per_second;
+};
+
+#ifdef CHESS_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct trace_ring
+{
+    struct trace_event *events;
+    uint64_t mask;
+    uint64_t count;
+    struct trace_ring *next;
+};
+
+struct trace_ring *trace_registry = NULL;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local struct trace_ring *local_trace = NULL;
+uint64_t trace_start_ticks;
+double trace_start_seconds;
+
+static inline uint64_t read_trace_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
 
-struct queue* init_queue()
+double trace_seconds()
 {
-    struct queue *new = (struct queue*)malloc(sizeof(struct queue));
-    if(new == NULL)
-    {
-        printf("memory not allocated\n");
-        return NULL;
-    }
-    new->front = new->rear = NULL;
-    return new;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-void enqueue(struct queue *q, struct node *new)
+struct trace_ring* register_trace_ring()
 {
-    if(new == NULL)
+    char *size = getenv("CHESS_TRACE_EVENTS");
+    uint64_t capacity = 1;
+    uint64_t wanted = size != NULL && atoll(size) > 0 ? (uint64_t)atoll(size) : 1 << 20;
+    while(capacity < wanted)
     {
-        return;
+        capacity *= 2;
     }
-    if(q->front == NULL)
+    local_trace = (struct trace_ring*)calloc(1, sizeof(struct trace_ring));
+    if(local_trace == NULL || (local_trace->events = (struct trace_event*)calloc(capacity, sizeof(struct trace_event))) == NULL)
     {
-        q->front = q->rear = new;
+        printf("memory not allocated\n");
+        exit(1);
     }
-    else
+    local_trace->mask = capacity - 1;
+    pthread_mutex_lock(&trace_lock);
+    if(trace_registry == NULL)
     {
-        q->rear->next = new;
-        q->rear = new;
+        trace_start_ticks = read_trace_clock();
+        trace_start_seconds = trace_seconds();
     }
+    local_trace->next = trace_registry;
+    trace_registry = local_trace;
+    pthread_mutex_unlock(&trace_lock);
+    return local_trace;
 }
 
-struct move* dequeue(struct queue *q)
+static inline void trace_event(int kind, int ply, int depth, int alpha, int beta, int move, int index, int moves, int reduction)
 {
-    struct node *temp;
-    if(q->front == NULL)
+    struct trace_ring *ring = local_trace != NULL ? local_trace : register_trace_ring();
+    struct trace_event *event = &ring->events[ring->count++ & ring->mask];
+    event->time = (uint32_t)(read_trace_clock() >> TRACE_CLOCK_SHIFT);
+    event->alpha = (int16_t)alpha;
+    event->beta = (int16_t)beta;
+    event->move = (uint16_t)move;
+    event->kind = (uint8_t)kind;
+    event->ply = (uint8_t)ply;
+    event->depth = (int8_t)(depth < -128 ? -128 : depth > 127 ? 127 : depth);
+    event->reduction = (int8_t)reduction;
+    event->index = (uint8_t)index;
+    event->moves = (uint8_t)(moves > 255 ? 255 : moves);
+}
+
+void dump_trace_at_exit()
+{
+    //modes that never search leave an existing trace alone
+    if(trace_registry == NULL)
     {
-        return NULL;
+        return;
     }
-    else if(q->front == q->rear)
+    char *path = getenv("CHESS_TRACE_FILE");
+    path = path != NULL ? path : "chess.trace";
+    FILE *fp = fopen(path, "wb");
+    if(fp == NULL)
     {
-        temp = q->front;
-        q->front = q->rear = NULL;
+        printf("cannot open %s\n", path);
+        return;
     }
-    else
+    pthread_mutex_lock(&trace_lock);
+    struct trace_file_header header;
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.event_size = sizeof(struct trace_event);
+    header.no_of_threads = 0;
+    for(struct trace_ring *ring = trace_registry; ring != NULL; ring = ring->next)
     {
-        temp = q->front;
-        q->front = q->front->next;
+        header.no_of_threads++;
+    }
+    double seconds = trace_seconds() - trace_start_seconds;
+    header.ticks_per_second = seconds > 0 ? ((read_trace_clock() - trace_start_ticks) >> TRACE_CLOCK_SHIFT) / seconds : 1;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for(struct trace_ring *ring = trace_registry; ring != NULL && ok; ring = ring->next)
+    {
+        uint64_t count = ring->count <= ring->mask ? ring->count : ring->mask + 1;
+        uint64_t first = ring->count - count;
+        ok = fwrite(&count, sizeof(count), 1, fp) == 1;
+        for(uint64_t i = 0; i < count && ok; i++)
+        {
+            ok = fwrite(&ring->events[(first + i) & ring->mask], sizeof(struct trace_event), 1, fp) == 1;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    if(fclose(fp) != 0 || !ok)
+    {
+        printf("cannot write %s\n", path);
     }
+}
 
-    struct move *mv = temp->mv;
-    free(temp);
-    return mv;
+#define TRACE_EVENT(kind, ply, depth, alpha, beta, move, index, moves, reduction) \
+    trace_event(kind, ply, depth, alpha, beta, move, index, moves, reduction)
+#else
+#define TRACE_EVENT(kind, ply, depth, alpha, beta, move, index, moves, reduction) ((void)0)
+#endif
+
+int piece_color(int piece)
+{
+    return piece & 24;
 }
 
-void display_queue(struct queue *q)
+int piece_type(int piece)
 {
-    struct node *front = q->front;
-    int count = 0;
-    while(front != NULL)
-    {
-        printf("src %d dest %d\n", front->mv->src, front->mv->dest);
-        front = front->next;
-        count++;
-    }
-    printf("queue count %d\n", count);
+    return piece & 7;
 }
 
-void free_queue(struct queue *q)
+int is_sliding_piece(int type)
 {
-    struct node *front= q->front;
-    struct node *temp;
-    while(front != NULL)
-    {
-        free(front->mv);
-        temp = front;
-        front = front->next;
-        free(temp);
-    }
-    free(q);
+    return type == BISHOP || type == ROOK || type == QUEEN;
 }
 
-void add_captured_piece(struct captured_pieces *cp, int piece)
+int is_capture(struct move *mv)
 {
-    if(cp->top == 31)
+    return (mv->type & CAPTURES) != 0;
+}
+
+int is_valid_position(int position)
+{
+    return position >= 0 && position <= 63;
+}
+
+int file(int position)
+{
+    return position % 8;
+}
+
+int rank(int position)
+{
+    return position / 8;
+}
+
+int color_index(int color)
+{
+    return color == WHITE ? 0 : 1;
+}
+
+int opposite_color(int color)
+{
+    return color == WHITE ? BLACK : WHITE;
+}
+
+uint64_t square_bit(int position)
+{
+    return 1ULL << position;
+}
+
+int pop_lsb(uint64_t *bits)
+{
+    int position = __builtin_ctzll(*bits);
+    *bits &= *bits - 1;
+    return position;
+}
+
+uint64_t zobrist_pieces[2][7][64];
+uint64_t zobrist_castle[16];
+uint64_t zobrist_en_passant[8];
+uint64_t zobrist_turn;
+
+uint64_t file_masks[8];
+uint64_t adjacent_file_masks[8];
+uint64_t passed_pawn_masks[2][64];
+uint64_t pawn_support_masks[2][64];
+uint64_t pawn_attack_masks[2][64];
+uint64_t pawn_shield_masks[2][64];
+uint64_t between_masks[64][64];
+uint64_t knight_attack_masks[64];
+uint64_t king_attack_masks[64];
+
+uint64_t random_u64(uint64_t *state)
+{
+    //xorshift64*, fixed seed so keys are identical on every run
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+void init_zobrist()
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for(int color = 0; color < 2; color++)
     {
-        printf("stack overflow");
+        for(int type = 0; type < 7; type++)
+        {
+            for(int position = 0; position < 64; position++)
+            {
+                zobrist_pieces[color][type][position] = random_u64(&state);
+            }
+        }
     }
-    else
+    for(int i = 0; i < 16; i++)
     {
-        cp->pieces[++(cp->top)] = piece;
+        zobrist_castle[i] = random_u64(&state);
+    }
+    for(int i = 0; i < 8; i++)
+    {
+        zobrist_en_passant[i] = random_u64(&state);
     }
+    zobrist_turn = random_u64(&state);
 }
 
-int last_captured_piece(struct captured_pieces *cp)
+void init_pawn_masks()
 {
-    int piece = 0;
-    if(cp->top == -1)
+    for(int f = 0; f < 8; f++)
     {
-        printf("stack underflow");
+        file_masks[f] = 0x0101010101010101ULL << f;
     }
-    else
+    for(int f = 0; f < 8; f++)
     {
-        piece = cp->pieces[(cp->top)--];
+        adjacent_file_masks[f] = (f > 0 ? file_masks[f - 1] : 0) | (f < 7 ? file_masks[f + 1] : 0);
     }
-    return piece;
-}
 
-void init_board(int *board)
-{
-    board[0] = board[7] = BLACK | ROOK , board[1] = board[6] = BLACK | KNIGHT,
-    board[2] = board[5] = BLACK | BISHOP, board[3] = BLACK | QUEEN, board[4] = BLACK | KING;
-    for(int i = 8; i <= 15; i++)
+    for(int position = 0; position < 64; position++)
     {
-        board[i] = BLACK | PAWN;
+        int r = rank(position);
+        int f = file(position);
+        uint64_t span = file_masks[f] | adjacent_file_masks[f];
+        uint64_t white_ahead = 0, black_ahead = 0;
+
+        for(int i = r + 1; i < 8; i++)
+        {
+            white_ahead |= 0xFFULL << (i * 8);
+        }
+        for(int i = r - 1; i >= 0; i--)
+        {
+            black_ahead |= 0xFFULL << (i * 8);
+        }
+
+        passed_pawn_masks[0][position] = span & white_ahead;
+        passed_pawn_masks[1][position] = span & black_ahead;
+
+        //friendly pawns on adjacent files level with or behind the pawn
+        pawn_support_masks[0][position] = adjacent_file_masks[f] & ~white_ahead;
+        pawn_support_masks[1][position] = adjacent_file_masks[f] & ~black_ahead;
+
+        pawn_attack_masks[0][position] = pawn_attack_masks[1][position] = 0;
+        pawn_shield_masks[0][position] = pawn_shield_masks[1][position] = 0;
+        if(r < 7)
+        {
+            pawn_attack_masks[0][position] = adjacent_file_masks[f] & (0xFFULL << ((r + 1) * 8));
+            pawn_shield_masks[0][position] = span & (0xFFULL << ((r + 1) * 8));
+        }
+        if(r > 0)
+        {
+            pawn_attack_masks[1][position] = adjacent_file_masks[f] & (0xFFULL << ((r - 1) * 8));
+            pawn_shield_masks[1][position] = span & (0xFFULL << ((r - 1) * 8));
+        }
     }
-    for(int i = 16; i <= 47; i++)
+}
+
+void init_between_masks()
+{
+    const int rank_steps[] = {1, 0, 0, -1, 1, 1, -1, -1};
+    const int file_steps[] = {0, 1, -1, 0, 1, -1, 1, -1};
+
+    for(int position = 0; position < 64; position++)
     {
-        board[i] = 0;
+        for(int target = 0; target < 64; target++)
+        {
+            between_masks[position][target] = 0;
+        }
+        for(int i = 0; i < 8; i++)
+        {
+            uint64_t between = 0;
+            int r = rank(position) + rank_steps[i];
+            int f = file(position) + file_steps[i];
+            while(r >= 0 && r <= 7 && f >= 0 && f <= 7)
+            {
+                between_masks[position][r * 8 + f] = between;
+                between |= square_bit(r * 8 + f);
+                r += rank_steps[i];
+                f += file_steps[i];
+            }
+        }
     }
-    for(int i = 48; i <= 55; i++)
+}
+
+void init_step_masks()
+{
+    const int knight_rank_steps[] = {2, 2, 1, 1, -1, -1, -2, -2};
+    const int knight_file_steps[] = {1, -1, 2, -2, 2, -2, 1, -1};
+    const int king_rank_steps[] = {1, 0, 0, -1, 1, 1, -1, -1};
+    const int king_file_steps[] = {0, 1, -1, 0, 1, -1, 1, -1};
+
+    for(int position = 0; position < 64; position++)
     {
-        board[i] = WHITE | PAWN;
+        knight_attack_masks[position] = king_attack_masks[position] = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            int r = rank(position) + knight_rank_steps[i];
+            int f = file(position) + knight_file_steps[i];
+            knight_attack_masks[position] |= r >= 0 && r <= 7 && f >= 0 && f <= 7 ? square_bit(r * 8 + f) : 0;
+            r = rank(position) + king_rank_steps[i];
+            f = file(position) + king_file_steps[i];
+            king_attack_masks[position] |= r >= 0 && r <= 7 && f >= 0 && f <= 7 ? square_bit(r * 8 + f) : 0;
+        }
     }
-    board[56] = board[63] = WHITE | ROOK , board[57] = board[62] = WHITE | KNIGHT,
-    board[58] = board[61] = WHITE | BISHOP, board[59] = WHITE | QUEEN, board[60] = WHITE | KING;
 }
 
-int fen_char_to_number(char ch)
+void init_tables()
 {
-    int color;
-    if(ch >= 'A' && ch <= 'Z')
+    static int initialized = 0;
+    if(initialized)
     {
-        color = WHITE;
-        ch += 32;
+        return;
     }
-    else
+    init_zobrist();
+    init_pawn_masks();
+    init_between_masks();
+    init_step_masks();
+    initialized = 1;
+}
+
+//squares attacked by the piece on position, a slider's rays end on the first piece
+uint64_t piece_attacks(struct chess_game *game, int position)
+{
+    int piece = game->board[position];
+    int type = piece_type(piece);
+    if(type == PAWN)
     {
-        color = BLACK;
+        return pawn_attack_masks[color_index(piece_color(piece))][position];
     }
-    if(ch == 'p')
+    if(type == KNIGHT)
     {
-        return color | PAWN;
+        return knight_attack_masks[position];
     }
-    else if(ch == 'n')
+    if(type == KING)
     {
-        return color | KNIGHT;
+        return king_attack_masks[position];
     }
-    else if(ch == 'b')
+    uint64_t attacks = 0;
+    for(int i = type == BISHOP ? 4 : 0; i < (type == ROOK ? 4 : 8); i++)
     {
-        return color | BISHOP;
+        int current = position;
+        for(int j = 0; j < game->distance_to_borders[position][i]; j++)
+        {
+            current += DIRECTIONS[i];
+            attacks |= square_bit(current);
+            if(game->board[current] != EMPTY)
+            {
+                break;
+            }
+        }
+    }
+    return attacks;
+}
+
+//adds (sign 1) or removes (sign -1) the attacks of the piece on position
+void toggle_piece_attacks(struct chess_game *game, int position, int sign)
+{
+    struct attack_map *map = &game->attacks;
+    uint64_t attacks = piece_attacks(game, position);
+    int color = color_index(piece_color(game->board[position]));
+    while(attacks != 0)
+    {
+        int target = pop_lsb(&attacks);
+        map->attackers[target] ^= square_bit(position);
+        map->counts[color][target] += sign;
+    }
+}
+
+void build_attack_maps(struct chess_game *game)
+{
+    memset(&game->attacks, 0, sizeof(game->attacks));
+    for(int position = 0; position < 64; position++)
+    {
+        if(game->board[position] != EMPTY)
+        {
+            toggle_piece_attacks(game, position, 1);
+        }
+    }
+}
+
+//from here on make_move keeps the maps and attack tests read them
+void enable_attack_maps(struct chess_game *game)
+{
+    game->track_attacks = 1;
+    build_attack_maps(game);
+}
+
+//a move changes the attacks of the pieces on the squares it empties or fills and of the sliders
+//whose rays reach those squares, nothing else. Called with the changed squares before the move
+//(sign -1) and after it (sign 1) with the sliders found the first time.
+uint64_t update_changed_attacks(struct chess_game *game, uint64_t changed, uint64_t sliders, int sign)
+{
+    uint64_t bits = changed;
+    while(sign < 0 && bits != 0)
+    {
+        uint64_t attackers = game->attacks.attackers[pop_lsb(&bits)] & ~changed;
+        while(attackers != 0)
+        {
+            int position = pop_lsb(&attackers);
+            sliders |= is_sliding_piece(piece_type(game->board[position])) ? square_bit(position) : 0;
+        }
+    }
+    bits = changed | sliders;
+    while(bits != 0)
+    {
+        int position = pop_lsb(&bits);
+        if(game->board[position] != EMPTY)
+        {
+            toggle_piece_attacks(game, position, sign);
+        }
+    }
+    return sliders;
+}
+
+int castle_index(struct chess_game *game)
+{
+    return game->white_castle | (game->black_castle << 2);
+}
+
+uint64_t piece_key(int piece, int position)
+{
+    return zobrist_pieces[color_index(piece_color(piece))][piece_type(piece)][position];
+}
+
+void toggle_piece_key(struct chess_game *game, int piece, int position)
+{
+    uint64_t key = piece_key(piece, position);
+    game->hash ^= key;
+    if(piece_type(piece) == PAWN)
+    {
+        game->pawn_hash ^= key;
+    }
+}
+
+uint64_t compute_hash(struct chess_game *game)
+{
+    uint64_t hash = 0;
+    for(int position = 0; position < 64; position++)
+    {
+        if(game->board[position] != EMPTY)
+        {
+            hash ^= piece_key(game->board[position], position);
+        }
+    }
+    hash ^= zobrist_castle[castle_index(game)];
+    if(game->en_passant != -1)
+    {
+        hash ^= zobrist_en_passant[file(game->en_passant)];
+    }
+    if(game->turn == BLACK)
+    {
+        hash ^= zobrist_turn;
+    }
+    return hash;
+}
+
+uint64_t compute_pawn_hash(struct chess_game *game)
+{
+    uint64_t hash = 0;
+    for(int position = 0; position < 64; position++)
+    {
+        if(piece_type(game->board[position]) == PAWN)
+        {
+            hash ^= piece_key(game->board[position], position);
+        }
+    }
+    return hash;
+}
+
+//allocations made by the move generator and fen parser, per thread, so benchmarks can report allocs/op
+_Thread_local long long allocation_count = 0;
+
+void* counted_malloc(size_t size)
+{
+    allocation_count++;
+    return malloc(size);
+}
+
+struct move* init_move(int source, int dest, int type)
+{
+    struct move *new = (struct move*)counted_malloc(sizeof(struct move));
+    if(new == NULL)
+    {
+        printf("memory not allocated\n");
+        return NULL;
+    }
+    new->src = source;
+    new->dest = dest;
+    new->type = type;
+    STAT_INC(moves_generated[type]);
+    return new;
+}
+
+struct node* init_node(struct move *mv)
+{
+    struct node *new = (struct node*)counted_malloc(sizeof(struct node));
+    if(mv == NULL)
+    {
+        return NULL;
+    }
+    if(new == NULL)
+    {
+        printf("memory not allocated\n");
+        return NULL;
+    }
+
+    new->mv = mv;
+    new->next = NULL;
+    return new;
+}
+
+struct queue* init_queue()
+{
+    struct queue *new = (struct queue*)counted_malloc(sizeof(struct queue));
+    if(new == NULL)
+    {
+        printf("memory not allocated\n");
+        return NULL;
+    }
+    new->front = new->rear = NULL;
+    return new;
+}
+
+void enqueue(struct queue *q, struct node *new)
+{
+    if(new == NULL)
+    {
+        return;
+    }
+    if(q->front == NULL)
+    {
+        q->front = q->rear = new;
+    }
+    else
+    {
+        q->rear->next = new;
+        q->rear = new;
+    }
+}
+
+struct move* dequeue(struct queue *q)
+{
+    struct node *temp;
+    if(q->front == NULL)
+    {
+        return NULL;
+    }
+    else if(q->front == q->rear)
+    {
+        temp = q->front;
+        q->front = q->rear = NULL;
+    }
+    else
+    {
+        temp = q->front;
+        q->front = q->front->next;
+    }
+
+    struct move *mv = temp->mv;
+    free(temp);
+    return mv;
+}
+
+void display_queue(struct queue *q)
+{
+    struct node *front = q->front;
+    int count = 0;
+    while(front != NULL)
+    {
+        printf("src %d dest %d\n", front->mv->src, front->mv->dest);
+        front = front->next;
+        count++;
+    }
+    printf("queue count %d\n", count);
+}
+
+void free_queue(struct queue *q)
+{
+    struct node *front= q->front;
+    struct node *temp;
+    while(front != NULL)
+    {
+        free(front->mv);
+        temp = front;
+        front = front->next;
+        free(temp);
+    }
+    free(q);
+}
+
+void add_captured_piece(struct captured_pieces *cp, int piece)
+{
+    if(cp->top == 31)
+    {
+        printf("stack overflow");
+    }
+    else
+    {
+        cp->pieces[++(cp->top)] = piece;
+    }
+}
+
+int last_captured_piece(struct captured_pieces *cp)
+{
+    int piece = 0;
+    if(cp->top == -1)
+    {
+        printf("stack underflow");
+    }
+    else
+    {
+        piece = cp->pieces[(cp->top)--];
+    }
+    return piece;
+}
+
+void init_board(int *board)
+{
+    board[0] = board[7] = BLACK | ROOK , board[1] = board[6] = BLACK | KNIGHT,
+    board[2] = board[5] = BLACK | BISHOP, board[3] = BLACK | QUEEN, board[4] = BLACK | KING;
+    for(int i = 8; i <= 15; i++)
+    {
+        board[i] = BLACK | PAWN;
+    }
+    for(int i = 16; i <= 47; i++)
+    {
+        board[i] = 0;
+    }
+    for(int i = 48; i <= 55; i++)
+    {
+        board[i] = WHITE | PAWN;
+    }
+    board[56] = board[63] = WHITE | ROOK , board[57] = board[62] = WHITE | KNIGHT,
+    board[58] = board[61] = WHITE | BISHOP, board[59] = WHITE | QUEEN, board[60] = WHITE | KING;
+}
+
+int fen_char_to_number(char ch)
+{
+    int color;
+    if(ch >= 'A' && ch <= 'Z')
+    {
+        color = WHITE;
+        ch += 32;
+    }
+    else
+    {
+        color = BLACK;
+    }
+    if(ch == 'p')
+    {
+        return color | PAWN;
+    }
+    else if(ch == 'n')
+    {
+        return color | KNIGHT;
+    }
+    else if(ch == 'b')
+    {
+        return color | BISHOP;
     }
     else if(ch == 'r')
     {
@@ -344,6 +1066,23 @@ char number_to_fen_char(int piece)
     return PIECE_SYMBOLS[type] - 32;
 }
 
+int write_number(char *string, int index, int number)
+{
+    char digits[12];
+    int count = 0;
+    do
+    {
+        digits[count++] = number % 10 + '0';
+        number /= 10;
+    } while(number > 0);
+
+    while(count > 0)
+    {
+        string[index++] = digits[--count];
+    }
+    return index;
+}
+
 void generate_fen(struct chess_game *game)
 {
     int *board = game->board;
@@ -446,9 +1185,9 @@ void generate_fen(struct chess_game *game)
     }
     fen[fen_index++] = ' ';
 
-    fen[fen_index++] = game->half_moves + '0';
+    fen_index = write_number(fen, fen_index, game->half_moves);
     fen[fen_index++] = ' ';
-    fen[fen_index++] = game->full_moves + '0';
+    fen_index = write_number(fen, fen_index, game->full_moves);
     fen[fen_index] = '\0';
 }
 
@@ -535,6 +1274,7 @@ void update_piece_index(struct piece_list *p_list, int piece_type, struct move*
     int no_of_pieces = p_list->no_of_pieces[piece_type];
     int *pieces = p_list->list[piece_type];
     int src = mv->src;
+    STAT_INC(piece_list_updates);
 
     int updated = 0;
     for(int i = 0; i < no_of_pieces; i++)
@@ -554,6 +1294,7 @@ void update_piece_index(struct piece_list *p_list, int piece_type, struct move*
 
 void add_piece_index(struct piece_list *p_list, int piece_type, int index)
 {
+    STAT_INC(piece_list_adds);
     p_list->list[piece_type][p_list->no_of_pieces[piece_type]++] = index;
 }
 
@@ -563,6 +1304,7 @@ void remove_piece_index(struct piece_list *p_list, int piece_type, int index)
     int *pieces = p_list->list[piece_type];
     int last_piece_index = pieces[no_of_pieces - 1];
     int removed = 0;
+    STAT_INC(piece_list_removes);
 
     for(int i = 0; i < no_of_pieces; i++)
     {
@@ -598,91 +1340,16 @@ void display_piece_list(struct piece_list *p_list)
     }
 }
 
-int is_sliding_piece(int type)
-{
-    return type == BISHOP || type == ROOK || type == QUEEN;
-}
-
-struct queue* generate_moves(struct chess_game *game)
-{
-    struct queue* q = init_queue();
-    if(q == NULL)
-    {
-        return NULL;
-    }
-    
-    struct piece_list *p_list;
-    if(game->turn == WHITE)
-    {
-        p_list = &game->white_piece_list;
-    }
-    else
-    {
-        p_list = &game->black_piece_list;
-    }
-
-    int no_of_pieces;
-    int *pieces_index;
-    for(int type = 1; type < 7; type++)
-    {
-        no_of_pieces = p_list->no_of_pieces[type];
-        if(no_of_pieces == 0)
-        {
-            continue;
-        }
-        pieces_index = p_list->list[type];
-        
-        if(is_sliding_piece(type))
-        {
-            for(int j = 0; j < no_of_pieces; j++)
-            {
-                generate_sliding_moves(game, pieces_index[j], q);
-            }
-        }
-        else if(type == KNIGHT)
-        {
-            for(int j = 0; j < no_of_pieces; j++)
-            {
-                generate_knight_moves(game, pieces_index[j], q);
-            }
-        }
-        else if(type == KING)
-        {
-            generate_king_moves(game, pieces_index[0], q);
-        }
-        else if(type == PAWN)
-        {
-            for(int j = 0; j < no_of_pieces; j++)
-            {
-                generate_pawn_moves(game, pieces_index[j], q);
-            }
-        }
-    }
-    return q;
-}
-
-void generate_sliding_moves(struct chess_game *game, int position, struct queue *q)
+//the generators below are written once with the side to move (and for sliders the direction
+//range) as a constant parameter and always inlined, so every caller gets its own copy with the
+//colour and piece type tests folded away
+
+#define SPECIALIZED static inline __attribute__((always_inline))
+
+SPECIALIZED void generate_slides(struct chess_game *game, int position, struct queue *q, const int us,
+    const int start_direction, const int end_direction)
 {
     int *board = game->board;
-    int type = piece_type(board[position]);
-    int start_direction, end_direction;
-
-    if(type == ROOK)
-    {
-        start_direction = 0;
-        end_direction = 3;
-    }
-    else if(type == BISHOP)
-    {
-        start_direction = 4;
-        end_direction = 7;
-    }
-    else if(type == QUEEN)
-    {
-        start_direction = 0;
-        end_direction = 7;
-    }
-
     int no_of_steps, direction, current_position;
     for(int i = start_direction; i <= end_direction; i++)
     {
@@ -694,7 +1361,7 @@ void generate_sliding_moves(struct chess_game *game, int position, struct queue
             current_position += direction;
             if(board[current_position] != EMPTY)
             {
-                if(piece_color(board[current_position]) != game->turn)
+                if(piece_color(board[current_position]) != us)
                 {
                     enqueue(q, init_node(init_move(position, current_position, CAPTURES)));
                 }
@@ -705,91 +1372,71 @@ void generate_sliding_moves(struct chess_game *game, int position, struct queue
     }
 }
 
-void generate_knight_moves(struct chess_game *game, int pos, struct queue *q)//
+SPECIALIZED void add_knight_move(int *board, int pos, int dest, struct queue *q, const int us)
+{
+    if(piece_color(board[dest]) != us)
+    {
+        int move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
+        enqueue(q, init_node(init_move(pos, dest, move_type)));
+    }
+}
+
+SPECIALIZED void generate_knight_moves_for(struct chess_game *game, int pos, struct queue *q, const int us)
 {
     int *board = game->board;
     int r = rank(pos);
     int f = file(pos);
-    int turn_color = game->turn;
-    int dest;
-    int move_type;
 
-    dest = pos + S + S + E;
-    if(r > 1 && f < 7 && piece_color(board[dest]) != turn_color)
+    if(r > 1 && f < 7)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + S + S + E, q, us);
     }
-    dest = pos + N + N + E;
-    if(r < 6 && f < 7 && piece_color(board[dest]) != turn_color)
+    if(r < 6 && f < 7)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + N + N + E, q, us);
     }
-    dest = pos + N + N + W;
-    if(r < 6 && f > 0 && piece_color(board[dest]) != turn_color)
+    if(r < 6 && f > 0)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + N + N + W, q, us);
     }
-    dest = pos + S + S + W;
-    if(r > 1 && f > 0 && piece_color(board[dest]) != turn_color)
+    if(r > 1 && f > 0)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + S + S + W, q, us);
     }
-    dest = pos + S + E + E;
-    if(r > 0 && f < 6 && piece_color(board[dest]) != turn_color)
+    if(r > 0 && f < 6)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + S + E + E, q, us);
     }
-    dest = pos + N + E + E;
-    if(r < 7 && f < 6 && piece_color(board[dest]) != turn_color)
+    if(r < 7 && f < 6)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + N + E + E, q, us);
     }
-    dest = pos + N + W + W;
-    if(r < 7 && f > 1 && piece_color(board[dest]) != turn_color)
+    if(r < 7 && f > 1)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + N + W + W, q, us);
     }
-    dest = pos + S + W + W;
-    if(r > 0 && f > 1 && piece_color(board[dest]) != turn_color)
+    if(r > 0 && f > 1)
     {
-        move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
-        enqueue(q, init_node(init_move(pos, dest, move_type)));
+        add_knight_move(board, pos, pos + S + W + W, q, us);
     }
 }
 
-void generate_king_moves(struct chess_game *game, int position, struct queue *q)
+SPECIALIZED void generate_king_moves_for(struct chess_game *game, int position, struct queue *q, const int us)
 {
     int *board = game->board;
     int move_type;
-    int turn = game->turn;
 
     for(int i = 0; i <= 7; i++)
     {
         int dest = position + DIRECTIONS[i];
-        if(game->distance_to_borders[position][i] > 0 && piece_color(board[dest]) != turn)
+        if(game->distance_to_borders[position][i] > 0 && piece_color(board[dest]) != us)
         {
             move_type = board[dest] == EMPTY ? QUIET_MOVE : CAPTURES;
             enqueue(q, init_node(init_move(position, dest, move_type)));
         }
     }
 
-    int castle;
-    if(turn == WHITE)
-    {
-        castle = game->white_castle;
-    }
-    else
-    {
-        castle = game->black_castle;
-    }
-
+    int castle = us == WHITE ? game->white_castle : game->black_castle;
     if(castle == 0)
     {
         return;
@@ -798,7 +1445,7 @@ void generate_king_moves(struct chess_game *game, int position, struct queue *q)
     {
         enqueue(q, init_node(init_move(position, position + E + E, KING_CASTLE)));
     }
-    if((castle & 1) == 1 && board[position + W] == EMPTY && board[position + W + W] == EMPTY)
+    if((castle & 1) == 1 && board[position + W] == EMPTY && board[position + W + W] == EMPTY && board[position + 3 * W] == EMPTY)
     {
         enqueue(q, init_node(init_move(position, position + W + W, QUEEN_CASTLE)));
     }
@@ -812,129 +1459,186 @@ void add_pawn_promotions(int position, int dest, int captures, struct queue *q)
     enqueue(q, init_node(init_move(position, dest, BISHOP_PROMOTION | captures)));
 }
 
-void generate_promotion_moves(struct chess_game *game, int position, int direction, struct queue *q)
+SPECIALIZED void generate_promotion_moves(struct chess_game *game, int position, int direction, struct queue *q, const int us)
 {
-    int turn = game->turn;
     int *board = game->board;
     int fle = file(position);
     if(board[position + direction]  == EMPTY)
     {
         add_pawn_promotions(position, position + direction, 0, q);
     }
-    if(fle < 7 && board[position + direction + E] != EMPTY && piece_color(board[position + direction + E]) != turn)
+    if(fle < 7 && board[position + direction + E] != EMPTY && piece_color(board[position + direction + E]) != us)
     {
         add_pawn_promotions(position, position + direction + E, CAPTURES, q);
     }
-    if(fle > 0 && board[position + direction + W] != EMPTY && piece_color(board[position + direction + W]) != turn)
+    if(fle > 0 && board[position + direction + W] != EMPTY && piece_color(board[position + direction + W]) != us)
     {
         add_pawn_promotions(position, position + direction + W, CAPTURES, q);
     }
 }
 
-void generate_pawn_moves(struct chess_game *game, int position, struct queue *q)
+SPECIALIZED void generate_pawn_moves_for(struct chess_game *game, int position, struct queue *q, const int us)
 {
-    int color = game->turn;
-    int rnk = rank(position);
+    const int them = us == WHITE ? BLACK : WHITE;
+    const int forward = us == WHITE ? N : S;
+    //rank counted from the pawn's own side of the board
+    int rnk = us == WHITE ? rank(position) : 7 - rank(position);
     int fle = file(position);
     int *board = game->board;
+    int ahead = position + forward;
 
-    if(color == WHITE)
+    if(rnk < 6 && board[ahead] == EMPTY)
     {
-        int north = position + N;
-        int north_east = position + NE;
-        int north_west = position + NW;
+        enqueue(q, init_node(init_move(position, ahead, QUIET_MOVE)));
+    }
+    if(rnk < 6 && fle < 7 && piece_color(board[ahead + E]) == them)
+    {
+        enqueue(q, init_node(init_move(position, ahead + E, CAPTURES)));
+    }
+    if(rnk < 6 && fle > 0 && piece_color(board[ahead + W]) == them)
+    {
+        enqueue(q, init_node(init_move(position, ahead + W, CAPTURES)));
+    }
 
-        if(rnk < 6 && board[north] == EMPTY)
-        {
-            enqueue(q, init_node(init_move(position, north, QUIET_MOVE)));
-        }
-        if(rnk < 6 && fle < 7 && piece_color(board[north_east]) == BLACK)
+    if(rnk == 1 && board[ahead] == EMPTY && board[ahead + forward] == EMPTY)
+    {
+        enqueue(q, init_node(init_move(position, ahead + forward, DOUBLE_PAWN_PUSH)));
+    }
+    else if(rnk == 6)
+    {
+        generate_promotion_moves(game, position, forward, q, us);
+    }
+    else if(rnk == 4 && game->en_passant != -1)
+    {
+        if(fle < 7 && ahead + E == game->en_passant)
         {
-            enqueue(q, init_node(init_move(position, north_east, CAPTURES)));
+            enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
         }
-        if(rnk < 6 && fle > 0 && piece_color(board[north_west]) == BLACK)
+        if(fle > 0 && ahead + W == game->en_passant)
         {
-            enqueue(q, init_node(init_move(position, north_west, CAPTURES)));
+            enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
         }
+    }
+}
 
-        if(rnk == 1 && board[north] == EMPTY && board[north + N] == EMPTY)
-        {
-            int dest = north + N;
-            enqueue(q, init_node(init_move(position, dest, DOUBLE_PAWN_PUSH)));
-            int dest_file = file(dest);
-            if(dest_file > 0  && piece_color(board[dest + W]) == BLACK && piece_type(board[dest + W]) == PAWN)
-            {
-                game->en_passant = dest + S;
-            }
-            else if(dest_file < 7  && piece_color(board[dest + E]) == BLACK && piece_type(board[dest + E]) == PAWN)
-            {
-                game->en_passant = dest + S;
-            }
-        }
-        else if(rnk == 6)
-        {
-            generate_promotion_moves(game, position, N, q);
-        }
-        else if(rnk == 4 && game->en_passant != -1)
-        {
-            if(fle < 7 && position + NE == game->en_passant)
-            {
-                enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
-            }
-            if(fle > 0 && position + NW == game->en_passant)
-            {
-                enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
-            }
-        }
+SPECIALIZED void generate_moves_for(struct chess_game *game, struct queue *q, const int us)
+{
+    struct piece_list *p_list = us == WHITE ? &game->white_piece_list : &game->black_piece_list;
+    int *pieces_index;
+
+    if(p_list->no_of_pieces[KING] > 0)
+    {
+        generate_king_moves_for(game, p_list->list[KING][0], q, us);
+    }
+    pieces_index = p_list->list[QUEEN];
+    for(int j = 0; j < p_list->no_of_pieces[QUEEN]; j++)
+    {
+        generate_slides(game, pieces_index[j], q, us, 0, 7);
+    }
+    pieces_index = p_list->list[ROOK];
+    for(int j = 0; j < p_list->no_of_pieces[ROOK]; j++)
+    {
+        generate_slides(game, pieces_index[j], q, us, 0, 3);
+    }
+    pieces_index = p_list->list[BISHOP];
+    for(int j = 0; j < p_list->no_of_pieces[BISHOP]; j++)
+    {
+        generate_slides(game, pieces_index[j], q, us, 4, 7);
+    }
+    pieces_index = p_list->list[KNIGHT];
+    for(int j = 0; j < p_list->no_of_pieces[KNIGHT]; j++)
+    {
+        generate_knight_moves_for(game, pieces_index[j], q, us);
+    }
+    pieces_index = p_list->list[PAWN];
+    for(int j = 0; j < p_list->no_of_pieces[PAWN]; j++)
+    {
+        generate_pawn_moves_for(game, pieces_index[j], q, us);
+    }
+}
+
+void generate_white_moves(struct chess_game *game, struct queue *q)
+{
+    generate_moves_for(game, q, WHITE);
+}
+
+void generate_black_moves(struct chess_game *game, struct queue *q)
+{
+    generate_moves_for(game, q, BLACK);
+}
+
+struct queue* generate_moves(struct chess_game *game)
+{
+    STAT_INC(generate_moves_calls);
+    TIMER_START(movegen_start);
+    struct queue* q = init_queue();
+    if(q == NULL)
+    {
+        return NULL;
+    }
+
+    if(game->turn == WHITE)
+    {
+        generate_white_moves(game, q);
     }
     else
     {
-        int south = position + S;
-        int south_east = position + SE;
-        int south_west = position + SW;
+        generate_black_moves(game, q);
+    }
+    TIMER_STOP(movegen_start, TIMER_MOVEGEN);
+    return q;
+}
 
-        if(rnk > 1 && board[south] == EMPTY)
-        {
-            enqueue(q, init_node(init_move(position, south, QUIET_MOVE)));
-        }
-        if(rnk > 1 && fle > 7 && piece_color(board[south_east]) == WHITE)
-        {
-            enqueue(q, init_node(init_move(position, south_east, CAPTURES)));
-        }
-        if(rnk > 1 && fle > 0 && piece_color(board[south_west]) == WHITE)
-        {
-            enqueue(q, init_node(init_move(position, south_west, CAPTURES)));
-        }
+//single piece entry points, these pick the specialised generator at run time
+void generate_sliding_moves(struct chess_game *game, int position, struct queue *q)
+{
+    int type = piece_type(game->board[position]);
+    int start_direction = type == BISHOP ? 4 : 0;
+    int end_direction = type == ROOK ? 3 : 7;
 
-        if(rnk == 6 && board[south] == EMPTY && board[south + S] == EMPTY)
-        {
-            int dest = south + S;
-            enqueue(q, init_node(init_move(position, dest, DOUBLE_PAWN_PUSH)));
-            int dest_file = file(dest);
-            if(dest_file > 0  && piece_color(board[dest + W]) == WHITE && piece_type(board[dest + W]) == PAWN)
-            {
-                game->en_passant = dest + N;
-            }
-            else if(dest_file < 7  && piece_color(board[dest + E]) == WHITE && piece_type(board[dest + E]) == PAWN)
-            {
-                game->en_passant = dest + N;
-            }
-        }
-        else if(rnk == 1)
-        {
-            generate_promotion_moves(game, position, S, q);
-        }
-        else if(rnk == 3 && game->en_passant != -1)
-        {
-            if(fle < 7 && position + SE == game->en_passant)
-            {
-                enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
-            }
-            if(fle > 0 && position + SW == game->en_passant)
-            {
-                enqueue(q, init_node(init_move(position, game->en_passant, ENPASSANT_CAPTURE)));
-            }
-        }
+    if(game->turn == WHITE)
+    {
+        generate_slides(game, position, q, WHITE, start_direction, end_direction);
+    }
+    else
+    {
+        generate_slides(game, position, q, BLACK, start_direction, end_direction);
+    }
+}
+
+void generate_knight_moves(struct chess_game *game, int pos, struct queue *q)
+{
+    if(game->turn == WHITE)
+    {
+        generate_knight_moves_for(game, pos, q, WHITE);
+    }
+    else
+    {
+        generate_knight_moves_for(game, pos, q, BLACK);
+    }
+}
+
+void generate_king_moves(struct chess_game *game, int position, struct queue *q)
+{
+    if(game->turn == WHITE)
+    {
+        generate_king_moves_for(game, position, q, WHITE);
+    }
+    else
+    {
+        generate_king_moves_for(game, position, q, BLACK);
+    }
+}
+
+void generate_pawn_moves(struct chess_game *game, int position, struct queue *q)
+{
+    if(game->turn == WHITE)
+    {
+        generate_pawn_moves_for(game, position, q, WHITE);
+    }
+    else
+    {
+        generate_pawn_moves_for(game, position, q, BLACK);
     }
 }
 
@@ -1001,7 +1705,7 @@ int init_fen(struct fen *fn, char *fen_string)
     {
         if(fen_string[i] == ' ')
         {
-            strings[string_count] = (char *)malloc(sizeof(char) * (i - start) + 1);
+            strings[string_count] = (char *)counted_malloc(sizeof(char) * (i - start) + 1);
             if(strings[string_count] == NULL)
             {
                 free_strings(strings, 6);
@@ -1013,7 +1717,7 @@ int init_fen(struct fen *fn, char *fen_string)
         }
     }
     
-    strings[string_count] = (char *)malloc(sizeof(char) * (i - start) + 1);
+    strings[string_count] = (char *)counted_malloc(sizeof(char) * (i - start) + 1);
     if(strings[string_count] == NULL)
     {
         free_strings(strings, 6);
@@ -1088,6 +1792,17 @@ int init_fen(struct fen *fn, char *fen_string)
     return 1;
 }
 
+int can_capture_en_passant(int *board, int en_passant)
+{
+    int pawn = en_passant < 32 ? en_passant + N : en_passant + S;
+    if(piece_type(board[pawn]) != PAWN)
+    {
+        return 0;
+    }
+    int enemy_pawn = opposite_color(piece_color(board[pawn])) | PAWN;
+    return (file(pawn) > 0 && board[pawn + W] == enemy_pawn) || (file(pawn) < 7 && board[pawn + E] == enemy_pawn);
+}
+
 void init_chess_game(struct chess_game *game, struct fen *fn)
 {
     game->turn = fn->turn;
@@ -1099,58 +1814,104 @@ void init_chess_game(struct chess_game *game, struct fen *fn)
     generate_steps_to_edges(game->distance_to_borders);
     init_board_from_fen(game->board, fn->piece_placement);
     init_piece_list(game);
+    game->captured_piece_list.top = -1;
+    init_tables();
+    //like make_move, only keep an en passant square some pawn can take, so equal positions hash equal
+    if(game->en_passant != -1 && !can_capture_en_passant(game->board, game->en_passant))
+    {
+        game->en_passant = -1;
+    }
+    game->hash = compute_hash(game);
+    game->pawn_hash = compute_pawn_hash(game);
+    game->history = NULL;
+    game->history_ply = 0;
+    game->track_attacks = 0;
     generate_fen(game);
 }
 
-void make_move(struct chess_game *game, struct move *mv)
+void update_castling_rights(struct chess_game *game, int position)
+{
+    if(position == 4)
+    {
+        game->white_castle = 0;
+    }
+    else if(position == 0)
+    {
+        game->white_castle &= 2;
+    }
+    else if(position == 7)
+    {
+        game->white_castle &= 1;
+    }
+    else if(position == 60)
+    {
+        game->black_castle = 0;
+    }
+    else if(position == 56)
+    {
+        game->black_castle &= 2;
+    }
+    else if(position == 63)
+    {
+        game->black_castle &= 1;
+    }
+}
+
+SPECIALIZED void make_move_for(struct chess_game *game, struct move *mv, const int turn)
 {
     int *board = game->board;
     int src = mv->src;
     int dest = mv->dest;
-    int turn = game->turn;
+    int moving_piece = board[src];
+    int captured_piece = EMPTY;
+    STAT_INC(make_move_calls[mv->type]);
+    TIMER_START(make_move_start);
 
-    struct piece_list *turn_piece_list, *opposite_piece_list;
-    if(turn == WHITE)
-    {
-        turn_piece_list = &game->white_piece_list;
-        opposite_piece_list = &game->black_piece_list;
-    }
-    else
+    struct piece_list *turn_piece_list = turn == WHITE ? &game->white_piece_list : &game->black_piece_list;
+    struct piece_list *opposite_piece_list = turn == WHITE ? &game->black_piece_list : &game->white_piece_list;
+
+    uint64_t changed = 0, sliders = 0;
+    if(game->track_attacks)
     {
-        turn_piece_list = &game->black_piece_list;
-        opposite_piece_list = &game->white_piece_list;
+        changed = square_bit(src) | square_bit(dest);
+        changed |= mv->type == ENPASSANT_CAPTURE ? square_bit(turn == BLACK ? dest + N : dest + S) : 0;
+        changed |= mv->type == KING_CASTLE ? square_bit(src + 3 * E) | square_bit(dest + W) : 0;
+        changed |= mv->type == QUEEN_CASTLE ? square_bit(src + 4 * W) | square_bit(dest + E) : 0;
+        sliders = update_changed_attacks(game, changed, 0, -1);
     }
 
     int move_type = mv->type;
     if(move_type == QUIET_MOVE || move_type == DOUBLE_PAWN_PUSH)
     {
         update_piece_index(turn_piece_list, piece_type(board[src]), mv);
+        toggle_piece_key(game, moving_piece, src);
+        toggle_piece_key(game, moving_piece, dest);
         board[dest] = board[src];
         board[src] = 0;
     }
     else if(move_type == CAPTURES)
     {
+        captured_piece = board[dest];
         add_captured_piece(&game->captured_piece_list, board[dest]);
         remove_piece_index(opposite_piece_list, piece_type(board[dest]), dest);
         update_piece_index(turn_piece_list, piece_type(board[src]), mv);
+        toggle_piece_key(game, captured_piece, dest);
+        toggle_piece_key(game, moving_piece, src);
+        toggle_piece_key(game, moving_piece, dest);
         board[dest] = board[src];
         board[src] = 0;
     }
     else if(move_type == ENPASSANT_CAPTURE)
     {
-        if(turn == BLACK)
-        {
-            add_captured_piece(&game->captured_piece_list, board[dest + N]);
-            remove_piece_index(opposite_piece_list, PAWN, dest + N);
-            board[dest + N] = 0;
-        }
-        else
-        {
-            add_captured_piece(&game->captured_piece_list, board[dest + S]);
-            remove_piece_index(opposite_piece_list, PAWN, dest + S);
-            board[dest + S] = 0;
-        }
+        int captured_position = turn == BLACK ? dest + N : dest + S;
+        captured_piece = board[captured_position];
+        add_captured_piece(&game->captured_piece_list, captured_piece);
+        remove_piece_index(opposite_piece_list, PAWN, captured_position);
+        toggle_piece_key(game, captured_piece, captured_position);
+        board[captured_position] = 0;
         update_piece_index(turn_piece_list, piece_type(board[src]), mv);
+        toggle_piece_key(game, moving_piece, src);
+        toggle_piece_key(game, moving_piece, dest);
         board[dest] = board[src];
         board[src] = 0;
     }
@@ -1161,6 +1922,10 @@ void make_move(struct chess_game *game, struct move *mv)
         update_piece_index(turn_piece_list, KING, mv);
         struct move rook_move = {src + 3 * E, dest + W};
         update_piece_index(turn_piece_list, ROOK, &rook_move);
+        toggle_piece_key(game, king, src);
+        toggle_piece_key(game, king, dest);
+        toggle_piece_key(game, rook, src + 3 * E);
+        toggle_piece_key(game, rook, dest + W);
         board[dest] = king;
         board[src] = 0;
         board[dest + W] = rook;
@@ -1173,6 +1938,10 @@ void make_move(struct chess_game *game, struct move *mv)
         update_piece_index(turn_piece_list, KING, mv);
         struct move rook_move = {src + 4 * W, dest + E};
         update_piece_index(turn_piece_list, ROOK, &rook_move);
+        toggle_piece_key(game, king, src);
+        toggle_piece_key(game, king, dest);
+        toggle_piece_key(game, rook, src + 4 * W);
+        toggle_piece_key(game, rook, dest + E);
         board[dest] = king;
         board[src] = 0;
         board[dest + E] = rook;
@@ -1183,10 +1952,13 @@ void make_move(struct chess_game *game, struct move *mv)
         if((move_type & 4) == 4)//captured promotion
         {
             move_type = move_type & 11;//setting capture bit to 0
+            captured_piece = board[dest];
             add_captured_piece(&game->captured_piece_list, board[dest]);
             remove_piece_index(opposite_piece_list, piece_type(board[dest]), dest);
+            toggle_piece_key(game, captured_piece, dest);
         }
         remove_piece_index(turn_piece_list, PAWN, src);
+        toggle_piece_key(game, moving_piece, src);
         board[src] = 0;
         if(move_type == QUEEN_PROMOTION)
         {
@@ -1208,27 +1980,9881 @@ void make_move(struct chess_game *game, struct move *mv)
             add_piece_index(turn_piece_list, BISHOP, dest);
             board[dest] = turn | BISHOP;
         }
+        toggle_piece_key(game, board[dest], dest);
+    }
+    if(game->track_attacks)
+    {
+        update_changed_attacks(game, changed, sliders, 1);
     }
-}
 
-int main()
-{
-    struct chess_game game;
-    char fen_string[] =  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
-    // char fen_string[] = "8/8/8/8/p7/8/8/8 b KQkq - 0 3";
+    if(game->en_passant != -1)
+    {
+        game->hash ^= zobrist_en_passant[file(game->en_passant)];
+        game->en_passant = -1;
+    }
+    if(mv->type == DOUBLE_PAWN_PUSH)
+    {
+        //only record the en passant square when an enemy pawn can take it
+        int enemy_pawn = opposite_color(turn) | PAWN;
+        if((file(dest) > 0 && board[dest + W] == enemy_pawn) || (file(dest) < 7 && board[dest + E] == enemy_pawn))
+        {
+            game->en_passant = (src + dest) / 2;
+            game->hash ^= zobrist_en_passant[file(game->en_passant)];
+        }
+    }
 
-    struct fen fn;
+    if(game->white_castle != 0 || game->black_castle != 0)
+    {
+        game->hash ^= zobrist_castle[castle_index(game)];
+        update_castling_rights(game, src);
+        update_castling_rights(game, dest);
+        game->hash ^= zobrist_castle[castle_index(game)];
+    }
 
-    init_fen(&fn, fen_string);
-    init_chess_game(&game, &fn);
-    display_name_board(game.board);
-    printf("%s\n", game.fen);
-    display_piece_list(&game.white_piece_list);
-    // display_piece_list(&game.black_piece_list);
-    struct queue* q = generate_moves(&game);
-    // display_queue(q);
-    free_queue(q);
-    return 0;
+    if(piece_type(moving_piece) == PAWN || captured_piece != EMPTY)
+    {
+        game->half_moves = 0;
+    }
+    else
+    {
+        game->half_moves++;
+    }
+    if(turn == BLACK)
+    {
+        game->full_moves++;
+    }
+    game->turn = opposite_color(turn);
+    game->hash ^= zobrist_turn;
+    if(game->history != NULL)
+    {
+        game->history->keys[++game->history_ply & (HISTORY_SIZE - 1)] = game->hash;
+    }
+    TIMER_STOP(make_move_start, TIMER_MAKE_MOVE);
+}
+
+void make_white_move(struct chess_game *game, struct move *mv)
+{
+    make_move_for(game, mv, WHITE);
+}
+
+void make_black_move(struct chess_game *game, struct move *mv)
+{
+    make_move_for(game, mv, BLACK);
+}
+
+void make_move(struct chess_game *game, struct move *mv)
+{
+    if(game->turn == WHITE)
+    {
+        make_white_move(game, mv);
+    }
+    else
+    {
+        make_black_move(game, mv);
+    }
+}
+
+const int KNIGHT_RANK_STEPS[] = {2, 2, 1, 1, -1, -1, -2, -2};
+const int KNIGHT_FILE_STEPS[] = {1, -1, 2, -2, 2, -2, 1, -1};
+
+SPECIALIZED int is_square_attacked_by(struct chess_game *game, int position, const int by_color)
+{
+    int *board = game->board;
+    int r = rank(position);
+    int f = file(position);
+    int pawn = by_color | PAWN;
+
+    if(by_color == WHITE)
+    {
+        if(r > 0 && f > 0 && board[position + SW] == pawn)
+        {
+            return 1;
+        }
+        if(r > 0 && f < 7 && board[position + SE] == pawn)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        if(r < 7 && f > 0 && board[position + NW] == pawn)
+        {
+            return 1;
+        }
+        if(r < 7 && f < 7 && board[position + NE] == pawn)
+        {
+            return 1;
+        }
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+        int target_rank = r + KNIGHT_RANK_STEPS[i];
+        int target_file = f + KNIGHT_FILE_STEPS[i];
+        if(target_rank >= 0 && target_rank <= 7 && target_file >= 0 && target_file <= 7 &&
+            board[target_rank * 8 + target_file] == (by_color | KNIGHT))
+        {
+            return 1;
+        }
+    }
+
+    for(int i = 0; i <= 7; i++)
+    {
+        int no_of_steps = game->distance_to_borders[position][i];
+        int direction = DIRECTIONS[i];
+        int slider = i < 4 ? ROOK : BISHOP;
+        int current_position = position;
+        for(int j = 0; j < no_of_steps; j++)
+        {
+            current_position += direction;
+            int piece = board[current_position];
+            if(piece == EMPTY)
+            {
+                continue;
+            }
+            if(piece == (by_color | QUEEN) || piece == (by_color | slider) || (j == 0 && piece == (by_color | KING)))
+            {
+                return 1;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+int is_attacked_by_white(struct chess_game *game, int position)
+{
+    return is_square_attacked_by(game, position, WHITE);
+}
+
+int is_attacked_by_black(struct chess_game *game, int position)
+{
+    return is_square_attacked_by(game, position, BLACK);
+}
+
+int is_square_attacked(struct chess_game *game, int position, int by_color)
+{
+    if(game->track_attacks)
+    {
+        return game->attacks.counts[color_index(by_color)][position] != 0;
+    }
+    return by_color == WHITE ? is_attacked_by_white(game, position) : is_attacked_by_black(game, position);
+}
+
+int is_in_check(struct chess_game *game, int color)
+{
+    struct piece_list *p_list = color == WHITE ? &game->white_piece_list : &game->black_piece_list;
+    if(p_list->no_of_pieces[KING] == 0)
+    {
+        return 0;
+    }
+    return is_square_attacked(game, p_list->list[KING][0], opposite_color(color));
+}
+
+int is_legal_move(struct chess_game *game, struct move *mv)
+{
+    int turn = game->turn;
+    int enemy = opposite_color(turn);
+
+    if(mv->type == KING_CASTLE || mv->type == QUEEN_CASTLE)
+    {
+        int step = mv->type == KING_CASTLE ? E : W;
+        if(is_square_attacked(game, mv->src, enemy) || is_square_attacked(game, mv->src + step, enemy))
+        {
+            return 0;
+        }
+    }
+
+    struct chess_game copy = *game;
+    make_move(&copy, mv);
+    return !is_in_check(&copy, turn);
+}
+
+struct queue* generate_legal_moves(struct chess_game *game)
+{
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return NULL;
+    }
+
+    struct node *current = q->front;
+    q->front = q->rear = NULL;
+    while(current != NULL)
+    {
+        struct node *next = current->next;
+        current->next = NULL;
+        if(is_legal_move(game, current->mv))
+        {
+            enqueue(q, current);
+        }
+        else
+        {
+            free(current->mv);
+            free(current);
+        }
+        current = next;
+    }
+    return q;
+}
+
+int count_legal_moves(struct chess_game *game)
+{
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return 0;
+    }
+
+    int count = 0;
+    struct move *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        count += is_legal_move(game, mv);
+        free(mv);
+    }
+    free(q);
+    return count;
+}
+
+//starts recording the game's keys, the current position becomes ply 0
+void attach_key_history(struct chess_game *game, struct key_history *history)
+{
+    game->history = history;
+    game->history_ply = 0;
+    history->keys[0] = game->hash;
+}
+
+//earlier occurrences of the current position since the last irreversible move. Only every second
+//key can match since the side to move must be the same.
+int count_repetitions(struct chess_game *game)
+{
+    if(game->history == NULL)
+    {
+        return 0;
+    }
+    int window = min(min(game->half_moves, game->history_ply), HISTORY_SIZE - 1);
+    int count = 0;
+    for(int back = 4; back <= window; back += 2)
+    {
+        count += game->history->keys[(game->history_ply - back) & (HISTORY_SIZE - 1)] == game->hash;
+    }
+    return count;
+}
+
+//search treats the first repetition as a draw, games are only drawn at the third occurrence
+int is_repetition(struct chess_game *game)
+{
+    if(game->history == NULL)
+    {
+        return 0;
+    }
+    int window = min(min(game->half_moves, game->history_ply), HISTORY_SIZE - 1);
+    for(int back = 4; back <= window; back += 2)
+    {
+        if(game->history->keys[(game->history_ply - back) & (HISTORY_SIZE - 1)] == game->hash)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//a hundred half moves without a capture or pawn move, unless the last one gave mate
+int is_fifty_move_draw(struct chess_game *game)
+{
+    return game->half_moves >= 100 && (!is_in_check(game, game->turn) || count_legal_moves(game) > 0);
+}
+
+int is_draw(struct chess_game *game)
+{
+    return is_fifty_move_draw(game) || is_repetition(game);
+}
+
+//long algebraic moves as in uci ("e2e4", "e7e8q"), returns the matching legal move or NULL
+struct move* parse_move(struct chess_game *game, char *text)
+{
+    int length = strlen(text);
+    if(length < 4 || length > 5 || text[0] < 'a' || text[0] > 'h' || text[1] < '1' || text[1] > '8' ||
+        text[2] < 'a' || text[2] > 'h' || text[3] < '1' || text[3] > '8')
+    {
+        return NULL;
+    }
+    int src = en_passant_position(text), dest = en_passant_position(text + 2);
+
+    struct queue *q = generate_legal_moves(game);
+    if(q == NULL)
+    {
+        return NULL;
+    }
+    struct move *found = NULL, *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        char promotion = mv->type >= KNIGHT_PROMOTION ? "nbrq"[mv->type & 3] : '\0';
+        if(found == NULL && mv->src == src && mv->dest == dest && promotion == text[4])
+        {
+            found = mv;
+        }
+        else
+        {
+            free(mv);
+        }
+    }
+    free(q);
+    return found;
+}
+
+//uci long algebraic form, text needs room for 6 characters
+void move_to_string(struct move *mv, char *text)
+{
+    text[0] = 'a' + file(mv->src);
+    text[1] = '1' + rank(mv->src);
+    text[2] = 'a' + file(mv->dest);
+    text[3] = '1' + rank(mv->dest);
+    text[4] = mv->type >= KNIGHT_PROMOTION ? "nbrq"[mv->type & 3] : '\0';
+    text[5] = '\0';
+}
+
+//copies the next space separated word of text into word, returns the rest of text or NULL at the end
+char* next_word(char *text, char *word, int size)
+{
+    while(*text == ' ')
+    {
+        text++;
+    }
+    if(*text == '\0')
+    {
+        return NULL;
+    }
+    int length = 0;
+    while(text[length] != ' ' && text[length] != '\0')
+    {
+        if(length < size - 1)
+        {
+            word[length] = text[length];
+        }
+        length++;
+    }
+    word[length < size - 1 ? length : size - 1] = '\0';
+    return text + length;
+}
+
+char START_POSITION_FEN[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+char START_POSITION_LINE[] = "startpos";
+
+//"startpos [moves ...]" or "fen <six fields> [moves ...]", sets up the game and returns the move list
+//(possibly empty), or NULL when the position cannot be read
+char* parse_position_line(struct chess_game *game, char *line)
+{
+    char fen_string[100], word[100];
+    struct fen fn;
+    char *rest = next_word(line, word, sizeof(word));
+    if(rest == NULL)
+    {
+        return NULL;
+    }
+
+    if(strcmp(word, "startpos") == 0)
+    {
+        string_cpy(fen_string, START_POSITION_FEN);
+    }
+    else if(strcmp(word, "fen") == 0)
+    {
+        int length = 0;
+        for(int field = 0; field < 6; field++)
+        {
+            rest = next_word(rest, word, sizeof(word));
+            if(rest == NULL || length + strlen(word) + 1 >= sizeof(fen_string))
+            {
+                return NULL;
+            }
+            length += sprintf(fen_string + length, field == 0 ? "%s" : " %s", word);
+        }
+    }
+    else
+    {
+        return NULL;
+    }
+    if(!init_fen(&fn, fen_string))
+    {
+        return NULL;
+    }
+    init_chess_game(game, &fn);
+
+    char *moves = next_word(rest, word, sizeof(word));
+    return moves != NULL && strcmp(word, "moves") == 0 ? moves : rest;
+}
+
+//standard algebraic notation with the check or mate suffix, text needs room for 8 characters
+void move_to_san(struct chess_game *game, struct move *mv, char *text)
+{
+    int length = 0, type = piece_type(game->board[mv->src]);
+    if(mv->type == KING_CASTLE || mv->type == QUEEN_CASTLE)
+    {
+        length = sprintf(text, mv->type == KING_CASTLE ? "O-O" : "O-O-O");
+    }
+    else
+    {
+        if(type == PAWN)
+        {
+            text[length] = 'a' + file(mv->src);
+            length += is_capture(mv);
+        }
+        else
+        {
+            //file, rank or both when another piece of the kind can go to the same square
+            int same_file = 0, same_rank = 0, others = 0;
+            struct queue *q = generate_legal_moves(game);
+            struct move *other;
+            while(q != NULL && (other = dequeue(q)) != NULL)
+            {
+                if(other->dest == mv->dest && other->src != mv->src && game->board[other->src] == game->board[mv->src])
+                {
+                    others++;
+                    same_file += file(other->src) == file(mv->src);
+                    same_rank += rank(other->src) == rank(mv->src);
+                }
+                free(other);
+            }
+            free(q);
+            text[length++] = PIECE_SYMBOLS[type] - 'a' + 'A';
+            if(others > 0 && (same_file == 0 || same_rank > 0))
+            {
+                text[length++] = 'a' + file(mv->src);
+            }
+            if(others > 0 && same_file > 0)
+            {
+                text[length++] = '1' + rank(mv->src);
+            }
+        }
+        if(is_capture(mv))
+        {
+            text[length++] = 'x';
+        }
+        text[length++] = 'a' + file(mv->dest);
+        text[length++] = '1' + rank(mv->dest);
+        if(mv->type >= KNIGHT_PROMOTION)
+        {
+            text[length++] = '=';
+            text[length++] = "NBRQ"[mv->type & 3];
+        }
+    }
+    struct chess_game child = *game;
+    make_move(&child, mv);
+    if(is_in_check(&child, child.turn))
+    {
+        text[length++] = count_legal_moves(&child) == 0 ? '#' : '+';
+    }
+    text[length] = '\0';
+}
+
+//drops capture, check, mate and annotation marks, spells castling with letters and adds a
+//missing '=', so "exd8Q+" and "exd8=Q" both read "ed8=Q"
+void normalize_san(char *san, char *text, int size)
+{
+    int length = 0;
+    for(int i = 0; san[i] != '\0' && length < size - 2; i++)
+    {
+        char ch = san[i] == '0' ? 'O' : san[i];
+        if(strchr("x-:+#!?", ch) != NULL)
+        {
+            continue;
+        }
+        if(strchr("NBRQ", ch) != NULL && length > 0 && text[length - 1] >= '1' && text[length - 1] <= '8')
+        {
+            text[length++] = '=';
+        }
+        text[length++] = ch;
+    }
+    text[length] = '\0';
+}
+
+//finds the legal move written in standard algebraic notation, with both origin coordinates
+//("Nh1g3"), or in uci form
+int parse_san_move(struct chess_game *game, char *san, struct move *mv)
+{
+    char wanted[16], text[16], full[16], uci[6];
+    normalize_san(san, wanted, sizeof(wanted));
+    struct queue *q = generate_legal_moves(game);
+    struct move *candidate;
+    int found = 0;
+    while(q != NULL && (candidate = dequeue(q)) != NULL)
+    {
+        if(!found)
+        {
+            move_to_san(game, candidate, text);
+            normalize_san(text, text, sizeof(text));
+            int type = piece_type(game->board[candidate->src]);
+            int length = type == PAWN ? 0 : sprintf(full, "%c", PIECE_SYMBOLS[type] - 'a' + 'A');
+            move_to_string(candidate, full + length);
+            if(candidate->type >= KNIGHT_PROMOTION)
+            {
+                sprintf(full + length + 4, "=%c", "NBRQ"[candidate->type & 3]);
+            }
+            move_to_string(candidate, uci);
+            if(strcmp(text, wanted) == 0 || strcmp(full, wanted) == 0 || strcmp(uci, san) == 0)
+            {
+                *mv = *candidate;
+                found = 1;
+            }
+        }
+        free(candidate);
+    }
+    free(q);
+    return found;
+}
+
+//an epd line is the first four fen fields followed by operations ("bm Nf6; id \"name\";"). The
+//position is read as a fen with the hmvc and fmvn operations as its clocks, the operations are
+//copied to operations.
+int init_epd(struct fen *fn, char *epd, char *operations, int size)
+{
+    char fields[4][100], word[100], fen_string[512];
+    char *rest = epd;
+    for(int i = 0; i < 4; i++)
+    {
+        rest = next_word(rest, fields[i], sizeof(fields[i]));
+        if(rest == NULL)
+        {
+            return 0;
+        }
+    }
+    while(*rest == ' ')
+    {
+        rest++;
+    }
+    snprintf(operations, size, "%s", rest);
+
+    int half_moves = 0, full_moves = 1;
+    char *hmvc = strstr(operations, "hmvc "), *fmvn = strstr(operations, "fmvn ");
+    half_moves = hmvc != NULL && next_word(hmvc + 5, word, sizeof(word)) != NULL ? atoi(word) : half_moves;
+    full_moves = fmvn != NULL && next_word(fmvn + 5, word, sizeof(word)) != NULL ? atoi(word) : full_moves;
+    snprintf(fen_string, sizeof(fen_string), "%s %s %s %s %d %d", fields[0], fields[1], fields[2], fields[3], half_moves, full_moves > 0 ? full_moves : 1);
+    return init_fen(fn, fen_string);
+}
+
+//the operands of opcode as one string ("Qd1 Qd3" for "bm Qd1 Qd3;"), without quotes
+int epd_operation(char *operations, char *opcode, char *operands, int size)
+{
+    int length = strlen(opcode);
+    char *p = operations;
+    while(*p != '\0')
+    {
+        while(*p == ' ' || *p == ';')
+        {
+            p++;
+        }
+        char *end = p;
+        int quoted = 0;
+        while(*end != '\0' && (*end != ';' || quoted))
+        {
+            quoted ^= *end == '"';
+            end++;
+        }
+        if(strncmp(p, opcode, length) == 0 && p[length] == ' ')
+        {
+            int written = 0;
+            for(char *q = p + length + 1; q < end && written < size - 1; q++)
+            {
+                if(*q != '"')
+                {
+                    operands[written++] = *q;
+                }
+            }
+            operands[written] = '\0';
+            return 1;
+        }
+        p = end;
+    }
+    return 0;
+}
+
+struct eval_params
+{
+    int piece_value[7];
+    int piece_square[7][64];
+    int passed_pawn[8];
+    int isolated_pawn;
+    int doubled_pawn;
+    int backward_pawn;
+    int pawn_shield;
+};
+
+//piece square tables are laid out from white's side, rank 8 first
+struct eval_params default_eval_params =
+{
+    {0, 0, 900, 500, 330, 320, 100},
+    {
+        {0},
+        {
+            -30,-40,-40,-50,-50,-40,-40,-30,
+            -30,-40,-40,-50,-50,-40,-40,-30,
+            -30,-40,-40,-50,-50,-40,-40,-30,
+            -30,-40,-40,-50,-50,-40,-40,-30,
+            -20,-30,-30,-40,-40,-30,-30,-20,
+            -10,-20,-20,-20,-20,-20,-20,-10,
+             20, 20,  0,  0,  0,  0, 20, 20,
+             20, 30, 10,  0,  0, 10, 30, 20
+        },
+        {
+            -20,-10,-10, -5, -5,-10,-10,-20,
+            -10,  0,  0,  0,  0,  0,  0,-10,
+            -10,  0,  5,  5,  5,  5,  0,-10,
+             -5,  0,  5,  5,  5,  5,  0, -5,
+              0,  0,  5,  5,  5,  5,  0, -5,
+            -10,  5,  5,  5,  5,  5,  0,-10,
+            -10,  0,  5,  0,  0,  0,  0,-10,
+            -20,-10,-10, -5, -5,-10,-10,-20
+        },
+        {
+              0,  0,  0,  0,  0,  0,  0,  0,
+              5, 10, 10, 10, 10, 10, 10,  5,
+             -5,  0,  0,  0,  0,  0,  0, -5,
+             -5,  0,  0,  0,  0,  0,  0, -5,
+             -5,  0,  0,  0,  0,  0,  0, -5,
+             -5,  0,  0,  0,  0,  0,  0, -5,
+             -5,  0,  0,  0,  0,  0,  0, -5,
+              0,  0,  0,  5,  5,  0,  0,  0
+        },
+        {
+            -20,-10,-10,-10,-10,-10,-10,-20,
+            -10,  0,  0,  0,  0,  0,  0,-10,
+            -10,  0,  5, 10, 10,  5,  0,-10,
+            -10,  5,  5, 10, 10,  5,  5,-10,
+            -10,  0, 10, 10, 10, 10,  0,-10,
+            -10, 10, 10, 10, 10, 10, 10,-10,
+            -10,  5,  0,  0,  0,  0,  5,-10,
+            -20,-10,-10,-10,-10,-10,-10,-20
+        },
+        {
+            -50,-40,-30,-30,-30,-30,-40,-50,
+            -40,-20,  0,  0,  0,  0,-20,-40,
+            -30,  0, 10, 15, 15, 10,  0,-30,
+            -30,  5, 15, 20, 20, 15,  5,-30,
+            -30,  0, 15, 20, 20, 15,  0,-30,
+            -30,  5, 10, 15, 15, 10,  5,-30,
+            -40,-20,  0,  5,  5,  0,-20,-40,
+            -50,-40,-30,-30,-30,-30,-40,-50
+        },
+        {
+              0,  0,  0,  0,  0,  0,  0,  0,
+             50, 50, 50, 50, 50, 50, 50, 50,
+             10, 10, 20, 30, 30, 20, 10, 10,
+              5,  5, 10, 25, 25, 10,  5,  5,
+              0,  0,  0, 20, 20,  0,  0,  0,
+              5, -5,-10,  0,  0,-10, -5,  5,
+              5, 10, 10,-20,-20, 10, 10,  5,
+              0,  0,  0,  0,  0,  0,  0,  0
+        }
+    },
+    {0, 5, 10, 20, 35, 60, 100, 0},
+    -10,
+    -10,
+    -8,
+    10
+};
+
+struct pawn_entry
+{
+    uint64_t key;
+    uint64_t pawns[2];
+    uint64_t passed[2];
+    int score;
+};
+
+struct pawn_table
+{
+    struct pawn_entry *entries;
+    uint64_t mask;
+    long long probes;
+    long long hits;
+};
+
+int piece_square_index(int color, int position)
+{
+    return color == WHITE ? position ^ 56 : position;
+}
+
+int init_pawn_table(struct pawn_table *table, int no_of_entries)
+{
+    int size = 1;
+    while(size * 2 <= no_of_entries)
+    {
+        size *= 2;
+    }
+    table->entries = (struct pawn_entry*)calloc(size, sizeof(struct pawn_entry));
+    if(table->entries == NULL)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    table->mask = size - 1;
+    table->probes = table->hits = 0;
+    return 1;
+}
+
+void clear_pawn_table(struct pawn_table *table)
+{
+    for(uint64_t i = 0; i <= table->mask; i++)
+    {
+        table->entries[i].key = 0;
+        table->entries[i].pawns[0] = table->entries[i].pawns[1] = 0;
+        table->entries[i].passed[0] = table->entries[i].passed[1] = 0;
+        table->entries[i].score = 0;
+    }
+    table->probes = table->hits = 0;
+}
+
+void free_pawn_table(struct pawn_table *table)
+{
+    free(table->entries);
+    table->entries = NULL;
+}
+
+uint64_t pawn_bitboard(struct piece_list *p_list)
+{
+    uint64_t pawns = 0;
+    for(int i = 0; i < p_list->no_of_pieces[PAWN]; i++)
+    {
+        pawns |= square_bit(p_list->list[PAWN][i]);
+    }
+    return pawns;
+}
+
+const int PAWN_PASSED = 1, PAWN_ISOLATED = 2, PAWN_BACKWARD = 4, PAWN_DOUBLED = 8;
+
+//the structure terms that apply to the pawn of side (0 white) on position
+int classify_pawn(uint64_t own, uint64_t enemy, int side, int position)
+{
+    int f = file(position);
+    uint64_t ahead = passed_pawn_masks[side][position];
+    int stop = side == 0 ? position + N : position + S;
+    int kind = 0;
+    if((enemy & ahead) == 0 && (own & ahead & file_masks[f]) == 0)
+    {
+        kind |= PAWN_PASSED;
+    }
+    if((own & adjacent_file_masks[f]) == 0)
+    {
+        kind |= PAWN_ISOLATED;
+    }
+    else if((own & pawn_support_masks[side][position]) == 0 && (enemy & pawn_attack_masks[side][stop]) != 0)
+    {
+        kind |= PAWN_BACKWARD;
+    }
+    if((own & ahead & file_masks[f]) != 0)
+    {
+        kind |= PAWN_DOUBLED;
+    }
+    return kind;
+}
+
+void evaluate_pawn_structure(struct chess_game *game, struct eval_params *params, struct pawn_entry *entry)
+{
+    entry->key = game->pawn_hash;
+    entry->pawns[0] = pawn_bitboard(&game->white_piece_list);
+    entry->pawns[1] = pawn_bitboard(&game->black_piece_list);
+    entry->score = 0;
+
+    for(int side = 0; side < 2; side++)
+    {
+        uint64_t own = entry->pawns[side];
+        uint64_t enemy = entry->pawns[1 - side];
+        uint64_t bits = own;
+        int value = 0;
+        entry->passed[side] = 0;
+
+        while(bits != 0)
+        {
+            int position = pop_lsb(&bits);
+            int kind = classify_pawn(own, enemy, side, position);
+            if(kind & PAWN_PASSED)
+            {
+                entry->passed[side] |= square_bit(position);
+                value += params->passed_pawn[side == 0 ? rank(position) : 7 - rank(position)];
+            }
+            value += kind & PAWN_ISOLATED ? params->isolated_pawn : 0;
+            value += kind & PAWN_BACKWARD ? params->backward_pawn : 0;
+            value += kind & PAWN_DOUBLED ? params->doubled_pawn : 0;
+        }
+        entry->score += side == 0 ? value : -value;
+    }
+}
+
+struct pawn_entry* probe_pawn_table(struct pawn_table *table, struct chess_game *game, struct eval_params *params)
+{
+    struct pawn_entry *entry = &table->entries[game->pawn_hash & table->mask];
+    table->probes++;
+    if(entry->key == game->pawn_hash)
+    {
+        table->hits++;
+        return entry;
+    }
+    evaluate_pawn_structure(game, params, entry);
+    return entry;
+}
+
+int material_score(struct piece_list *p_list, int color, struct eval_params *params)
+{
+    int score = 0;
+    for(int type = 1; type < 7; type++)
+    {
+        int *pieces = p_list->list[type];
+        for(int i = 0; i < p_list->no_of_pieces[type]; i++)
+        {
+            score += params->piece_value[type] + params->piece_square[type][piece_square_index(color, pieces[i])];
+        }
+    }
+    return score;
+}
+
+//score in centipawns from the side to move's point of view
+int evaluate(struct chess_game *game, struct eval_params *params, struct pawn_table *table)
+{
+    STAT_INC(evaluate_calls);
+    TIMER_START(evaluate_start);
+    struct pawn_entry local_entry;
+    struct pawn_entry *entry;
+    if(table != NULL)
+    {
+        entry = probe_pawn_table(table, game, params);
+    }
+    else
+    {
+        evaluate_pawn_structure(game, params, &local_entry);
+        entry = &local_entry;
+    }
+
+    int score = material_score(&game->white_piece_list, WHITE, params) - material_score(&game->black_piece_list, BLACK, params);
+    score += entry->score;
+
+    if(game->white_piece_list.no_of_pieces[KING] > 0)
+    {
+        int king = game->white_piece_list.list[KING][0];
+        score += params->pawn_shield * __builtin_popcountll(entry->pawns[0] & pawn_shield_masks[0][king]);
+    }
+    if(game->black_piece_list.no_of_pieces[KING] > 0)
+    {
+        int king = game->black_piece_list.list[KING][0];
+        score -= params->pawn_shield * __builtin_popcountll(entry->pawns[1] & pawn_shield_masks[1][king]);
+    }
+
+    TIMER_STOP(evaluate_start, TIMER_EVALUATE);
+    return game->turn == WHITE ? score : -score;
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+#define BATCH_KERNEL_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define BATCH_KERNEL_TARGETS
+#endif
+
+#define BATCH_LANES 4
+
+typedef uint64_t batch_lanes __attribute__((vector_size(8 * BATCH_LANES)));
+
+//lanes are shifted with macros so no 32 byte vector is ever passed by value
+#define SHIFT_LANES(bits, shift) ((shift) > 0 ? (bits) << (shift) : (bits) >> -(shift))
+#define STEP_LANES(bits, direction) (SHIFT_LANES(bits, DIRECTIONS[direction]) & DIRECTION_WRAPS[direction])
+
+const uint64_t NOT_FILE_A = 0xFEFEFEFEFEFEFEFEULL, NOT_FILE_H = 0x7F7F7F7F7F7F7F7FULL;
+const uint64_t RANK_3 = 0x0000000000FF0000ULL, RANK_8 = 0xFF00000000000000ULL;
+const uint64_t DIRECTION_WRAPS[] = {~0ULL, 0xFEFEFEFEFEFEFEFEULL, 0x7F7F7F7F7F7F7F7FULL, ~0ULL,
+0xFEFEFEFEFEFEFEFEULL, 0x7F7F7F7F7F7F7F7FULL, 0xFEFEFEFEFEFEFEFEULL, 0x7F7F7F7F7F7F7F7FULL};
+const int KNIGHT_SHIFTS[] = {17, 15, 10, 6, -6, -10, -15, -17};
+const uint64_t KNIGHT_WRAPS[] = {0xFEFEFEFEFEFEFEFEULL, 0x7F7F7F7F7F7F7F7FULL, 0xFCFCFCFCFCFCFCFCULL, 0x3F3F3F3F3F3F3F3FULL,
+0xFCFCFCFCFCFCFCFCULL, 0x3F3F3F3F3F3F3F3FULL, 0xFEFEFEFEFEFEFEFEULL, 0x7F7F7F7F7F7F7F7FULL};
+
+//flags set by the batch kernel for positions it could not finish on its own
+const int BATCH_IN_CHECK = 1, BATCH_PIN_RISK = 2;
+
+//structure of arrays: every field holds one entry per position. Boards are stored from the
+//side to move's point of view (flipped vertically when black is to move), so the kernel
+//always generates moves for a side that plays up the board.
+struct position_batch
+{
+    int count;
+    int capacity;
+    uint64_t *pieces[2][7];
+    uint64_t *castle;
+    uint64_t *en_passant;
+    int *flipped;
+    int *flags;
+    int *move_count;
+    int *mobility;
+    uint64_t *attacks[2];
+};
+
+//the lane helpers only take and return vectors through pointers, so they are safe to call
+//from both the avx2 and the default build of the kernel
+
+//kogge-stone fill, every square the sliders attack in one direction
+static inline void slide_lanes(batch_lanes *attacks, const batch_lanes *sliders, const batch_lanes *empty_squares, int direction)
+{
+    int shift = DIRECTIONS[direction];
+    batch_lanes pieces = *sliders;
+    batch_lanes empty = *empty_squares & DIRECTION_WRAPS[direction];
+    pieces |= empty & SHIFT_LANES(pieces, shift);
+    empty &= SHIFT_LANES(empty, shift);
+    pieces |= empty & SHIFT_LANES(pieces, 2 * shift);
+    empty &= SHIFT_LANES(empty, 2 * shift);
+    pieces |= empty & SHIFT_LANES(pieces, 4 * shift);
+    *attacks = STEP_LANES(pieces, direction);
+}
+
+static inline void add_popcount_lanes(batch_lanes *total, const batch_lanes *bits, uint64_t mask, int weight)
+{
+    batch_lanes x = *bits & mask;
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x += x >> 8;
+    x += x >> 16;
+    x += x >> 32;
+    *total += (x & 0x7F) * (uint64_t)weight;
+}
+
+static inline void enemy_attack_lanes(batch_lanes *attacks, const batch_lanes *them, const batch_lanes *empty)
+{
+    batch_lanes rooks = them[ROOK] | them[QUEEN];
+    batch_lanes bishops = them[BISHOP] | them[QUEEN];
+    batch_lanes slider_attacks;
+
+    *attacks = ((them[PAWN] >> 7) & NOT_FILE_A) | ((them[PAWN] >> 9) & NOT_FILE_H);
+    for(int i = 0; i < 8; i++)
+    {
+        slide_lanes(&slider_attacks, i < 4 ? &rooks : &bishops, empty, i);
+        *attacks |= SHIFT_LANES(them[KNIGHT], KNIGHT_SHIFTS[i]) & KNIGHT_WRAPS[i];
+        *attacks |= STEP_LANES(them[KING], i) | slider_attacks;
+    }
+}
+
+BATCH_KERNEL_TARGETS
+void count_batch_lanes(struct position_batch *batch, int start, int end)
+{
+    uint64_t results[3][BATCH_LANES];
+
+    for(int index = start; index < end; index += BATCH_LANES)
+    {
+        batch_lanes us[7], them[7];
+        batch_lanes us_all = {0}, them_all = {0};
+        for(int type = 1; type < 7; type++)
+        {
+            memcpy(&us[type], &batch->pieces[0][type][index], sizeof(batch_lanes));
+            memcpy(&them[type], &batch->pieces[1][type][index], sizeof(batch_lanes));
+            us_all |= us[type];
+            them_all |= them[type];
+        }
+
+        batch_lanes empty = ~(us_all | them_all);
+        batch_lanes targets = ~us_all;
+        batch_lanes us_rooks = us[ROOK] | us[QUEEN];
+        batch_lanes us_bishops = us[BISHOP] | us[QUEEN];
+        batch_lanes them_rooks = them[ROOK] | them[QUEEN];
+        batch_lanes them_bishops = them[BISHOP] | them[QUEEN];
+        batch_lanes all_squares = ~(batch_lanes){0};
+
+        //squares the king may not step to, sliders see through the king itself
+        batch_lanes see_through_king = empty | us[KING];
+        batch_lanes them_attacks, danger;
+        enemy_attack_lanes(&them_attacks, them, &empty);
+        enemy_attack_lanes(&danger, them, &see_through_king);
+
+        batch_lanes mobility = {0}, illegal = {0}, pin_risk = {0};
+        batch_lanes us_attacks = ((us[PAWN] << 9) & NOT_FILE_A) | ((us[PAWN] << 7) & NOT_FILE_H);
+
+        for(int i = 0; i < 8; i++)
+        {
+            batch_lanes slider_moves, king_lines;
+            //rays from different sliders in one direction never overlap, so one count per direction is exact
+            slide_lanes(&slider_moves, i < 4 ? &us_rooks : &us_bishops, &empty, i);
+            slide_lanes(&king_lines, &us[KING], &all_squares, i);
+            batch_lanes knight_moves = SHIFT_LANES(us[KNIGHT], KNIGHT_SHIFTS[i]) & KNIGHT_WRAPS[i];
+            batch_lanes king_moves = STEP_LANES(us[KING], i);
+            batch_lanes unsafe_king_moves = king_moves & targets & danger;
+
+            us_attacks |= knight_moves | king_moves | slider_moves;
+            knight_moves &= targets;
+            king_moves &= targets;
+            slider_moves &= targets;
+            add_popcount_lanes(&mobility, &knight_moves, ~0ULL, 1);
+            add_popcount_lanes(&mobility, &king_moves, ~0ULL, 1);
+            add_popcount_lanes(&mobility, &slider_moves, ~0ULL, 1);
+            add_popcount_lanes(&illegal, &unsafe_king_moves, ~0ULL, 1);
+            pin_risk |= king_lines & (i < 4 ? them_rooks : them_bishops);
+        }
+
+        batch_lanes en_passant;
+        memcpy(&en_passant, &batch->en_passant[index], sizeof(batch_lanes));
+        batch_lanes single_push = (us[PAWN] << 8) & empty;
+        batch_lanes double_push = ((single_push & RANK_3) << 8) & empty;
+        batch_lanes east_captures = (us[PAWN] << 9) & NOT_FILE_A & them_all;
+        batch_lanes west_captures = (us[PAWN] << 7) & NOT_FILE_H & them_all;
+        batch_lanes en_passant_pawns = us[PAWN] & (((en_passant >> 9) & NOT_FILE_H) | ((en_passant >> 7) & NOT_FILE_A));
+
+        //moves onto the last rank count once per promotion piece
+        add_popcount_lanes(&mobility, &single_push, ~RANK_8, 1);
+        add_popcount_lanes(&mobility, &single_push, RANK_8, 4);
+        add_popcount_lanes(&mobility, &east_captures, ~RANK_8, 1);
+        add_popcount_lanes(&mobility, &east_captures, RANK_8, 4);
+        add_popcount_lanes(&mobility, &west_captures, ~RANK_8, 1);
+        add_popcount_lanes(&mobility, &west_captures, RANK_8, 4);
+        add_popcount_lanes(&mobility, &double_push, ~0ULL, 1);
+        add_popcount_lanes(&mobility, &en_passant_pawns, ~0ULL, 1);
+
+        batch_lanes castle;
+        memcpy(&castle, &batch->castle[index], sizeof(batch_lanes));
+        batch_lanes king_home = (us[KING] >> 4) & 1;
+        batch_lanes king_side = king_home & (castle >> 1) & (empty >> 5) & (empty >> 6) & 1;
+        batch_lanes queen_side = king_home & castle & (empty >> 1) & (empty >> 2) & (empty >> 3) & 1;
+        mobility += king_side + queen_side;
+        illegal += king_side & ((them_attacks >> 5) | (them_attacks >> 6));
+        illegal += queen_side & ((them_attacks >> 3) | (them_attacks >> 2));
+
+        batch_lanes flags = ((batch_lanes)((us[KING] & them_attacks) != 0) & BATCH_IN_CHECK) |
+            ((batch_lanes)(pin_risk != 0) & BATCH_PIN_RISK);
+        batch_lanes move_count = mobility - illegal;
+
+        memcpy(results[0], &mobility, sizeof(mobility));
+        memcpy(results[1], &move_count, sizeof(move_count));
+        memcpy(results[2], &flags, sizeof(flags));
+        memcpy(&batch->attacks[0][index], &us_attacks, sizeof(us_attacks));
+        memcpy(&batch->attacks[1][index], &them_attacks, sizeof(them_attacks));
+        for(int lane = 0; lane < BATCH_LANES; lane++)
+        {
+            batch->mobility[index + lane] = (int)results[0][lane];
+            batch->move_count[index + lane] = (int)results[1][lane];
+            batch->flags[index + lane] = (int)results[2][lane];
+        }
+    }
+}
+
+int init_position_batch(struct position_batch *batch, int capacity)
+{
+    capacity = (capacity + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+    batch->count = 0;
+    batch->capacity = capacity;
+
+    uint64_t **arrays[] = {&batch->castle, &batch->en_passant, &batch->attacks[0], &batch->attacks[1]};
+    for(int i = 0; i < 4; i++)
+    {
+        *arrays[i] = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+    }
+    for(int side = 0; side < 2; side++)
+    {
+        batch->pieces[side][0] = NULL;
+        for(int type = 1; type < 7; type++)
+        {
+            batch->pieces[side][type] = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+        }
+    }
+    batch->flipped = (int*)calloc(capacity, sizeof(int));
+    batch->flags = (int*)calloc(capacity, sizeof(int));
+    batch->move_count = (int*)calloc(capacity, sizeof(int));
+    batch->mobility = (int*)calloc(capacity, sizeof(int));
+
+    int allocated = batch->castle && batch->en_passant && batch->attacks[0] && batch->attacks[1] &&
+        batch->flipped && batch->flags && batch->move_count && batch->mobility;
+    for(int type = 1; type < 7; type++)
+    {
+        allocated = allocated && batch->pieces[0][type] && batch->pieces[1][type];
+    }
+    if(!allocated)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    return 1;
+}
+
+void free_position_batch(struct position_batch *batch)
+{
+    for(int side = 0; side < 2; side++)
+    {
+        for(int type = 1; type < 7; type++)
+        {
+            free(batch->pieces[side][type]);
+        }
+        free(batch->attacks[side]);
+    }
+    free(batch->castle);
+    free(batch->en_passant);
+    free(batch->flipped);
+    free(batch->flags);
+    free(batch->move_count);
+    free(batch->mobility);
+}
+
+uint64_t piece_list_bitboard(struct piece_list *p_list, int type)
+{
+    uint64_t bits = 0;
+    for(int i = 0; i < p_list->no_of_pieces[type]; i++)
+    {
+        bits |= square_bit(p_list->list[type][i]);
+    }
+    return bits;
+}
+
+int batch_add_position(struct position_batch *batch, struct chess_game *game)
+{
+    if(batch->count == batch->capacity)
+    {
+        return -1;
+    }
+
+    int index = batch->count++;
+    int flip = game->turn == BLACK;
+    struct piece_list *us = flip ? &game->black_piece_list : &game->white_piece_list;
+    struct piece_list *them = flip ? &game->white_piece_list : &game->black_piece_list;
+
+    for(int type = 1; type < 7; type++)
+    {
+        uint64_t us_bits = piece_list_bitboard(us, type);
+        uint64_t them_bits = piece_list_bitboard(them, type);
+        batch->pieces[0][type][index] = flip ? __builtin_bswap64(us_bits) : us_bits;
+        batch->pieces[1][type][index] = flip ? __builtin_bswap64(them_bits) : them_bits;
+    }
+    batch->castle[index] = flip ? game->black_castle : game->white_castle;
+    batch->en_passant[index] = 0;
+    if(game->en_passant != -1)
+    {
+        batch->en_passant[index] = square_bit(flip ? game->en_passant ^ 56 : game->en_passant);
+    }
+    batch->flipped[index] = flip;
+    return index;
+}
+
+void batch_position_to_game(struct position_batch *batch, int index, struct chess_game *game)
+{
+    int flip = batch->flipped[index];
+    int colors[2] = {flip ? BLACK : WHITE, flip ? WHITE : BLACK};
+
+    for(int position = 0; position < 64; position++)
+    {
+        game->board[position] = EMPTY;
+    }
+    for(int side = 0; side < 2; side++)
+    {
+        for(int type = 1; type < 7; type++)
+        {
+            uint64_t bits = batch->pieces[side][type][index];
+            bits = flip ? __builtin_bswap64(bits) : bits;
+            while(bits != 0)
+            {
+                game->board[pop_lsb(&bits)] = colors[side] | type;
+            }
+        }
+    }
+
+    game->turn = colors[0];
+    game->white_castle = flip ? 0 : (int)batch->castle[index];
+    game->black_castle = flip ? (int)batch->castle[index] : 0;
+    game->en_passant = -1;
+    if(batch->en_passant[index] != 0)
+    {
+        int position = __builtin_ctzll(batch->en_passant[index]);
+        game->en_passant = flip ? position ^ 56 : position;
+    }
+    game->half_moves = 0;
+    game->full_moves = 1;
+    game->captured_piece_list.top = -1;
+    generate_steps_to_edges(game->distance_to_borders);
+    init_piece_list(game);
+    init_tables();
+    game->hash = compute_hash(game);
+    game->pawn_hash = compute_pawn_hash(game);
+    game->history = NULL;
+    game->history_ply = 0;
+    game->track_attacks = 0;
+}
+
+//the kernel only flags a possible pin, a real one needs exactly one of our pieces between
+int batch_has_pin(struct position_batch *batch, int index)
+{
+    uint64_t us_all = 0, them_all = 0;
+    for(int type = 1; type < 7; type++)
+    {
+        us_all |= batch->pieces[0][type][index];
+        them_all |= batch->pieces[1][type][index];
+    }
+
+    int king = __builtin_ctzll(batch->pieces[0][KING][index]);
+    uint64_t rooks = batch->pieces[1][ROOK][index] | batch->pieces[1][QUEEN][index];
+    uint64_t bishops = batch->pieces[1][BISHOP][index] | batch->pieces[1][QUEEN][index];
+    uint64_t orthogonal = file_masks[file(king)] | (0xFFULL << (rank(king) * 8));
+    uint64_t sliders = (rooks & orthogonal) | (bishops & ~orthogonal);
+
+    //en passant removes two pieces from one rank at once
+    if(batch->en_passant[index] != 0 && (rooks & (0xFFULL << (rank(king) * 8))) != 0)
+    {
+        return 1;
+    }
+
+    //and uncovers a diagonal through either the captured pawn or the target square
+    if(batch->en_passant[index] != 0)
+    {
+        uint64_t en_passant_squares = batch->en_passant[index] | (batch->en_passant[index] >> 8);
+        uint64_t diagonals = bishops;
+        while(diagonals != 0)
+        {
+            if((between_masks[king][pop_lsb(&diagonals)] & en_passant_squares) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    while(sliders != 0)
+    {
+        uint64_t blockers = between_masks[king][pop_lsb(&sliders)] & (us_all | them_all);
+        if(blockers != 0 && (blockers & (blockers - 1)) == 0 && (blockers & us_all) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//returns how many positions had to be finished by the single position path
+int count_batch_moves(struct position_batch *batch)
+{
+    int slow_path = 0;
+    count_batch_lanes(batch, 0, batch->count);
+
+    for(int index = 0; index < batch->count; index++)
+    {
+        int flags = batch->flags[index];
+        if((flags & BATCH_IN_CHECK) != 0 || ((flags & BATCH_PIN_RISK) != 0 && batch_has_pin(batch, index)))
+        {
+            struct chess_game game;
+            batch_position_to_game(batch, index, &game);
+            batch->move_count[index] = count_legal_moves(&game);
+            slow_path++;
+        }
+
+        uint64_t us_attacks = batch->attacks[0][index];
+        uint64_t them_attacks = batch->attacks[1][index];
+        if(batch->flipped[index])
+        {
+            batch->attacks[0][index] = __builtin_bswap64(them_attacks);
+            batch->attacks[1][index] = __builtin_bswap64(us_attacks);
+        }
+    }
+    return slow_path;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char *SAMPLE_FENS[] =
+{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "2kr3r/pp1q1ppp/2n1bn2/2bpp3/4P3/2NP1N2/PPPBBPPP/R2QK2R b KQ - 3 9",
+    "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 b - - 0 1",
+    "8/5b2/8/3pP3/8/8/K7/7k w - d6 0 1"
+};
+const int NO_OF_SAMPLE_FENS = 11;
+
+int load_fen_lines(char *path, char ***fens)
+{
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+
+    int count = 0, capacity = 1024;
+    char line[256];
+    *fens = (char**)malloc(sizeof(char*) * capacity);
+    while(*fens != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if(line[0] == '\0')
+        {
+            continue;
+        }
+        if(count == capacity)
+        {
+            capacity *= 2;
+            *fens = (char**)realloc(*fens, sizeof(char*) * capacity);
+            if(*fens == NULL)
+            {
+                break;
+            }
+        }
+        (*fens)[count] = (char*)malloc(strlen(line) + 1);
+        string_cpy((*fens)[count++], line);
+    }
+    fclose(fp);
+    return *fens == NULL ? 0 : count;
+}
+
+//usage: batch [fen file] [positions]
+int run_batch_benchmark(int argc, char *argv[])
+{
+    char **fens = SAMPLE_FENS;
+    int no_of_fens = NO_OF_SAMPLE_FENS;
+    int no_of_positions = argc > 1 ? atoi(argv[1]) : 100000;
+    if(argc > 0 && strcmp(argv[0], "-") != 0)
+    {
+        no_of_fens = load_fen_lines(argv[0], &fens);
+    }
+    if(no_of_fens == 0 || no_of_positions <= 0)
+    {
+        return 1;
+    }
+
+    struct chess_game *games = (struct chess_game*)malloc(sizeof(struct chess_game) * no_of_fens);
+    struct fen fn;
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            return 1;
+        }
+        init_chess_game(&games[i], &fn);
+    }
+
+    struct position_batch batch;
+    if(!init_position_batch(&batch, no_of_positions))
+    {
+        return 1;
+    }
+
+    double start = now_seconds();
+    for(int i = 0; i < no_of_positions; i++)
+    {
+        batch_add_position(&batch, &games[i % no_of_fens]);
+    }
+    int slow_path = count_batch_moves(&batch);
+    double batch_time = now_seconds() - start;
+
+    long long total = 0;
+    int mismatches = 0;
+    start = now_seconds();
+    for(int i = 0; i < no_of_positions; i++)
+    {
+        int count = count_legal_moves(&games[i % no_of_fens]);
+        total += count;
+        mismatches += count != batch.move_count[i];
+    }
+    double single_time = now_seconds() - start;
+
+    printf("positions %d, legal moves %lld, mismatches %d, single path %d\n", no_of_positions, total, mismatches, slow_path);
+    printf("batch  %.0f positions/sec\n", no_of_positions / batch_time);
+    printf("single %.0f positions/sec\n", no_of_positions / single_time);
+
+    free_position_batch(&batch);
+    free(games);
+    return mismatches != 0;
+}
+
+char *MICROBENCH_FENS[] =
+{
+    //openings
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2",
+    "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    //middlegames
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "2kr3r/pp1q1ppp/2n1bn2/2bpp3/4P3/2NP1N2/PPPBBPPP/R2QK2R b KQ - 3 9",
+    "r1b2rk1/2q1bppp/p2ppn2/1p6/3BPP2/2N2B2/PPPQ2PP/R4R1K w - - 0 15",
+    //endgames
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 b - - 0 1",
+    "8/5pk1/6p1/7p/1R5P/6P1/r4PK1/8 w - - 0 40",
+    //promotion heavy
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+    "8/P1P3kP/8/8/8/8/p1p3Kp/8 w - - 0 1"
+};
+const int NO_OF_MICROBENCH_FENS = 16;
+const char *MOVE_TYPE_NAMES[] = {"quiet", "double_pawn_push", "king_castle", "queen_castle", "capture", "en_passant",
+"", "", "knight_promotion", "bishop_promotion", "rook_promotion", "queen_promotion",
+"knight_promo_capture", "bishop_promo_capture", "rook_promo_capture", "queen_promo_capture"};
+
+#define MICROBENCH_MAX_MOVES 4096
+
+//forces the compiler to materialise *p, so copies that are only timed are not optimised away
+#define ESCAPE(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+struct microbench_context
+{
+    struct fen fens[16];
+    struct chess_game games[16];
+    struct chess_game tracked_games[16];
+    struct move moves[16][MICROBENCH_MAX_MOVES];
+    int move_games[16][MICROBENCH_MAX_MOVES];
+    int no_of_moves[16];
+    int selected;
+    volatile uint64_t sink;
+};
+
+//each benchmark runs one pass over its inputs and returns how many operations it performed
+typedef long long (*microbench_function)(struct microbench_context *ctx);
+
+long long bench_init_fen(struct microbench_context *ctx)
+{
+    struct fen fn;
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        init_fen(&fn, MICROBENCH_FENS[i]);
+        ctx->sink += fn.en_passant;
+    }
+    return NO_OF_MICROBENCH_FENS;
+}
+
+long long bench_init_chess_game(struct microbench_context *ctx)
+{
+    struct chess_game game;
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        init_chess_game(&game, &ctx->fens[i]);
+        ctx->sink += game.hash;
+    }
+    return NO_OF_MICROBENCH_FENS;
+}
+
+long long bench_generate_fen(struct microbench_context *ctx)
+{
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        generate_fen(&ctx->games[i]);
+        ctx->sink += ctx->games[i].fen[0];
+    }
+    return NO_OF_MICROBENCH_FENS;
+}
+
+long long bench_generate_moves(struct microbench_context *ctx)
+{
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        struct queue *q = generate_moves(&ctx->games[i]);
+        ctx->sink += q->front != NULL;
+        free_queue(q);
+    }
+    return NO_OF_MICROBENCH_FENS;
+}
+
+//times the generator for ctx->selected piece type, once per piece of that type
+long long bench_piece_generator(struct microbench_context *ctx)
+{
+    long long ops = 0;
+    int type = ctx->selected;
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        struct chess_game *game = &ctx->games[i];
+        struct piece_list *p_list = game->turn == WHITE ? &game->white_piece_list : &game->black_piece_list;
+        for(int j = 0; j < p_list->no_of_pieces[type]; j++)
+        {
+            struct queue *q = init_queue();
+            int position = p_list->list[type][j];
+            if(is_sliding_piece(type))
+            {
+                generate_sliding_moves(game, position, q);
+            }
+            else if(type == KNIGHT)
+            {
+                generate_knight_moves(game, position, q);
+            }
+            else if(type == KING)
+            {
+                generate_king_moves(game, position, q);
+            }
+            else
+            {
+                generate_pawn_moves(game, position, q);
+            }
+            ctx->sink += q->front != NULL;
+            free_queue(q);
+            ops++;
+        }
+    }
+    return ops;
+}
+
+long long bench_copy_game(struct microbench_context *ctx)
+{
+    int type = ctx->selected;
+    for(int i = 0; i < ctx->no_of_moves[type]; i++)
+    {
+        struct chess_game copy = ctx->games[ctx->move_games[type][i]];
+        ESCAPE(&copy);
+    }
+    return ctx->no_of_moves[type];
+}
+
+long long bench_make_move(struct microbench_context *ctx)
+{
+    int type = ctx->selected;
+    for(int i = 0; i < ctx->no_of_moves[type]; i++)
+    {
+        struct chess_game copy = ctx->games[ctx->move_games[type][i]];
+        ESCAPE(&copy);
+        make_move(&copy, &ctx->moves[type][i]);
+        ctx->sink += copy.hash;
+    }
+    return ctx->no_of_moves[type];
+}
+
+//every move of the inputs with the attack maps off (0), kept incrementally (1) or rebuilt after
+//the move (2), so the difference to the first is the cost of either way of keeping them
+long long bench_attack_maps(struct microbench_context *ctx)
+{
+    long long ops = 0;
+    for(int type = 0; type < 16; type++)
+    {
+        for(int i = 0; i < ctx->no_of_moves[type]; i++)
+        {
+            int index = ctx->move_games[type][i];
+            struct chess_game copy = ctx->selected == 1 ? ctx->tracked_games[index] : ctx->games[index];
+            ESCAPE(&copy);
+            make_move(&copy, &ctx->moves[type][i]);
+            if(ctx->selected == 2)
+            {
+                build_attack_maps(&copy);
+            }
+            ctx->sink += copy.hash + copy.attacks.counts[0][copy.white_piece_list.list[KING][0]];
+        }
+        ops += ctx->no_of_moves[type];
+    }
+    return ops;
+}
+
+long long bench_update_piece_index(struct microbench_context *ctx)
+{
+    long long ops = 0;
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        struct piece_list *p_list = &ctx->games[i].white_piece_list;
+        for(int type = 1; type < 7; type++)
+        {
+            for(int j = 0; j < p_list->no_of_pieces[type]; j++)
+            {
+                //move the piece away and back so the list is unchanged after each pass
+                struct move there = {p_list->list[type][j], 64 + j, QUIET_MOVE};
+                struct move back = {64 + j, there.src, QUIET_MOVE};
+                update_piece_index(p_list, type, &there);
+                update_piece_index(p_list, type, &back);
+                ops += 2;
+            }
+        }
+    }
+    return ops;
+}
+
+long long bench_add_remove_piece_index(struct microbench_context *ctx)
+{
+    long long ops = 0;
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        struct piece_list *p_list = &ctx->games[i].black_piece_list;
+        for(int type = QUEEN; type < 7; type++)
+        {
+            if(p_list->no_of_pieces[type] < p_list->max_pieces[type])
+            {
+                add_piece_index(p_list, type, 64);
+                remove_piece_index(p_list, type, 64);
+                ops += 2;
+            }
+        }
+    }
+    return ops;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+//median of several timed samples, each long enough to drown out timer resolution
+void run_microbench(FILE *fp, int *first, char *name, microbench_function function, struct microbench_context *ctx, double sample_time)
+{
+    double samples[9];
+    const int no_of_samples = 9;
+
+    long long ops = function(ctx);
+    if(ops == 0)
+    {
+        return;
+    }
+
+    int passes = 1;
+    double start = now_seconds();
+    while(now_seconds() - start < sample_time / 10)
+    {
+        function(ctx);
+        passes++;
+    }
+    passes = (int)(passes * 10 * sample_time / (now_seconds() - start + 1e-9)) / 10 + 1;
+
+    long long allocations = allocation_count;
+    for(int i = 0; i < no_of_samples; i++)
+    {
+        start = now_seconds();
+        for(int j = 0; j < passes; j++)
+        {
+            function(ctx);
+        }
+        samples[i] = (now_seconds() - start) * 1e9 / ((double)ops * passes);
+    }
+    allocations = allocation_count - allocations;
+    qsort(samples, no_of_samples, sizeof(double), compare_doubles);
+
+    fprintf(fp, "%s  {\"name\": \"%s\", \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"allocs_per_op\": %.2f, \"ops_per_sample\": %lld}",
+        *first ? "" : ",\n", name, samples[no_of_samples / 2], samples[0],
+        (double)allocations / ((double)ops * passes * no_of_samples), ops * passes);
+    *first = 0;
+}
+
+//usage: microbench [sample milliseconds]
+int run_microbenchmarks(int argc, char *argv[])
+{
+    double sample_time = (argc > 0 ? atoi(argv[0]) : 50) / 1000.0;
+    struct microbench_context *ctx = (struct microbench_context*)calloc(1, sizeof(struct microbench_context));
+    if(ctx == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+
+    for(int i = 0; i < NO_OF_MICROBENCH_FENS; i++)
+    {
+        init_fen(&ctx->fens[i], MICROBENCH_FENS[i]);
+        init_chess_game(&ctx->games[i], &ctx->fens[i]);
+        ctx->tracked_games[i] = ctx->games[i];
+        enable_attack_maps(&ctx->tracked_games[i]);
+
+        struct queue *q = generate_moves(&ctx->games[i]);
+        struct move *mv;
+        while((mv = dequeue(q)) != NULL)
+        {
+            int type = mv->type;
+            if(ctx->no_of_moves[type] < MICROBENCH_MAX_MOVES)
+            {
+                ctx->moves[type][ctx->no_of_moves[type]] = *mv;
+                ctx->move_games[type][ctx->no_of_moves[type]++] = i;
+            }
+            free(mv);
+        }
+        free(q);
+    }
+
+    char name[64];
+    int first = 1;
+    FILE *fp = stdout;
+    fprintf(fp, "[\n");
+    run_microbench(fp, &first, "init_fen", bench_init_fen, ctx, sample_time);
+    run_microbench(fp, &first, "init_chess_game", bench_init_chess_game, ctx, sample_time);
+    run_microbench(fp, &first, "generate_fen", bench_generate_fen, ctx, sample_time);
+    run_microbench(fp, &first, "generate_moves", bench_generate_moves, ctx, sample_time);
+
+    const char *generator_names[] = {"", "king", "queen", "rook", "bishop", "knight", "pawn"};
+    for(int type = 1; type < 7; type++)
+    {
+        ctx->selected = type;
+        snprintf(name, sizeof(name), "generate_%s_moves", generator_names[type]);
+        run_microbench(fp, &first, name, bench_piece_generator, ctx, sample_time);
+    }
+
+    //make_move works on a fresh copy of the position each time, copy_game is that overhead alone
+    ctx->selected = QUIET_MOVE;
+    run_microbench(fp, &first, "copy_game", bench_copy_game, ctx, sample_time);
+    for(int type = 0; type < 16; type++)
+    {
+        ctx->selected = type;
+        if(ctx->no_of_moves[type] > 0)
+        {
+            snprintf(name, sizeof(name), "make_move_%s", MOVE_TYPE_NAMES[type]);
+            run_microbench(fp, &first, name, bench_make_move, ctx, sample_time);
+        }
+    }
+
+    char *attack_map_names[] = {"make_move_no_attack_maps", "make_move_update_attack_maps", "make_move_rebuild_attack_maps"};
+    for(int mode = 0; mode < 3; mode++)
+    {
+        ctx->selected = mode;
+        run_microbench(fp, &first, attack_map_names[mode], bench_attack_maps, ctx, sample_time);
+    }
+
+    run_microbench(fp, &first, "update_piece_index", bench_update_piece_index, ctx, sample_time);
+    run_microbench(fp, &first, "add_remove_piece_index", bench_add_remove_piece_index, ctx, sample_time);
+    fprintf(fp, "\n]\n");
+
+    free(ctx);
+    return 0;
+}
+
+//24 byte position: occupancy bitboard, then one nibble per occupied square in square order.
+//Nibble codes 1-6 and 9-14 are white and black pieces by type, the spare codes carry the rest
+//of the state: 7 a pawn that can be taken en passant, 8 a rook that can still castle, 15 the
+//black king when black is to move. Nibbles left over after the pieces hold the clocks: the
+//half-move clock in the last byte when there are at most 30 pieces, the full-move number in
+//the two bytes before it when there are at most 26 (otherwise they decode as 0 and 1).
+#define PACKED_POSITION_SIZE 24
+
+struct packed_position
+{
+    unsigned char bytes[PACKED_POSITION_SIZE];
+};
+
+const int PACKED_EN_PASSANT_PAWN = 7, PACKED_CASTLE_ROOK = 8, PACKED_BLACK_KING_TO_MOVE = 15;
+const char POSITION_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'P', 'K', '1'};
+
+struct position_file_header
+{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct position_file
+{
+    int fd;
+    void *map;
+    size_t size;
+    struct packed_position *records;
+    long long count;
+};
+
+int steps_to_edges[64][8];
+unsigned char piece_to_code[32];
+int code_to_piece[16];
+
+void init_packed_codec()
+{
+    static int initialized = 0;
+    if(initialized)
+    {
+        return;
+    }
+    generate_steps_to_edges(steps_to_edges);
+    for(int type = 1; type < 7; type++)
+    {
+        piece_to_code[WHITE | type] = type;
+        piece_to_code[BLACK | type] = 8 + type;
+        code_to_piece[type] = WHITE | type;
+        code_to_piece[8 + type] = BLACK | type;
+    }
+    code_to_piece[PACKED_BLACK_KING_TO_MOVE] = BLACK | KING;
+    initialized = 1;
+}
+
+void set_nibble(unsigned char *nibbles, int index, int value)
+{
+    int shift = (index & 1) * 4;
+    nibbles[index >> 1] = (nibbles[index >> 1] & ~(15 << shift)) | (value << shift);
+}
+
+int get_nibble(unsigned char *nibbles, int index)
+{
+    return (nibbles[index >> 1] >> ((index & 1) * 4)) & 15;
+}
+
+int nibble_index(uint64_t occupancy, int position)
+{
+    return __builtin_popcountll(occupancy & (square_bit(position) - 1));
+}
+
+void encode_position(struct chess_game *game, struct packed_position *packed)
+{
+    uint64_t occupancy = 0;
+    unsigned char *nibbles = packed->bytes + 8;
+    memset(packed->bytes, 0, PACKED_POSITION_SIZE);
+
+    for(int type = 1; type < 7; type++)
+    {
+        occupancy |= piece_list_bitboard(&game->white_piece_list, type) | piece_list_bitboard(&game->black_piece_list, type);
+    }
+    for(int i = 0; i < 8; i++)
+    {
+        packed->bytes[i] = (unsigned char)(occupancy >> (i * 8));
+    }
+
+    int count = 0;
+    uint64_t bits = occupancy;
+    while(bits != 0)
+    {
+        int position = pop_lsb(&bits);
+        nibbles[count >> 1] |= piece_to_code[game->board[position]] << ((count & 1) * 4);
+        count++;
+    }
+
+    if(game->en_passant != -1)
+    {
+        int pawn = game->en_passant < 32 ? game->en_passant + N : game->en_passant + S;
+        if(piece_type(game->board[pawn]) == PAWN)
+        {
+            set_nibble(nibbles, nibble_index(occupancy, pawn), PACKED_EN_PASSANT_PAWN);
+        }
+    }
+    //castle_index bits in order: a1, h1, a8, h8
+    const int rook_squares[4] = {0, 7, 56, 63};
+    int rights = castle_index(game);
+    for(int i = 0; i < 4; i++)
+    {
+        if(((rights >> i) & 1) && piece_type(game->board[rook_squares[i]]) == ROOK)
+        {
+            set_nibble(nibbles, nibble_index(occupancy, rook_squares[i]), PACKED_CASTLE_ROOK);
+        }
+    }
+    if(game->turn == BLACK && game->black_piece_list.no_of_pieces[KING] > 0)
+    {
+        set_nibble(nibbles, nibble_index(occupancy, game->black_piece_list.list[KING][0]), PACKED_BLACK_KING_TO_MOVE);
+    }
+
+    if(count <= 30)
+    {
+        packed->bytes[23] = game->half_moves > 255 ? 255 : game->half_moves;
+    }
+    if(count <= 26)
+    {
+        int full_moves = game->full_moves > 65535 ? 65535 : game->full_moves;
+        packed->bytes[21] = full_moves & 255;
+        packed->bytes[22] = full_moves >> 8;
+    }
+}
+
+void decode_position(struct packed_position *packed, struct chess_game *game)
+{
+    unsigned char *nibbles = packed->bytes + 8;
+    uint64_t occupancy = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        occupancy |= (uint64_t)packed->bytes[i] << (i * 8);
+    }
+
+    memset(game->board, 0, sizeof(game->board));
+    game->turn = WHITE;
+    game->white_castle = game->black_castle = 0;
+    game->en_passant = -1;
+
+    int count = 0;
+    uint64_t hash = 0, pawn_hash = 0;
+    uint64_t bits = occupancy;
+    while(bits != 0)
+    {
+        int position = pop_lsb(&bits);
+        int code = get_nibble(nibbles, count++);
+        int white_side = position < 32;
+        int piece = code_to_piece[code];
+
+        if(code == PACKED_EN_PASSANT_PAWN)
+        {
+            piece = (white_side ? WHITE : BLACK) | PAWN;
+            game->en_passant = white_side ? position + S : position + N;
+        }
+        else if(code == PACKED_CASTLE_ROOK)
+        {
+            piece = (white_side ? WHITE : BLACK) | ROOK;
+            int right = file(position) == 0 ? 1 : 2;
+            game->white_castle |= white_side ? right : 0;
+            game->black_castle |= white_side ? 0 : right;
+        }
+        game->turn = code == PACKED_BLACK_KING_TO_MOVE ? BLACK : game->turn;
+        game->board[position] = piece;
+        hash ^= piece_key(piece, position);
+        pawn_hash ^= piece_type(piece) == PAWN ? piece_key(piece, position) : 0;
+    }
+
+    game->half_moves = count <= 30 ? packed->bytes[23] : 0;
+    game->full_moves = count <= 26 ? packed->bytes[21] | (packed->bytes[22] << 8) : 1;
+    game->captured_piece_list.top = -1;
+    game->fen[0] = '\0';
+    memcpy(game->distance_to_borders, steps_to_edges, sizeof(steps_to_edges));
+    init_piece_list(game);
+
+    hash ^= zobrist_castle[castle_index(game)];
+    hash ^= game->en_passant != -1 ? zobrist_en_passant[file(game->en_passant)] : 0;
+    hash ^= game->turn == BLACK ? zobrist_turn : 0;
+    game->hash = hash;
+    game->pawn_hash = pawn_hash;
+    game->history = NULL;
+    game->history_ply = 0;
+    game->track_attacks = 0;
+}
+
+int compare_packed_positions(const void *a, const void *b)
+{
+    return memcmp(a, b, PACKED_POSITION_SIZE);
+}
+
+//sorts the records in place, drops exact duplicates and writes them behind a small header
+long long write_position_file(char *path, struct packed_position *positions, long long count)
+{
+    qsort(positions, count, sizeof(struct packed_position), compare_packed_positions);
+    long long unique = 0;
+    for(long long i = 0; i < count; i++)
+    {
+        if(unique == 0 || memcmp(&positions[unique - 1], &positions[i], PACKED_POSITION_SIZE) != 0)
+        {
+            positions[unique++] = positions[i];
+        }
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return -1;
+    }
+    struct position_file_header header;
+    memcpy(header.magic, POSITION_FILE_MAGIC, sizeof(header.magic));
+    header.record_size = PACKED_POSITION_SIZE;
+    header.reserved = 0;
+    header.count = unique;
+    int written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(positions, sizeof(struct packed_position), unique, fp) == (size_t)unique;
+    if(fclose(fp) != 0 || !written)
+    {
+        printf("cannot write %s\n", path);
+        return -1;
+    }
+    return unique;
+}
+
+int open_position_file(char *path, struct position_file *pf)
+{
+    pf->fd = open(path, O_RDONLY);
+    if(pf->fd < 0)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    fstat(pf->fd, &st);
+    pf->size = st.st_size;
+    pf->map = pf->size >= sizeof(struct position_file_header) ? mmap(NULL, pf->size, PROT_READ, MAP_SHARED, pf->fd, 0) : MAP_FAILED;
+    if(pf->map == MAP_FAILED)
+    {
+        printf("cannot map %s\n", path);
+        close(pf->fd);
+        return 0;
+    }
+
+    struct position_file_header *header = (struct position_file_header*)pf->map;
+    if(memcmp(header->magic, POSITION_FILE_MAGIC, sizeof(header->magic)) != 0 || header->record_size != PACKED_POSITION_SIZE ||
+        sizeof(*header) + header->count * PACKED_POSITION_SIZE > pf->size)
+    {
+        printf("%s is not a position file\n", path);
+        munmap(pf->map, pf->size);
+        close(pf->fd);
+        return 0;
+    }
+    pf->records = (struct packed_position*)((char*)pf->map + sizeof(*header));
+    pf->count = header->count;
+    return 1;
+}
+
+void close_position_file(struct position_file *pf)
+{
+    munmap(pf->map, pf->size);
+    close(pf->fd);
+}
+
+long long find_packed_position(struct position_file *pf, struct packed_position *packed)
+{
+    long long low = 0, high = pf->count - 1;
+    while(low <= high)
+    {
+        long long middle = low + (high - low) / 2;
+        int order = memcmp(&pf->records[middle], packed, PACKED_POSITION_SIZE);
+        if(order == 0)
+        {
+            return middle;
+        }
+        else if(order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+//usage: pack <fen file> <position file>, or pack find <position file> <fen>
+int run_pack_mode(int argc, char *argv[])
+{
+    struct fen fn;
+    struct chess_game game;
+    struct packed_position packed;
+    init_tables();
+    init_packed_codec();
+
+    if(argc == 3 && strcmp(argv[0], "find") == 0)
+    {
+        struct position_file pf;
+        if(!init_fen(&fn, argv[2]) || !open_position_file(argv[1], &pf))
+        {
+            return 1;
+        }
+        init_chess_game(&game, &fn);
+        encode_position(&game, &packed);
+        double start = now_seconds();
+        long long index = find_packed_position(&pf, &packed);
+        printf("%s at %lld of %lld (%.1f us)\n", index < 0 ? "not found" : "found", index, pf.count, (now_seconds() - start) * 1e6);
+        close_position_file(&pf);
+        return index < 0;
+    }
+    if(argc != 2)
+    {
+        printf("usage: pack <fen file> <position file> | pack find <position file> <fen>\n");
+        return 1;
+    }
+
+    char **fens;
+    int no_of_fens = load_fen_lines(argv[0], &fens);
+    struct packed_position *positions = (struct packed_position*)malloc(sizeof(struct packed_position) * (no_of_fens + 1));
+    if(positions == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+
+    int mismatches = 0, no_of_positions = 0;
+    struct chess_game decoded;
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            continue;
+        }
+        init_chess_game(&game, &fn);
+        encode_position(&game, &positions[no_of_positions]);
+        decode_position(&positions[no_of_positions++], &decoded);
+        mismatches += decoded.hash != game.hash;
+    }
+    long long written = write_position_file(argv[1], positions, no_of_positions);
+    printf("%d positions, %lld unique written, %d round trip mismatches\n", no_of_positions, written, mismatches);
+    free(positions);
+    return written < 0 || mismatches != 0;
+}
+
+//Position counts over game corpora much larger than memory. Phase one replays games on every core
+//and appends (hash, packed position) records to partition files picked by the top bits of the hash.
+//Phase two aggregates one partition per thread in a hash table sized to the memory budget, a
+//partition with more unique positions than fit is split on the next hash bits and retried.
+#define DEDUP_PARTITION_BITS 8
+#define DEDUP_SPLIT_BITS 4
+#define DEDUP_CHUNK 256
+
+struct dedup_record
+{
+    uint64_t hash;
+    struct packed_position packed;
+    uint64_t count;
+};
+
+struct counted_position
+{
+    struct packed_position packed;
+    uint64_t count;
+};
+
+const char DEDUP_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'D', 'C', '1'};
+
+struct dedup_job
+{
+    FILE *input;
+    pthread_mutex_t input_lock;
+    char temp_dir[4096];
+    int fds[1 << DEDUP_PARTITION_BITS];
+    int no_of_threads;
+    int records_per_buffer;
+    int table_capacity;
+    int next_partition;
+    FILE *output;
+    pthread_mutex_t output_lock;
+    long long games, invalid_games, records, unique, splits;
+    int failed;
+};
+
+int write_all(int fd, void *data, size_t size)
+{
+    char *bytes = (char*)data;
+    while(size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if(written <= 0)
+        {
+            return 0;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 1;
+}
+
+//one thread's buffers in front of partition files shared by all threads. The files are opened
+//for appending, so whole buffers from different threads never interleave.
+struct partition_buffers
+{
+    int *fds;
+    int no_of_partitions;
+    int record_size;
+    int records_per_buffer;
+    char *records;
+    int *fill;
+    int failed;
+};
+
+int init_partition_buffers(struct partition_buffers *pb, int *fds, int no_of_partitions, int record_size, int records_per_buffer)
+{
+    pb->fds = fds;
+    pb->no_of_partitions = no_of_partitions;
+    pb->record_size = record_size;
+    pb->records_per_buffer = records_per_buffer;
+    pb->records = (char*)malloc((size_t)record_size * records_per_buffer * no_of_partitions);
+    pb->fill = (int*)calloc(no_of_partitions, sizeof(int));
+    pb->failed = pb->records == NULL || pb->fill == NULL;
+    if(pb->failed)
+    {
+        printf("memory not allocated\n");
+    }
+    return !pb->failed;
+}
+
+void flush_partition_buffer(struct partition_buffers *pb, int partition)
+{
+    char *buffer = pb->records + (size_t)partition * pb->records_per_buffer * pb->record_size;
+    if(pb->fill[partition] > 0 && !write_all(pb->fds[partition], buffer, (size_t)pb->fill[partition] * pb->record_size))
+    {
+        printf("cannot write partition %d\n", partition);
+        pb->failed = 1;
+    }
+    pb->fill[partition] = 0;
+}
+
+//returns the next free record of the partition's buffer, writing the buffer out first when it is full
+void* partition_record(struct partition_buffers *pb, int partition)
+{
+    if(pb->fill[partition] == pb->records_per_buffer)
+    {
+        flush_partition_buffer(pb, partition);
+    }
+    char *buffer = pb->records + (size_t)partition * pb->records_per_buffer * pb->record_size;
+    return buffer + (size_t)pb->fill[partition]++ * pb->record_size;
+}
+
+void free_partition_buffers(struct partition_buffers *pb)
+{
+    for(int partition = 0; !pb->failed && partition < pb->no_of_partitions; partition++)
+    {
+        flush_partition_buffer(pb, partition);
+    }
+    free(pb->records);
+    free(pb->fill);
+}
+
+int open_partition_files(char *dir, int *fds, int no_of_partitions)
+{
+    char path[4200];
+    for(int partition = 0; partition < no_of_partitions; partition++)
+    {
+        snprintf(path, sizeof(path), "%s/%03d", dir, partition);
+        fds[partition] = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if(fds[partition] < 0)
+        {
+            printf("cannot open %s\n", path);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void remove_partition_files(char *dir, int no_of_partitions)
+{
+    char path[4200];
+    for(int partition = 0; partition < no_of_partitions; partition++)
+    {
+        snprintf(path, sizeof(path), "%s/%03d", dir, partition);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+typedef void (*game_visitor)(void *context, struct chess_game *game, int ply);
+
+//calls visit for the starting position of a game line and after every move, returns the number of
+//positions visited (0 when the line has no position). complete is cleared on an illegal move.
+int replay_game(char *line, struct chess_game *game, game_visitor visit, void *context, int *complete)
+{
+    char word[16];
+    char *moves = parse_position_line(game, line);
+    *complete = moves != NULL;
+    if(moves == NULL)
+    {
+        return 0;
+    }
+    for(int ply = 0; ; ply++)
+    {
+        visit(context, game, ply);
+        moves = next_word(moves, word, sizeof(word));
+        if(moves == NULL)
+        {
+            return ply + 1;
+        }
+        struct move *mv = parse_move(game, word);
+        if(mv == NULL)
+        {
+            *complete = 0;
+            return ply + 1;
+        }
+        make_move(game, mv);
+        free(mv);
+    }
+}
+
+int run_worker_threads(int no_of_threads, void *(*worker)(void*), void *arg)
+{
+    pthread_t threads[256];
+    int started = 0;
+    for(int i = 0; i < no_of_threads && i < 256; i++)
+    {
+        if(pthread_create(&threads[started], NULL, worker, arg) == 0)
+        {
+            started++;
+        }
+    }
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    if(started == 0)
+    {
+        printf("cannot start threads\n");
+    }
+    return started > 0;
+}
+
+void add_dedup_record(void *context, struct chess_game *game, int ply)
+{
+    struct partition_buffers *pb = (struct partition_buffers*)context;
+    (void)ply;
+    struct dedup_record *record = (struct dedup_record*)partition_record(pb, game->hash >> (64 - DEDUP_PARTITION_BITS));
+
+    //the clocks are not part of the position
+    int half_moves = game->half_moves, full_moves = game->full_moves;
+    game->half_moves = 0;
+    game->full_moves = 1;
+    encode_position(game, &record->packed);
+    game->half_moves = half_moves;
+    game->full_moves = full_moves;
+    record->hash = game->hash;
+    record->count = 1;
+}
+
+void* dedup_replay_worker(void *arg)
+{
+    struct dedup_job *job = (struct dedup_job*)arg;
+    struct partition_buffers pb;
+    if(!init_partition_buffers(&pb, job->fds, 1 << DEDUP_PARTITION_BITS, sizeof(struct dedup_record), job->records_per_buffer))
+    {
+        job->failed = 1;
+    }
+
+    struct chess_game game;
+    char *line = NULL;
+    size_t capacity = 0;
+    long long games = 0, invalid_games = 0, records = 0;
+    while(!job->failed && !pb.failed)
+    {
+        pthread_mutex_lock(&job->input_lock);
+        ssize_t length = getline(&line, &capacity, job->input);
+        pthread_mutex_unlock(&job->input_lock);
+        if(length < 0)
+        {
+            break;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+
+        //a game with an illegal move keeps the positions before it
+        int complete;
+        int positions = replay_game(line, &game, add_dedup_record, &pb, &complete);
+        games += positions > 0;
+        invalid_games += !complete && line[0] != '\0';
+        records += positions;
+    }
+
+    free_partition_buffers(&pb);
+    job->failed |= pb.failed;
+    __atomic_add_fetch(&job->games, games, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->invalid_games, invalid_games, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->records, records, __ATOMIC_RELAXED);
+    free(line);
+    return NULL;
+}
+
+//linear probing on the low bits of the hash, the high bits already picked the partition
+int insert_dedup_record(struct dedup_record *table, int mask, struct dedup_record *record)
+{
+    int index = record->hash & mask;
+    while(table[index].count != 0)
+    {
+        if(table[index].hash == record->hash && memcmp(&table[index].packed, &record->packed, PACKED_POSITION_SIZE) == 0)
+        {
+            table[index].count += record->count;
+            return 0;
+        }
+        index = (index + 1) & mask;
+    }
+    table[index] = *record;
+    return 1;
+}
+
+int write_dedup_table(struct dedup_job *job, struct dedup_record *table, int capacity)
+{
+    long long unique = 0;
+    int written = 1;
+    struct counted_position counted;
+    pthread_mutex_lock(&job->output_lock);
+    for(int i = 0; i < capacity && written; i++)
+    {
+        if(table[i].count != 0)
+        {
+            counted.packed = table[i].packed;
+            counted.count = table[i].count;
+            written = fwrite(&counted, sizeof(counted), 1, job->output) == 1;
+            unique++;
+        }
+    }
+    job->unique += unique;
+    pthread_mutex_unlock(&job->output_lock);
+    if(!written)
+    {
+        printf("cannot write output\n");
+    }
+    return written;
+}
+
+int aggregate_partition(struct dedup_job *job, struct dedup_record *table, char *path, int depth);
+
+//routes what is already aggregated in the table and the unread rest of the partition to sub-partitions
+int split_partition(struct dedup_job *job, struct dedup_record *table, int capacity, char *path, int depth, FILE *fp, struct dedup_record *chunk, int start, int end)
+{
+    int shift = 64 - DEDUP_PARTITION_BITS - DEDUP_SPLIT_BITS * (depth + 1);
+    if(shift < 0)
+    {
+        printf("%s does not fit in memory\n", path);
+        return 0;
+    }
+
+    char sub_paths[1 << DEDUP_SPLIT_BITS][4200];
+    FILE *subs[1 << DEDUP_SPLIT_BITS];
+    int ok = 1;
+    for(int sub = 0; sub < (1 << DEDUP_SPLIT_BITS); sub++)
+    {
+        snprintf(sub_paths[sub], sizeof(sub_paths[sub]), "%s.%x", path, sub);
+        subs[sub] = fopen(sub_paths[sub], "wb");
+        ok = ok && subs[sub] != NULL;
+    }
+
+    int mask = (1 << DEDUP_SPLIT_BITS) - 1;
+    for(int i = 0; ok && i < capacity; i++)
+    {
+        if(table[i].count != 0)
+        {
+            ok = fwrite(&table[i], sizeof(struct dedup_record), 1, subs[(table[i].hash >> shift) & mask]) == 1;
+        }
+    }
+    while(ok && start < end)
+    {
+        for(int i = start; ok && i < end; i++)
+        {
+            ok = fwrite(&chunk[i], sizeof(struct dedup_record), 1, subs[(chunk[i].hash >> shift) & mask]) == 1;
+        }
+        start = 0;
+        end = fread(chunk, sizeof(struct dedup_record), DEDUP_CHUNK, fp);
+    }
+    for(int sub = 0; sub < (1 << DEDUP_SPLIT_BITS); sub++)
+    {
+        ok = subs[sub] != NULL && fclose(subs[sub]) == 0 && ok;
+    }
+    fclose(fp);
+    unlink(path);
+    if(!ok)
+    {
+        printf("cannot split %s\n", path);
+        return 0;
+    }
+
+    __atomic_add_fetch(&job->splits, 1, __ATOMIC_RELAXED);
+    for(int sub = 0; ok && sub < (1 << DEDUP_SPLIT_BITS); sub++)
+    {
+        ok = aggregate_partition(job, table, sub_paths[sub], depth + 1);
+    }
+    return ok;
+}
+
+int aggregate_partition(struct dedup_job *job, struct dedup_record *table, char *path, int depth)
+{
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+
+    //small partitions only clear and scan as much of the table as they can fill
+    struct stat st;
+    fstat(fileno(fp), &st);
+    long long records = st.st_size / sizeof(struct dedup_record);
+    int capacity = 1024;
+    while(capacity < records * 2 && capacity < job->table_capacity)
+    {
+        capacity *= 2;
+    }
+    memset(table, 0, sizeof(struct dedup_record) * capacity);
+
+    struct dedup_record chunk[DEDUP_CHUNK];
+    int mask = capacity - 1, limit = capacity / 4 * 3, used = 0;
+    int count;
+    while((count = fread(chunk, sizeof(struct dedup_record), DEDUP_CHUNK, fp)) > 0)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            if(used == limit)
+            {
+                return split_partition(job, table, capacity, path, depth, fp, chunk, i, count);
+            }
+            used += insert_dedup_record(table, mask, &chunk[i]);
+        }
+    }
+    fclose(fp);
+    unlink(path);
+    return write_dedup_table(job, table, capacity);
+}
+
+void* dedup_aggregate_worker(void *arg)
+{
+    struct dedup_job *job = (struct dedup_job*)arg;
+    struct dedup_record *table = (struct dedup_record*)malloc(sizeof(struct dedup_record) * job->table_capacity);
+    if(table == NULL)
+    {
+        printf("memory not allocated\n");
+        job->failed = 1;
+        return NULL;
+    }
+
+    char path[4200];
+    while(!job->failed)
+    {
+        int partition = __atomic_fetch_add(&job->next_partition, 1, __ATOMIC_RELAXED);
+        if(partition >= (1 << DEDUP_PARTITION_BITS))
+        {
+            break;
+        }
+        snprintf(path, sizeof(path), "%s/%03d", job->temp_dir, partition);
+        if(!aggregate_partition(job, table, path, 0))
+        {
+            job->failed = 1;
+        }
+    }
+    free(table);
+    return NULL;
+}
+
+//usage: dedup <games file> <output file> [threads] [memory MB]
+//each line of the games file is "startpos moves e2e4 ..." or "fen <fen> moves ...", the output is a
+//position file header followed by (packed position, occurrences) records
+int run_dedup_mode(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: dedup <games file> <output file> [threads] [memory MB]\n");
+        return 1;
+    }
+    init_tables();
+    init_packed_codec();
+
+    struct dedup_job *job = (struct dedup_job*)calloc(1, sizeof(struct dedup_job));
+    if(job == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    int no_of_partitions = 1 << DEDUP_PARTITION_BITS;
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    job->no_of_threads = argc > 2 ? atoi(argv[2]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    job->no_of_threads = job->no_of_threads < 1 ? 1 : job->no_of_threads > 256 ? 256 : job->no_of_threads;
+    size_t memory = (size_t)(argc > 3 ? atoi(argv[3]) : 256) << 20;
+
+    //half the budget buffers phase one, all of it is spread over the phase two tables
+    size_t buffer_records = memory / 2 / sizeof(struct dedup_record) / job->no_of_threads / no_of_partitions;
+    job->records_per_buffer = buffer_records < 16 ? 16 : buffer_records;
+    job->table_capacity = 1024;
+    while((size_t)job->table_capacity * 2 * sizeof(struct dedup_record) <= memory / job->no_of_threads && job->table_capacity < (1 << 30))
+    {
+        job->table_capacity *= 2;
+    }
+
+    pthread_mutex_init(&job->input_lock, NULL);
+    pthread_mutex_init(&job->output_lock, NULL);
+    snprintf(job->temp_dir, sizeof(job->temp_dir), "%s.parts", argv[1]);
+    job->input = fopen(argv[0], "r");
+    job->output = fopen(argv[1], "wb");
+    if(job->input == NULL || job->output == NULL || (mkdir(job->temp_dir, 0755) != 0 && access(job->temp_dir, W_OK) != 0))
+    {
+        printf("cannot open %s, %s or %s\n", argv[0], argv[1], job->temp_dir);
+        return 1;
+    }
+
+    if(!open_partition_files(job->temp_dir, job->fds, no_of_partitions))
+    {
+        return 1;
+    }
+
+    struct position_file_header header;
+    memcpy(header.magic, DEDUP_FILE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(struct counted_position);
+    header.reserved = 0;
+    header.count = 0;
+    fwrite(&header, sizeof(header), 1, job->output);
+
+    double start = now_seconds();
+    job->failed |= !run_worker_threads(job->no_of_threads, dedup_replay_worker, job);
+    for(int partition = 0; partition < no_of_partitions; partition++)
+    {
+        close(job->fds[partition]);
+    }
+    double replayed = now_seconds();
+    if(!job->failed)
+    {
+        job->failed |= !run_worker_threads(job->no_of_threads, dedup_aggregate_worker, job);
+    }
+    double finished = now_seconds();
+
+    header.count = job->unique;
+    int ok = !job->failed && fseek(job->output, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, job->output) == 1;
+    ok = fclose(job->output) == 0 && ok;
+    fclose(job->input);
+    remove_partition_files(job->temp_dir, no_of_partitions);
+
+    printf("{\"games\": %lld, \"invalid_games\": %lld, \"positions\": %lld, \"unique\": %lld, \"splits\": %lld, "
+        "\"threads\": %d, \"memory_mb\": %zu, \"replay_s\": %.3f, \"aggregate_s\": %.3f, \"ok\": %s}\n",
+        job->games, job->invalid_games, job->records, job->unique, job->splits, job->no_of_threads, memory >> 20,
+        replayed - start, finished - replayed, ok ? "true" : "false");
+    free(job);
+    return !ok;
+}
+
+//Inverted index over a game file, game ids are line numbers. Every position reached maps its
+//Zobrist key to (game, ply) postings, every material balance reached maps its signature to
+//(game, first ply). Postings are gathered in partition files like dedup; partitions follow the
+//top key bits, so sorting them one at a time writes both key tables in order. A posting list is
+//a varint count followed by varint deltas of the game id and ply.
+#define INDEX_PARTITION_BITS 7
+#define INDEX_MAX_SLICE_BITS 12
+
+const int POSITION_SECTION = 0, MATERIAL_SECTION = 1;
+const char INDEX_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'I', 'X', '1'};
+
+struct index_posting
+{
+    uint64_t key;
+    uint32_t game;
+    uint16_t ply;
+    uint16_t reserved;
+};
+
+struct index_key
+{
+    uint64_t key;
+    uint64_t offset;
+};
+
+struct index_header
+{
+    char magic[8];
+    uint64_t games;
+    uint64_t postings_offset;
+    uint64_t no_of_keys[2];
+    uint64_t keys_offset[2];
+};
+
+struct index_job
+{
+    FILE *input;
+    pthread_mutex_t input_lock;
+    long long next_game;
+    char temp_dir[4096];
+    int fds[2 << INDEX_PARTITION_BITS];
+    int no_of_threads;
+    int records_per_buffer;
+    long long games, invalid_games, postings;
+    int failed;
+};
+
+struct index_worker
+{
+    struct partition_buffers pb;
+    uint32_t game;
+    uint64_t material;
+};
+
+struct game_index
+{
+    int fd;
+    void *map;
+    size_t size;
+    struct index_header *header;
+    unsigned char *postings;
+    struct index_key *keys[2];
+};
+
+struct posting_cursor
+{
+    unsigned char *next;
+    long long remaining;
+    uint32_t game;
+    int ply;
+};
+
+//4 bits per piece count from queens to pawns, white in the low 20 bits and black above
+uint64_t material_signature(struct chess_game *game)
+{
+    uint64_t signature = 0;
+    for(int type = QUEEN; type <= PAWN; type++)
+    {
+        signature |= (uint64_t)game->white_piece_list.no_of_pieces[type] << ((type - QUEEN) * 4);
+        signature |= (uint64_t)game->black_piece_list.no_of_pieces[type] << (20 + (type - QUEEN) * 4);
+    }
+    return signature;
+}
+
+//"KRPvKR" style, returns -1 when the text is not a signature
+int64_t parse_material_signature(char *text)
+{
+    uint64_t signature = 0;
+    int shift = 0;
+    for(int i = 0; text[i] != '\0'; i++)
+    {
+        char ch = text[i] >= 'A' && text[i] <= 'Z' ? text[i] - 'A' + 'a' : text[i];
+        if(ch == 'v' && shift == 0)
+        {
+            shift = 20;
+            continue;
+        }
+        int type = EMPTY;
+        for(int t = KING; t <= PAWN; t++)
+        {
+            type = PIECE_SYMBOLS[t] == ch ? t : type;
+        }
+        if(type == EMPTY)
+        {
+            return -1;
+        }
+        if(type != KING)
+        {
+            int offset = shift + (type - QUEEN) * 4;
+            if(((signature >> offset) & 15) == 15)
+            {
+                return -1;
+            }
+            signature += 1ULL << offset;
+        }
+    }
+    return shift == 0 ? -1 : (int64_t)signature;
+}
+
+//signatures are dense in the low bits, mixing spreads them over the partitions (the mix is a bijection)
+uint64_t material_key(uint64_t signature)
+{
+    signature ^= signature >> 30;
+    signature *= 0xBF58476D1CE4E5B9ULL;
+    signature ^= signature >> 27;
+    signature *= 0x94D049BB133111EBULL;
+    return signature ^ (signature >> 31);
+}
+
+void add_index_posting(struct index_worker *worker, int section, uint64_t key, int ply)
+{
+    int partition = (section << INDEX_PARTITION_BITS) | (int)(key >> (64 - INDEX_PARTITION_BITS));
+    struct index_posting *posting = (struct index_posting*)partition_record(&worker->pb, partition);
+    posting->key = key;
+    posting->game = worker->game;
+    posting->ply = ply > 65535 ? 65535 : ply;
+    posting->reserved = 0;
+}
+
+void add_index_postings(void *context, struct chess_game *game, int ply)
+{
+    struct index_worker *worker = (struct index_worker*)context;
+    add_index_posting(worker, POSITION_SECTION, game->hash, ply);
+
+    uint64_t material = material_key(material_signature(game));
+    if(ply == 0 || material != worker->material)
+    {
+        add_index_posting(worker, MATERIAL_SECTION, material, ply);
+        worker->material = material;
+    }
+}
+
+void* index_replay_worker(void *arg)
+{
+    struct index_job *job = (struct index_job*)arg;
+    struct index_worker worker;
+    if(!init_partition_buffers(&worker.pb, job->fds, 2 << INDEX_PARTITION_BITS, sizeof(struct index_posting), job->records_per_buffer))
+    {
+        job->failed = 1;
+    }
+
+    struct chess_game game;
+    char *line = NULL;
+    size_t capacity = 0;
+    long long games = 0, invalid_games = 0, postings = 0;
+    while(!job->failed && !worker.pb.failed)
+    {
+        pthread_mutex_lock(&job->input_lock);
+        ssize_t length = getline(&line, &capacity, job->input);
+        worker.game = length < 0 ? 0 : job->next_game++;
+        pthread_mutex_unlock(&job->input_lock);
+        if(length < 0)
+        {
+            break;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+
+        int complete;
+        int positions = replay_game(line, &game, add_index_postings, &worker, &complete);
+        games += positions > 0;
+        invalid_games += !complete && line[0] != '\0';
+        postings += positions;
+    }
+
+    free_partition_buffers(&worker.pb);
+    job->failed |= worker.pb.failed;
+    __atomic_add_fetch(&job->games, games, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->invalid_games, invalid_games, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->postings, postings, __ATOMIC_RELAXED);
+    free(line);
+    return NULL;
+}
+
+int compare_index_postings(const void *a, const void *b)
+{
+    const struct index_posting *x = (const struct index_posting*)a, *y = (const struct index_posting*)b;
+    if(x->key != y->key)
+    {
+        return x->key < y->key ? -1 : 1;
+    }
+    if(x->game != y->game)
+    {
+        return x->game < y->game ? -1 : 1;
+    }
+    return x->ply - y->ply;
+}
+
+int write_varint(unsigned char *bytes, uint64_t value)
+{
+    int length = 0;
+    while(value >= 128)
+    {
+        bytes[length++] = (value & 127) | 128;
+        value >>= 7;
+    }
+    bytes[length++] = value;
+    return length;
+}
+
+unsigned char* read_varint(unsigned char *bytes, uint64_t *value)
+{
+    *value = 0;
+    for(int shift = 0; ; shift += 7)
+    {
+        *value |= (uint64_t)(*bytes & 127) << shift;
+        if((*bytes++ & 128) == 0)
+        {
+            return bytes;
+        }
+    }
+}
+
+//appends sorted postings as posting lists to the output and their keys to the key file
+int write_index_postings(struct index_posting *postings, long long count, FILE *output, uint64_t *postings_size, FILE *keys, uint64_t *no_of_keys)
+{
+    int ok = 1;
+    unsigned char bytes[32];
+    for(long long start = 0, end; ok && start < count; start = end)
+    {
+        for(end = start + 1; end < count && postings[end].key == postings[start].key; end++);
+
+        struct index_key entry = {postings[start].key, *postings_size};
+        ok = fwrite(&entry, sizeof(entry), 1, keys) == 1;
+        (*no_of_keys)++;
+
+        int length = write_varint(bytes, end - start);
+        uint32_t game = 0;
+        int ply = 0;
+        for(long long i = start; ok && i < end; i++)
+        {
+            length += write_varint(bytes + length, postings[i].game - game);
+            length += write_varint(bytes + length, postings[i].game == game && i > start ? postings[i].ply - ply : postings[i].ply);
+            game = postings[i].game;
+            ply = postings[i].ply;
+            ok = fwrite(bytes, 1, length, output) == (size_t)length;
+            *postings_size += length;
+            length = 0;
+        }
+    }
+    return ok;
+}
+
+//sorts one partition and writes it out. A partition larger than the memory budget is read once per
+//slice of the next key bits, slices follow key order so the key tables stay sorted. Only the
+//postings of a single key cannot be split, a slice holding more of them than the budget still grows.
+int write_index_partition(char *path, FILE *output, uint64_t *postings_size, FILE *keys, uint64_t *no_of_keys, size_t memory)
+{
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    fstat(fileno(fp), &st);
+    long long count = st.st_size / sizeof(struct index_posting);
+    long long budget = memory / sizeof(struct index_posting), capacity;
+    budget = budget < 1024 ? 1024 : budget;
+    capacity = count < budget ? count : budget;
+    int slice_bits = 0;
+    while((count >> slice_bits) > budget && slice_bits < INDEX_MAX_SLICE_BITS)
+    {
+        slice_bits++;
+    }
+    struct index_posting *postings = (struct index_posting*)malloc(sizeof(struct index_posting) * (capacity + 1));
+    struct index_posting block[1024];
+    int ok = postings != NULL;
+    if(!ok)
+    {
+        printf("memory not allocated\n");
+    }
+    for(uint64_t slice = 0; ok && slice < (1ULL << slice_bits); slice++)
+    {
+        long long fill = 0;
+        size_t read;
+        rewind(fp);
+        while(ok && (read = fread(block, sizeof(struct index_posting), 1024, fp)) > 0)
+        {
+            for(size_t i = 0; ok && i < read; i++)
+            {
+                if(slice_bits > 0 && (block[i].key << INDEX_PARTITION_BITS) >> (64 - slice_bits) != slice)
+                {
+                    continue;
+                }
+                if(fill == capacity)
+                {
+                    capacity = capacity * 2 + 1024;
+                    struct index_posting *grown = (struct index_posting*)realloc(postings, sizeof(struct index_posting) * (capacity + 1));
+                    if(grown == NULL)
+                    {
+                        printf("memory not allocated\n");
+                        ok = 0;
+                        break;
+                    }
+                    postings = grown;
+                }
+                postings[fill++] = block[i];
+            }
+        }
+        ok = ok && !ferror(fp);
+        qsort(postings, fill, sizeof(struct index_posting), compare_index_postings);
+        ok = ok && write_index_postings(postings, fill, output, postings_size, keys, no_of_keys);
+    }
+    fclose(fp);
+    free(postings);
+    return ok;
+}
+
+int append_file(FILE *output, FILE *input)
+{
+    char buffer[65536];
+    size_t count;
+    rewind(input);
+    while((count = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        if(fwrite(buffer, 1, count, output) != count)
+        {
+            return 0;
+        }
+    }
+    return !ferror(input);
+}
+
+//usage: index build <games file> <index file> [threads] [memory MB]
+int build_game_index(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: index build <games file> <index file> [threads] [memory MB]\n");
+        return 1;
+    }
+    struct index_job *job = (struct index_job*)calloc(1, sizeof(struct index_job));
+    if(job == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    int no_of_partitions = 2 << INDEX_PARTITION_BITS;
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    job->no_of_threads = argc > 2 ? atoi(argv[2]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    job->no_of_threads = job->no_of_threads < 1 ? 1 : job->no_of_threads > 256 ? 256 : job->no_of_threads;
+    size_t memory = (size_t)(argc > 3 ? atoi(argv[3]) : 256) << 20;
+    size_t buffer_records = memory / sizeof(struct index_posting) / job->no_of_threads / no_of_partitions;
+    job->records_per_buffer = buffer_records < 16 ? 16 : buffer_records;
+
+    pthread_mutex_init(&job->input_lock, NULL);
+    snprintf(job->temp_dir, sizeof(job->temp_dir), "%s.parts", argv[1]);
+    job->input = fopen(argv[0], "r");
+    FILE *output = fopen(argv[1], "wb");
+    if(job->input == NULL || output == NULL || (mkdir(job->temp_dir, 0755) != 0 && access(job->temp_dir, W_OK) != 0))
+    {
+        printf("cannot open %s, %s or %s\n", argv[0], argv[1], job->temp_dir);
+        return 1;
+    }
+    if(!open_partition_files(job->temp_dir, job->fds, no_of_partitions))
+    {
+        return 1;
+    }
+
+    struct index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.postings_offset = sizeof(header);
+    fwrite(&header, sizeof(header), 1, output);
+
+    double start = now_seconds();
+    job->failed |= !run_worker_threads(job->no_of_threads, index_replay_worker, job);
+    for(int partition = 0; partition < no_of_partitions; partition++)
+    {
+        close(job->fds[partition]);
+    }
+    double replayed = now_seconds();
+
+    char path[4200];
+    uint64_t postings_size = 0;
+    FILE *keys[2] = {tmpfile(), tmpfile()};
+    int ok = !job->failed && keys[0] != NULL && keys[1] != NULL;
+    for(int partition = 0; ok && partition < no_of_partitions; partition++)
+    {
+        int section = partition >> INDEX_PARTITION_BITS;
+        snprintf(path, sizeof(path), "%s/%03d", job->temp_dir, partition);
+        ok = write_index_partition(path, output, &postings_size, keys[section], &header.no_of_keys[section], memory);
+        unlink(path);
+    }
+    header.games = job->next_game;
+    header.keys_offset[0] = header.postings_offset + postings_size;
+    header.keys_offset[1] = header.keys_offset[0] + header.no_of_keys[0] * sizeof(struct index_key);
+    ok = ok && append_file(output, keys[0]) && append_file(output, keys[1]);
+    ok = ok && fseek(output, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, output) == 1;
+    ok = fclose(output) == 0 && ok;
+    for(int section = 0; section < 2; section++)
+    {
+        if(keys[section] != NULL)
+        {
+            fclose(keys[section]);
+        }
+    }
+    fclose(job->input);
+    remove_partition_files(job->temp_dir, no_of_partitions);
+
+    printf("{\"games\": %lld, \"invalid_games\": %lld, \"positions\": %lld, \"position_keys\": %llu, \"material_keys\": %llu, "
+        "\"postings_bytes\": %llu, \"replay_s\": %.3f, \"write_s\": %.3f, \"ok\": %s}\n",
+        job->games, job->invalid_games, job->postings, (unsigned long long)header.no_of_keys[0], (unsigned long long)header.no_of_keys[1],
+        (unsigned long long)postings_size, replayed - start, now_seconds() - replayed, ok ? "true" : "false");
+    free(job);
+    return !ok;
+}
+
+int open_game_index(char *path, struct game_index *index)
+{
+    index->fd = open(path, O_RDONLY);
+    if(index->fd < 0)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    fstat(index->fd, &st);
+    index->size = st.st_size;
+    index->map = index->size >= sizeof(struct index_header) ? mmap(NULL, index->size, PROT_READ, MAP_SHARED, index->fd, 0) : MAP_FAILED;
+    if(index->map == MAP_FAILED)
+    {
+        printf("cannot map %s\n", path);
+        close(index->fd);
+        return 0;
+    }
+
+    struct index_header *header = (struct index_header*)index->map;
+    if(memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->keys_offset[1] + header->no_of_keys[1] * sizeof(struct index_key) > index->size)
+    {
+        printf("%s is not an index file\n", path);
+        munmap(index->map, index->size);
+        close(index->fd);
+        return 0;
+    }
+    index->header = header;
+    index->postings = (unsigned char*)index->map + header->postings_offset;
+    index->keys[0] = (struct index_key*)((char*)index->map + header->keys_offset[0]);
+    index->keys[1] = (struct index_key*)((char*)index->map + header->keys_offset[1]);
+    return 1;
+}
+
+void close_game_index(struct game_index *index)
+{
+    munmap(index->map, index->size);
+    close(index->fd);
+}
+
+//positions the cursor on the postings of key, returns how many there are (0 when the key is absent)
+long long find_index_postings(struct game_index *index, int section, uint64_t key, struct posting_cursor *cursor)
+{
+    struct index_key *keys = index->keys[section];
+    long long low = 0, high = (long long)index->header->no_of_keys[section] - 1;
+    cursor->remaining = 0;
+    while(low <= high)
+    {
+        long long middle = low + (high - low) / 2;
+        if(keys[middle].key == key)
+        {
+            uint64_t count;
+            cursor->next = read_varint(index->postings + keys[middle].offset, &count);
+            cursor->remaining = count;
+            cursor->game = 0;
+            cursor->ply = -1;
+            break;
+        }
+        else if(keys[middle].key < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return cursor->remaining;
+}
+
+//moves to the next (game, ply) posting, returns 0 after the last one
+int next_index_posting(struct posting_cursor *cursor)
+{
+    if(cursor->remaining == 0)
+    {
+        return 0;
+    }
+    uint64_t game_delta, ply;
+    cursor->next = read_varint(cursor->next, &game_delta);
+    cursor->next = read_varint(cursor->next, &ply);
+    //plies are deltas within a game, the first posting of each game has its own ply
+    cursor->ply = game_delta == 0 && cursor->ply >= 0 ? cursor->ply + ply : ply;
+    cursor->game += game_delta;
+    cursor->remaining--;
+    return 1;
+}
+
+//usage: index build ..., index position <index file> <fen>, index material <index file> <KRPvKR>
+int run_index_mode(int argc, char *argv[])
+{
+    init_tables();
+    init_packed_codec();
+    if(argc > 0 && strcmp(argv[0], "build") == 0)
+    {
+        return build_game_index(argc - 1, argv + 1);
+    }
+    if(argc != 3 || (strcmp(argv[0], "position") != 0 && strcmp(argv[0], "material") != 0))
+    {
+        printf("usage: index build <games file> <index file> [threads] [memory MB] | index position <index file> <fen> | "
+            "index material <index file> <signature>\n");
+        return 1;
+    }
+
+    int section = strcmp(argv[0], "position") == 0 ? POSITION_SECTION : MATERIAL_SECTION;
+    uint64_t key;
+    if(section == POSITION_SECTION)
+    {
+        struct fen fn;
+        struct chess_game game;
+        if(!init_fen(&fn, argv[2]))
+        {
+            printf("invalid fen %s\n", argv[2]);
+            return 1;
+        }
+        init_chess_game(&game, &fn);
+        key = game.hash;
+    }
+    else
+    {
+        int64_t signature = parse_material_signature(argv[2]);
+        if(signature < 0)
+        {
+            printf("invalid material signature %s\n", argv[2]);
+            return 1;
+        }
+        key = material_key(signature);
+    }
+
+    struct game_index index;
+    struct posting_cursor cursor;
+    if(!open_game_index(argv[1], &index))
+    {
+        return 1;
+    }
+    double start = now_seconds();
+    long long count = find_index_postings(&index, section, key, &cursor);
+    long long games = 0;
+    uint32_t last_game = 0;
+    while(next_index_posting(&cursor))
+    {
+        games += games == 0 || cursor.game != last_game;
+        last_game = cursor.game;
+        if(games <= 20)
+        {
+            printf("game %u ply %d\n", cursor.game, cursor.ply);
+        }
+    }
+    printf("{\"postings\": %lld, \"games\": %lld, \"query_us\": %.1f}\n", count, games, (now_seconds() - start) * 1e6);
+    close_game_index(&index);
+    return 0;
+}
+
+//Move validation service. Games live in a slab of slots handed out from a free list, a game id
+//is the slot index in the low bits and the slot's generation above, so the id of a closed game
+//never reaches the next game in its slot. Requests are lines, one response line each:
+//  new [startpos | fen <fen>] [moves ...]   ok <id> <status> <fen> moves <legal moves>
+//  move <id> <move> [<move> ...]            ok ..., or illegal <id> <move> (nothing applied)
+//  validate <id> <move>                     legal <id> <move> or illegal <id> <move>
+//  show <id>                                ok ...
+//  close <id>                               closed <id>
+//A client may send any number of lines at once, every complete line read in one go is answered
+//with one write.
+#define SERVICE_SLOT_BITS 20
+#define SERVICE_BUFFER_SIZE 65536
+#define SERVICE_RESPONSE_SIZE 4096
+
+struct game_slot
+{
+    struct chess_game game;
+    struct key_history history;
+    pthread_mutex_t lock;
+    uint32_t generation;
+    int in_use;
+    int next_free;
+};
+
+struct game_pool
+{
+    struct game_slot *slots;
+    int capacity;
+    int free_list;
+    int in_use;
+    pthread_mutex_t lock;
+};
+
+struct service_connection
+{
+    int fd;
+    int length;
+    char input[SERVICE_BUFFER_SIZE];
+};
+
+struct game_service
+{
+    struct game_pool pool;
+    int listen_fd;
+    int epoll_fd;
+    long long requests;
+};
+
+volatile sig_atomic_t service_stopped = 0;
+
+void stop_service(int signal_number)
+{
+    service_stopped = signal_number;
+}
+
+//slots are calloc'd, so pages of a large pool are only touched once games reach them
+int init_game_pool(struct game_pool *pool, int capacity)
+{
+    capacity = capacity > (1 << SERVICE_SLOT_BITS) ? 1 << SERVICE_SLOT_BITS : capacity;
+    pool->slots = (struct game_slot*)calloc(capacity, sizeof(struct game_slot));
+    if(pool->slots == NULL)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    pool->capacity = capacity;
+    pool->in_use = 0;
+    for(int i = 0; i < capacity; i++)
+    {
+        pthread_mutex_init(&pool->slots[i].lock, NULL);
+        pool->slots[i].next_free = i + 1 < capacity ? i + 1 : -1;
+    }
+    pool->free_list = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    return 1;
+}
+
+void free_game_pool(struct game_pool *pool)
+{
+    for(int i = 0; i < pool->capacity; i++)
+    {
+        pthread_mutex_destroy(&pool->slots[i].lock);
+    }
+    free(pool->slots);
+}
+
+//returns the new game's slot locked, or NULL when the pool is full
+struct game_slot* allocate_game(struct game_pool *pool, uint32_t *id)
+{
+    pthread_mutex_lock(&pool->lock);
+    int index = pool->free_list;
+    if(index >= 0)
+    {
+        pool->free_list = pool->slots[index].next_free;
+        pool->in_use++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if(index < 0)
+    {
+        return NULL;
+    }
+
+    struct game_slot *slot = &pool->slots[index];
+    pthread_mutex_lock(&slot->lock);
+    slot->in_use = 1;
+    *id = ((slot->generation & ((1U << (32 - SERVICE_SLOT_BITS)) - 1)) << SERVICE_SLOT_BITS) | index;
+    return slot;
+}
+
+//returns the game's slot locked, or NULL when the id is not a live game
+struct game_slot* lock_game(struct game_pool *pool, uint32_t id)
+{
+    uint32_t index = id & ((1U << SERVICE_SLOT_BITS) - 1);
+    if(index >= (uint32_t)pool->capacity)
+    {
+        return NULL;
+    }
+    struct game_slot *slot = &pool->slots[index];
+    pthread_mutex_lock(&slot->lock);
+    if(!slot->in_use || ((slot->generation << SERVICE_SLOT_BITS) ^ id) >> SERVICE_SLOT_BITS != 0)
+    {
+        pthread_mutex_unlock(&slot->lock);
+        return NULL;
+    }
+    return slot;
+}
+
+//takes a locked slot back into the pool
+void release_game(struct game_pool *pool, struct game_slot *slot)
+{
+    slot->in_use = 0;
+    slot->generation++;
+    pthread_mutex_unlock(&slot->lock);
+    pthread_mutex_lock(&pool->lock);
+    slot->next_free = pool->free_list;
+    pool->free_list = slot - pool->slots;
+    pool->in_use--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int write_game_state(uint32_t id, struct chess_game *game, char *out, int size)
+{
+    struct queue *q = generate_legal_moves(game);
+    if(q == NULL)
+    {
+        return snprintf(out, size, "error memory not allocated\n");
+    }
+    int no_of_moves = 0;
+    for(struct node *current = q->front; current != NULL; current = current->next)
+    {
+        no_of_moves++;
+    }
+    char *status = "ongoing";
+    if(no_of_moves == 0)
+    {
+        status = is_in_check(game, game->turn) ? "checkmate" : "stalemate";
+    }
+    else if(is_fifty_move_draw(game) || count_repetitions(game) >= 2)
+    {
+        status = "draw";
+    }
+
+    generate_fen(game);
+    int length = snprintf(out, size, "ok %u %s %s moves", id, status, game->fen);
+    struct move *mv;
+    char text[6];
+    while((mv = dequeue(q)) != NULL)
+    {
+        move_to_string(mv, text);
+        length += snprintf(out + length, size - length, " %s", text);
+        free(mv);
+    }
+    free(q);
+    return length + snprintf(out + length, size - length, "\n");
+}
+
+//plays space separated moves, either all of them or none. Returns 1, or 0 with the first illegal move in word.
+int apply_moves(struct chess_game *game, char *moves, char *word, int size)
+{
+    struct chess_game next = *game;
+    while((moves = next_word(moves, word, size)) != NULL)
+    {
+        struct move *mv = parse_move(&next, word);
+        if(mv == NULL)
+        {
+            return 0;
+        }
+        make_move(&next, mv);
+        free(mv);
+    }
+    *game = next;
+    return 1;
+}
+
+//answers one request line into out (at most SERVICE_RESPONSE_SIZE bytes), returns the response length
+int handle_service_request(struct game_pool *pool, char *line, char *out)
+{
+    char command[16], word[100];
+    char *rest = next_word(line, command, sizeof(command));
+    if(rest == NULL)
+    {
+        return 0;
+    }
+
+    if(strcmp(command, "new") == 0)
+    {
+        uint32_t id;
+        struct game_slot *slot = allocate_game(pool, &id);
+        if(slot == NULL)
+        {
+            return snprintf(out, SERVICE_RESPONSE_SIZE, "error no free games\n");
+        }
+        char *moves = parse_position_line(&slot->game, next_word(rest, word, sizeof(word)) == NULL ? START_POSITION_LINE : rest);
+        if(moves == NULL)
+        {
+            release_game(pool, slot);
+            return snprintf(out, SERVICE_RESPONSE_SIZE, "error invalid position\n");
+        }
+        attach_key_history(&slot->game, &slot->history);
+        if(!apply_moves(&slot->game, moves, word, sizeof(word)))
+        {
+            release_game(pool, slot);
+            return snprintf(out, SERVICE_RESPONSE_SIZE, "error illegal move %s\n", word);
+        }
+        int length = write_game_state(id, &slot->game, out, SERVICE_RESPONSE_SIZE);
+        pthread_mutex_unlock(&slot->lock);
+        return length;
+    }
+
+    char *end;
+    rest = next_word(rest, word, sizeof(word));
+    uint32_t id = rest == NULL ? 0 : strtoul(word, &end, 10);
+    struct game_slot *slot = rest == NULL || *end != '\0' ? NULL : lock_game(pool, id);
+    if(slot == NULL)
+    {
+        return snprintf(out, SERVICE_RESPONSE_SIZE, "error unknown game %s\n", rest == NULL ? "" : word);
+    }
+
+    int length;
+    if(strcmp(command, "move") == 0)
+    {
+        length = apply_moves(&slot->game, rest, word, sizeof(word)) ? write_game_state(id, &slot->game, out, SERVICE_RESPONSE_SIZE) :
+            snprintf(out, SERVICE_RESPONSE_SIZE, "illegal %u %s\n", id, word);
+    }
+    else if(strcmp(command, "validate") == 0)
+    {
+        struct move *mv = next_word(rest, word, sizeof(word)) == NULL ? NULL : parse_move(&slot->game, word);
+        length = snprintf(out, SERVICE_RESPONSE_SIZE, "%s %u %s\n", mv != NULL ? "legal" : "illegal", id, word);
+        free(mv);
+    }
+    else if(strcmp(command, "show") == 0)
+    {
+        length = write_game_state(id, &slot->game, out, SERVICE_RESPONSE_SIZE);
+    }
+    else if(strcmp(command, "close") == 0)
+    {
+        release_game(pool, slot);
+        return snprintf(out, SERVICE_RESPONSE_SIZE, "closed %u\n", id);
+    }
+    else
+    {
+        length = snprintf(out, SERVICE_RESPONSE_SIZE, "error unknown request %s\n", command);
+    }
+    pthread_mutex_unlock(&slot->lock);
+    return length;
+}
+
+//answers every complete line in the connection's input with a single write where possible
+int serve_connection_input(struct game_service *service, struct service_connection *conn, char *out)
+{
+    int start = 0, length = 0, ok = 1;
+    for(int i = 0; i < conn->length && ok; i++)
+    {
+        if(conn->input[i] == '\n')
+        {
+            conn->input[i] = '\0';
+            if(i > start && conn->input[i - 1] == '\r')
+            {
+                conn->input[i - 1] = '\0';
+            }
+            length += handle_service_request(&service->pool, conn->input + start, out + length);
+            __atomic_add_fetch(&service->requests, 1, __ATOMIC_RELAXED);
+            start = i + 1;
+            if(length > SERVICE_BUFFER_SIZE - SERVICE_RESPONSE_SIZE)
+            {
+                ok = write_all(conn->fd, out, length);
+                length = 0;
+            }
+        }
+    }
+    ok = ok && write_all(conn->fd, out, length);
+
+    memmove(conn->input, conn->input + start, conn->length - start);
+    conn->length -= start;
+    if(conn->length == SERVICE_BUFFER_SIZE)
+    {
+        //a line longer than the buffer
+        conn->length = 0;
+        ok = ok && write_all(conn->fd, "error request too long\n", 23);
+    }
+    return ok;
+}
+
+//connections and the listening socket are armed one shot, so only one worker handles each at a time
+void* service_worker(void *arg)
+{
+    struct game_service *service = (struct game_service*)arg;
+    char *out = (char*)malloc(SERVICE_BUFFER_SIZE);
+    if(out == NULL)
+    {
+        printf("memory not allocated\n");
+        return NULL;
+    }
+
+    struct epoll_event event;
+    while(!service_stopped)
+    {
+        if(epoll_wait(service->epoll_fd, &event, 1, 200) <= 0)
+        {
+            continue;
+        }
+        struct service_connection *conn = (struct service_connection*)event.data.ptr;
+        if(conn == NULL)
+        {
+            int fd = accept(service->listen_fd, NULL, NULL);
+            conn = fd < 0 ? NULL : (struct service_connection*)malloc(sizeof(struct service_connection));
+            if(conn != NULL)
+            {
+                conn->fd = fd;
+                conn->length = 0;
+                struct epoll_event client = {EPOLLIN | EPOLLONESHOT, {.ptr = conn}};
+                epoll_ctl(service->epoll_fd, EPOLL_CTL_ADD, fd, &client);
+            }
+            else if(fd >= 0)
+            {
+                close(fd);
+            }
+            struct epoll_event listener = {EPOLLIN | EPOLLONESHOT, {.ptr = NULL}};
+            epoll_ctl(service->epoll_fd, EPOLL_CTL_MOD, service->listen_fd, &listener);
+            continue;
+        }
+
+        ssize_t count = read(conn->fd, conn->input + conn->length, SERVICE_BUFFER_SIZE - conn->length);
+        if(count <= 0 || (conn->length += count, !serve_connection_input(service, conn, out)))
+        {
+            close(conn->fd);
+            free(conn);
+            continue;
+        }
+        event.events = EPOLLIN | EPOLLONESHOT;
+        epoll_ctl(service->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    }
+    free(out);
+    return NULL;
+}
+
+int serve_stdin(struct game_service *service)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    char out[SERVICE_RESPONSE_SIZE];
+    while(getline(&line, &capacity, stdin) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        fwrite(out, 1, handle_service_request(&service->pool, line, out), stdout);
+        fflush(stdout);
+        service->requests++;
+    }
+    free(line);
+    return 0;
+}
+
+//usage: serve <socket path | -> [threads] [max games]
+int run_service(int argc, char *argv[])
+{
+    struct game_service service;
+    int no_of_threads = argc > 1 ? atoi(argv[1]) : 4;
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    if(argc < 1 || !init_game_pool(&service.pool, argc > 2 ? atoi(argv[2]) : 65536))
+    {
+        printf("usage: serve <socket path | -> [threads] [max games]\n");
+        return 1;
+    }
+    service.requests = 0;
+    init_tables();
+    if(strcmp(argv[0], "-") == 0)
+    {
+        serve_stdin(&service);
+        free_game_pool(&service.pool);
+        return 0;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[0], sizeof(address.sun_path) - 1);
+    unlink(argv[0]);
+    service.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    service.epoll_fd = epoll_create1(0);
+    struct epoll_event listener = {EPOLLIN | EPOLLONESHOT, {.ptr = NULL}};
+    if(service.listen_fd < 0 || service.epoll_fd < 0 || bind(service.listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(service.listen_fd, 128) != 0 || epoll_ctl(service.epoll_fd, EPOLL_CTL_ADD, service.listen_fd, &listener) != 0)
+    {
+        printf("cannot listen on %s\n", argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, stop_service);
+    signal(SIGTERM, stop_service);
+    signal(SIGPIPE, SIG_IGN);
+    printf("serving %s with %d threads, %d games\n", argv[0], no_of_threads, service.pool.capacity);
+    fflush(stdout);
+    double start = now_seconds();
+    run_worker_threads(no_of_threads, service_worker, &service);
+    printf("{\"requests\": %lld, \"seconds\": %.1f, \"games_open\": %d}\n", service.requests, now_seconds() - start, service.pool.in_use);
+    close(service.listen_fd);
+    close(service.epoll_fd);
+    unlink(argv[0]);
+    free_game_pool(&service.pool);
+    return 0;
+}
+
+struct load_client
+{
+    char *path;
+    int no_of_games;
+    int batch;
+    double seconds;
+    unsigned int seed;
+    double *latencies;
+    long long no_of_batches;
+    long long capacity;
+    long long requests;
+    long long errors;
+};
+
+//the response to the last request for each game, moves are picked from its legal move list
+struct load_game
+{
+    char state[SERVICE_RESPONSE_SIZE];
+    int plies;
+};
+
+int read_response(FILE *fp, char *line, int size)
+{
+    if(fgets(line, size, fp) == NULL)
+    {
+        return 0;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    return 1;
+}
+
+//writes the next request for a game: a random legal move, or a fresh game once it is over
+int next_load_request(struct load_game *lg, char *out, unsigned int *seed)
+{
+    char *moves = strstr(lg->state, " moves");
+    uint32_t id = strtoul(lg->state + 3, NULL, 10);
+    int no_of_moves = 0;
+    for(char *p = moves == NULL ? NULL : moves + 6; p != NULL && *p != '\0'; p++)
+    {
+        no_of_moves += *p == ' ';
+    }
+    if(strncmp(lg->state, "ok ", 3) != 0 || no_of_moves == 0 || strstr(lg->state, " draw ") != NULL || lg->plies >= 200)
+    {
+        lg->plies = 0;
+        return strncmp(lg->state, "ok ", 3) == 0 ? sprintf(out, "close %u\nnew startpos\n", id) : sprintf(out, "new startpos\n");
+    }
+
+    char word[16];
+    char *p = moves + 6;
+    for(int pick = rand_r(seed) % no_of_moves; pick >= 0; pick--)
+    {
+        p = next_word(p, word, sizeof(word));
+    }
+    lg->plies++;
+    return sprintf(out, "move %u %s\n", id, word);
+}
+
+void* load_client_worker(void *arg)
+{
+    struct load_client *client = (struct load_client*)arg;
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, client->path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("cannot connect to %s\n", client->path);
+        client->errors++;
+        return NULL;
+    }
+    FILE *in = fdopen(fd, "r");
+    struct load_game *games = (struct load_game*)calloc(client->no_of_games, sizeof(struct load_game));
+    char *out = (char*)malloc((size_t)client->batch * 64 + 64);
+    char line[SERVICE_RESPONSE_SIZE];
+    if(in == NULL || games == NULL || out == NULL)
+    {
+        printf("memory not allocated\n");
+        client->errors++;
+        return NULL;
+    }
+
+    //every game starts as a failed response, so its first request is new
+    int next_game = 0;
+    double start = now_seconds();
+    while(now_seconds() - start < client->seconds)
+    {
+        int length = 0, first = next_game, expected = 0;
+        for(int i = 0; i < client->batch; i++)
+        {
+            struct load_game *lg = &games[(first + i) % client->no_of_games];
+            int request = next_load_request(lg, out + length, &client->seed);
+            for(int j = 0; j < request; j++)
+            {
+                expected += out[length + j] == '\n';
+            }
+            length += request;
+        }
+        next_game = (first + client->batch) % client->no_of_games;
+
+        double sent = now_seconds();
+        if(!write_all(fd, out, length))
+        {
+            client->errors++;
+            break;
+        }
+        for(int i = 0, game = first; i < expected; i++)
+        {
+            if(!read_response(in, line, sizeof(line)))
+            {
+                client->errors++;
+                expected = -1;
+                break;
+            }
+            if(strncmp(line, "closed ", 7) == 0)
+            {
+                continue;
+            }
+            client->errors += strncmp(line, "ok ", 3) != 0;
+            string_cpy(games[game].state, line);
+            game = (game + 1) % client->no_of_games;
+        }
+        if(expected < 0)
+        {
+            break;
+        }
+
+        if(client->no_of_batches == client->capacity)
+        {
+            client->capacity = client->capacity == 0 ? 4096 : client->capacity * 2;
+            client->latencies = (double*)realloc(client->latencies, sizeof(double) * client->capacity);
+        }
+        client->latencies[client->no_of_batches++] = now_seconds() - sent;
+        client->requests += expected;
+    }
+    fclose(in);
+    free(games);
+    free(out);
+    return NULL;
+}
+
+//usage: serve load <socket path> [clients] [seconds] [batch] [games per client]
+int run_service_load(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: serve load <socket path> [clients] [seconds] [batch] [games per client]\n");
+        return 1;
+    }
+    int no_of_clients = argc > 1 ? atoi(argv[1]) : 8;
+    no_of_clients = no_of_clients < 1 ? 1 : no_of_clients > 256 ? 256 : no_of_clients;
+    struct load_client clients[256];
+    pthread_t threads[256];
+    for(int i = 0; i < no_of_clients; i++)
+    {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].path = argv[0];
+        clients[i].seconds = argc > 2 ? atof(argv[2]) : 5;
+        clients[i].batch = argc > 3 ? atoi(argv[3]) : 16;
+        clients[i].no_of_games = argc > 4 ? atoi(argv[4]) : 1000;
+        clients[i].batch = clients[i].batch < 1 ? 1 : clients[i].batch > clients[i].no_of_games ? clients[i].no_of_games : clients[i].batch;
+        clients[i].seed = 12345 + i;
+    }
+
+    double start = now_seconds();
+    int started = 0;
+    for(int i = 0; i < no_of_clients; i++)
+    {
+        started += pthread_create(&threads[i], NULL, load_client_worker, &clients[i]) == 0;
+    }
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    long long no_of_batches = 0, requests = 0, errors = 0;
+    for(int i = 0; i < started; i++)
+    {
+        no_of_batches += clients[i].no_of_batches;
+        requests += clients[i].requests;
+        errors += clients[i].errors;
+    }
+    double *latencies = (double*)malloc(sizeof(double) * (no_of_batches + 1));
+    if(latencies == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    long long count = 0;
+    for(int i = 0; i < started; i++)
+    {
+        memcpy(latencies + count, clients[i].latencies, sizeof(double) * clients[i].no_of_batches);
+        count += clients[i].no_of_batches;
+        free(clients[i].latencies);
+    }
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("{\"clients\": %d, \"batch\": %d, \"batches\": %lld, \"requests\": %lld, \"errors\": %lld, \"requests_per_s\": %.0f, "
+        "\"batch_p50_us\": %.1f, \"batch_p99_us\": %.1f}\n", started, clients[0].batch, count, requests, errors, requests / elapsed,
+        count > 0 ? latencies[count / 2] * 1e6 : 0, count > 0 ? latencies[count * 99 / 100] * 1e6 : 0);
+    free(latencies);
+    return errors != 0;
+}
+
+//Search: iterative deepening principal variation search with null move pruning, check extensions
+//and a quiescence search over captures. Every thread searches the same root (lazy smp, helpers
+//start one ply deeper on odd ids) and they share what they find through the transposition table.
+#define MAX_PLY 128
+#define MAX_MOVES 256
+#define MAX_MULTI_PV 32
+
+const int INFINITE_SCORE = 32001, MATE_SCORE = 32000, MATE_BOUND = 31000;
+const int BOUND_UPPER = 1, BOUND_LOWER = 2, BOUND_EXACT = 3;
+
+//data packs move (16 bits), score (16), depth (8), bound (2) and generation (6). check is the key
+//xor the data, so an entry torn by two threads writing at once reads as a miss.
+struct tt_entry
+{
+    uint64_t check;
+    uint64_t data;
+};
+
+struct transposition_table
+{
+    struct tt_entry *entries;
+    uint64_t mask;
+    int generation;
+    size_t size;
+    int pages;
+};
+
+struct search_limits
+{
+    int depth;
+    long long nodes;
+    int movetime;
+    int time[2];
+    int increment[2];
+    int movestogo;
+    int infinite;
+    int ponder;
+};
+
+struct search_shared
+{
+    struct transposition_table *table;
+    struct analysis_cache *cache;
+    struct eval_params *params;
+    struct chess_game root;
+    struct key_history history;
+    struct search_limits limits;
+    struct search_thread *threads;
+    int no_of_threads;
+    double start;
+    double soft_time;
+    double hard_time;
+    int stop;
+    int pondering;
+    int verbose;
+    int multi_pv;
+    void (*on_iteration)(struct search_thread *st, int depth);
+    void *context;
+};
+
+struct root_line
+{
+    int score;
+    int pv_length;
+    struct move pv[MAX_PLY];
+};
+
+//lines holds the iteration in progress, best_lines the last completed one, best first
+struct search_thread
+{
+    struct search_shared *shared;
+    int id;
+    struct chess_game root;
+    struct key_history history;
+    struct pawn_table pawns;
+    long long nodes;
+    struct move killers[MAX_PLY][2];
+    int history_scores[64][64];
+    struct move pv[MAX_PLY][MAX_PLY];
+    int pv_length[MAX_PLY];
+    struct root_line lines[MAX_MULTI_PV];
+    struct root_line best_lines[MAX_MULTI_PV];
+    int no_of_best_lines;
+    int completed_depth;
+};
+
+//Large tables are mapped with 2 MB pages when they can be: explicit huge pages from the reserved
+//pool first, then transparent ones asked for with madvise, then ordinary memory. With NumaPin
+//search thread i runs on the cpus of node i modulo the number of nodes, and a large table is
+//cleared by one thread per cpu pinned the same way, so its pages are spread over the nodes by
+//first touch instead of all landing next to the thread that allocated it.
+#define HUGE_PAGE_SIZE (2 << 20)
+#define MAX_NUMA_NODES 64
+#define PARALLEL_CLEAR_BYTES (64 << 20)
+const int PAGES_NORMAL = 0, PAGES_TRANSPARENT = 1, PAGES_EXPLICIT = 2;
+const char *PAGE_KIND_NAMES[] = {"normal", "transparent huge", "explicit huge"};
+
+struct memory_settings
+{
+    int large_pages;
+    int numa_pin;
+    int no_of_nodes;
+    cpu_set_t node_cpus[MAX_NUMA_NODES];
+};
+
+struct memory_settings memory_settings = {.large_pages = 1};
+
+//reads the cpu list of every node ("0-3,8-11") from sysfs, or puts every cpu in one node
+void find_numa_nodes()
+{
+    char path[64], list[4096];
+    int count = 0;
+    for(int node = 0; node < MAX_NUMA_NODES; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *fp = fopen(path, "r");
+        if(fp == NULL)
+        {
+            continue;
+        }
+        cpu_set_t *cpus = &memory_settings.node_cpus[count];
+        CPU_ZERO(cpus);
+        if(fgets(list, sizeof(list), fp) != NULL)
+        {
+            char *p = list;
+            while(*p >= '0' && *p <= '9')
+            {
+                int first = strtol(p, &p, 10), last = first;
+                last = *p == '-' ? strtol(p + 1, &p, 10) : last;
+                for(int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+                {
+                    CPU_SET(cpu, cpus);
+                }
+                p += *p == ',';
+            }
+        }
+        fclose(fp);
+        count += CPU_COUNT(cpus) > 0;
+    }
+    if(count == 0)
+    {
+        CPU_ZERO(&memory_settings.node_cpus[0]);
+        for(int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &memory_settings.node_cpus[0]);
+        }
+        count = 1;
+    }
+    memory_settings.no_of_nodes = count;
+}
+
+//returns 1 when the calling thread was moved to its node's cpus
+int pin_thread_to_node(int index)
+{
+    if(!memory_settings.numa_pin)
+    {
+        return 0;
+    }
+    if(memory_settings.no_of_nodes == 0)
+    {
+        find_numa_nodes();
+    }
+    cpu_set_t *cpus = &memory_settings.node_cpus[index % memory_settings.no_of_nodes];
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) == 0;
+}
+
+void* alloc_large_table(size_t size, int *pages)
+{
+    void *memory;
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+    if(memory_settings.large_pages && size >= HUGE_PAGE_SIZE)
+    {
+        memory = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(memory != MAP_FAILED)
+        {
+            *pages = PAGES_EXPLICIT;
+            return memory;
+        }
+    }
+#endif
+    if(memory_settings.large_pages && size >= HUGE_PAGE_SIZE)
+    {
+        //map one page extra so the table can start on a huge page boundary
+        char *mapped = (char*)mmap(NULL, rounded + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapped != MAP_FAILED)
+        {
+            char *aligned = (char*)(((uintptr_t)mapped + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if(aligned > mapped)
+            {
+                munmap(mapped, aligned - mapped);
+            }
+            munmap(aligned + rounded, mapped + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, rounded, MADV_HUGEPAGE);
+#endif
+            *pages = PAGES_TRANSPARENT;
+            return aligned;
+        }
+    }
+    *pages = PAGES_NORMAL;
+    return malloc(size);
+}
+
+void free_large_table(void *memory, size_t size, int pages)
+{
+    if(memory != NULL && pages != PAGES_NORMAL)
+    {
+        munmap(memory, (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1));
+    }
+    else
+    {
+        free(memory);
+    }
+}
+
+//kilobytes of the mapping at memory that the kernel backs with transparent huge pages
+long long transparent_huge_kb(void *memory)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if(fp == NULL)
+    {
+        return -1;
+    }
+    char line[256];
+    long long kb = -1;
+    int inside = 0;
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned long long first, last;
+        if(sscanf(line, "%llx-%llx ", &first, &last) == 2)
+        {
+            if(inside)
+            {
+                break;
+            }
+            inside = (uintptr_t)memory >= first && (uintptr_t)memory < last;
+        }
+        else if(inside && sscanf(line, "AnonHugePages: %lld kB", &kb) == 1)
+        {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb;
+}
+
+struct clear_job
+{
+    char *memory;
+    size_t size;
+    int no_of_threads;
+    int next;
+};
+
+void* clear_worker(void *arg)
+{
+    struct clear_job *job = (struct clear_job*)arg;
+    int index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    pin_thread_to_node(index);
+    //slices are whole huge pages so no page is touched first from two nodes
+    size_t slice = ((job->size / job->no_of_threads) + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    size_t start = slice * index;
+    if(start < job->size)
+    {
+        memset(job->memory + start, 0, start + slice < job->size ? slice : job->size - start);
+    }
+    return NULL;
+}
+
+//zeroes a table, a large one with a thread per cpu
+void clear_large_table(void *memory, size_t size)
+{
+    int no_of_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    if(size < PARALLEL_CLEAR_BYTES || no_of_threads == 1)
+    {
+        memset(memory, 0, size);
+        return;
+    }
+    struct clear_job job = {(char*)memory, size, no_of_threads, 0};
+    run_worker_threads(no_of_threads, clear_worker, &job);
+}
+
+int init_transposition_table(struct transposition_table *table, int megabytes)
+{
+    uint64_t no_of_entries = 1;
+    while(no_of_entries * 2 * sizeof(struct tt_entry) <= ((uint64_t)megabytes << 20))
+    {
+        no_of_entries *= 2;
+    }
+    table->size = no_of_entries * sizeof(struct tt_entry);
+    table->entries = (struct tt_entry*)alloc_large_table(table->size, &table->pages);
+    if(table->entries == NULL)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    table->mask = no_of_entries - 1;
+    table->generation = 0;
+    clear_large_table(table->entries, table->size);
+    return 1;
+}
+
+void clear_transposition_table(struct transposition_table *table)
+{
+    clear_large_table(table->entries, table->size);
+    table->generation = 0;
+}
+
+void free_transposition_table(struct transposition_table *table)
+{
+    free_large_table(table->entries, table->size, table->pages);
+    table->entries = NULL;
+}
+
+//what the table got: its page kind, and for transparent pages how much the kernel really backs
+void describe_table_memory(struct transposition_table *table, char *text, int size)
+{
+    int length = snprintf(text, size, "hash %zu MB %s pages", table->size >> 20, PAGE_KIND_NAMES[table->pages]);
+    if(table->pages == PAGES_TRANSPARENT && length < size)
+    {
+        long long kb = transparent_huge_kb(table->entries);
+        if(kb >= 0)
+        {
+            length += snprintf(text + length, size - length, ", %lld of %zu MB backed", kb >> 10, table->size >> 20);
+        }
+    }
+    if(memory_settings.numa_pin && length < size)
+    {
+        if(memory_settings.no_of_nodes == 0)
+        {
+            find_numa_nodes();
+        }
+        snprintf(text + length, size - length, ", threads pinned over %d numa nodes", memory_settings.no_of_nodes);
+    }
+}
+
+int tt_hashfull(struct transposition_table *table)
+{
+    int used = 0;
+    for(int i = 0; i < 1000 && (uint64_t)i <= table->mask; i++)
+    {
+        uint64_t data = table->entries[i].data;
+        used += data != 0 && (int)((data >> 42) & 63) == table->generation;
+    }
+    return used;
+}
+
+int pack_move(struct move *mv)
+{
+    return mv->src | (mv->dest << 6) | (mv->type << 12);
+}
+
+void unpack_move(int packed, struct move *mv)
+{
+    mv->src = packed & 63;
+    mv->dest = (packed >> 6) & 63;
+    mv->type = packed >> 12;
+}
+
+//mate scores are stored relative to the node so they stay right wherever the position turns up
+int score_to_tt(int score, int ply)
+{
+    return score > MATE_BOUND ? score + ply : score < -MATE_BOUND ? score - ply : score;
+}
+
+int score_from_tt(int score, int ply)
+{
+    return score > MATE_BOUND ? score - ply : score < -MATE_BOUND ? score + ply : score;
+}
+
+int probe_tt(struct transposition_table *table, uint64_t key, int *move, int *score, int *depth, int *bound)
+{
+    struct tt_entry *entry = &table->entries[key & table->mask];
+    uint64_t data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    uint64_t check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+    STAT_INC(tt_probes);
+    if((check ^ data) != key)
+    {
+        return 0;
+    }
+    STAT_INC(tt_hits);
+    *move = data & 0xFFFF;
+    *score = (int16_t)((data >> 16) & 0xFFFF);
+    *depth = (data >> 32) & 0xFF;
+    *bound = (data >> 40) & 3;
+    return 1;
+}
+
+//keeps a deeper entry of the current search unless this one is for the same position
+void store_tt(struct transposition_table *table, uint64_t key, int move, int score, int depth, int bound)
+{
+    struct tt_entry *entry = &table->entries[key & table->mask];
+    uint64_t old = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    int same_key = (__atomic_load_n(&entry->check, __ATOMIC_RELAXED) ^ old) == key;
+    if(!same_key && (int)((old >> 42) & 63) == table->generation && (int)((old >> 32) & 0xFF) > depth)
+    {
+        return;
+    }
+    if(same_key && move == 0)
+    {
+        move = old & 0xFFFF;
+    }
+    uint64_t data = (uint64_t)(move & 0xFFFF) | ((uint64_t)(score & 0xFFFF) << 16) | ((uint64_t)(depth & 0xFF) << 32) |
+        ((uint64_t)bound << 40) | ((uint64_t)(table->generation & 63) << 42);
+    __atomic_store_n(&entry->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+//Analysis cache: a transposition table in a file, mapped shared so results outlive the process.
+//The search looks here when its own table has nothing as deep, and writes results of at least
+//CACHE_MIN_DEPTH that are not shallower than what the slot holds, so the file mostly sees reads.
+//Entries keep generation 0, which makes store_tt depth preferred for them.
+#define CACHE_MIN_DEPTH 4
+
+const char CACHE_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'A', 'C', '1'};
+
+struct cache_file_header
+{
+    char magic[8];
+    uint64_t no_of_entries;
+};
+
+struct analysis_cache
+{
+    int fd;
+    void *map;
+    size_t size;
+    struct transposition_table table;
+};
+
+//opens the cache at path, or creates one of about megabytes when there is none
+int open_analysis_cache(char *path, int megabytes, struct analysis_cache *cache)
+{
+    cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(cache->fd < 0)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    struct stat st;
+    struct cache_file_header header;
+    fstat(cache->fd, &st);
+    if(st.st_size == 0)
+    {
+        memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+        header.no_of_entries = 1;
+        while(header.no_of_entries * 2 * sizeof(struct tt_entry) <= ((uint64_t)megabytes << 20))
+        {
+            header.no_of_entries *= 2;
+        }
+        st.st_size = sizeof(header) + header.no_of_entries * sizeof(struct tt_entry);
+        if(!write_all(cache->fd, &header, sizeof(header)) || ftruncate(cache->fd, st.st_size) != 0)
+        {
+            printf("cannot create %s\n", path);
+            close(cache->fd);
+            return 0;
+        }
+    }
+
+    cache->size = st.st_size;
+    cache->map = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    struct cache_file_header *mapped = (struct cache_file_header*)cache->map;
+    if(cache->map == MAP_FAILED || cache->size < sizeof(header) || memcmp(mapped->magic, CACHE_FILE_MAGIC, sizeof(mapped->magic)) != 0 ||
+        (mapped->no_of_entries & (mapped->no_of_entries - 1)) != 0 || sizeof(header) + mapped->no_of_entries * sizeof(struct tt_entry) != cache->size)
+    {
+        printf("%s is not an analysis cache\n", path);
+        if(cache->map != MAP_FAILED)
+        {
+            munmap(cache->map, cache->size);
+        }
+        close(cache->fd);
+        return 0;
+    }
+    cache->table.entries = (struct tt_entry*)((char*)cache->map + sizeof(header));
+    cache->table.mask = mapped->no_of_entries - 1;
+    cache->table.generation = 0;
+    return 1;
+}
+
+void close_analysis_cache(struct analysis_cache *cache)
+{
+    msync(cache->map, cache->size, MS_SYNC);
+    munmap(cache->map, cache->size);
+    close(cache->fd);
+}
+
+void store_analysis_cache(struct analysis_cache *cache, uint64_t key, int move, int score, int depth, int bound)
+{
+    struct tt_entry *entry = &cache->table.entries[key & cache->table.mask];
+    uint64_t old = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+    if(old == 0 || (int)((old >> 32) & 0xFF) <= depth)
+    {
+        store_tt(&cache->table, key, move, score, depth, bound);
+    }
+}
+
+//passes the move: clears en passant and records the key like make_move, and counts as
+//irreversible so no repetition is found across it
+void make_null_move(struct chess_game *game)
+{
+    if(game->en_passant != -1)
+    {
+        game->hash ^= zobrist_en_passant[file(game->en_passant)];
+        game->en_passant = -1;
+    }
+    game->turn = opposite_color(game->turn);
+    game->hash ^= zobrist_turn;
+    game->half_moves = 0;
+    if(game->history != NULL)
+    {
+        game->history->keys[++game->history_ply & (HISTORY_SIZE - 1)] = game->hash;
+    }
+}
+
+int has_non_pawn_material(struct chess_game *game)
+{
+    struct piece_list *p_list = game->turn == WHITE ? &game->white_piece_list : &game->black_piece_list;
+    return p_list->no_of_pieces[QUEEN] + p_list->no_of_pieces[ROOK] + p_list->no_of_pieces[BISHOP] + p_list->no_of_pieces[KNIGHT] > 0;
+}
+
+int same_move(struct move *a, struct move *b)
+{
+    return a->src == b->src && a->dest == b->dest && a->type == b->type;
+}
+
+//pseudo legal moves in an array with ordering scores: table move, captures by most valuable
+//victim then least valuable attacker, queen promotions, killers, then the history table
+int generate_scored_moves(struct search_thread *st, struct chess_game *game, int ply, int tt_move, struct move *moves, int *scores)
+{
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return 0;
+    }
+    int count = 0;
+    struct move *mv;
+    struct eval_params *params = st->shared->params;
+    while((mv = dequeue(q)) != NULL)
+    {
+        if(count < MAX_MOVES)
+        {
+            moves[count] = *mv;
+            int score;
+            if(pack_move(mv) == tt_move)
+            {
+                score = 4000000;
+            }
+            else if(is_capture(mv))
+            {
+                int victim = mv->type == ENPASSANT_CAPTURE ? PAWN : piece_type(game->board[mv->dest]);
+                score = 2000000 + params->piece_value[victim] * 10 + piece_type(game->board[mv->src]);
+            }
+            else if(mv->type == QUEEN_PROMOTION)
+            {
+                score = 1900000;
+            }
+            else if(ply < MAX_PLY && same_move(mv, &st->killers[ply][0]))
+            {
+                score = 1800000;
+            }
+            else if(ply < MAX_PLY && same_move(mv, &st->killers[ply][1]))
+            {
+                score = 1700000;
+            }
+            else
+            {
+                score = st->history_scores[mv->src][mv->dest];
+            }
+            scores[count++] = score;
+        }
+        free(mv);
+    }
+    free(q);
+    return count;
+}
+
+//moves the best scored of the remaining moves to index
+void pick_move(struct move *moves, int *scores, int index, int count)
+{
+    int best = index;
+    for(int i = index + 1; i < count; i++)
+    {
+        best = scores[i] > scores[best] ? i : best;
+    }
+    struct move mv = moves[index];
+    int score = scores[index];
+    moves[index] = moves[best];
+    scores[index] = scores[best];
+    moves[best] = mv;
+    scores[best] = score;
+}
+
+//plays mv on child if it is legal for the side to move in game
+int make_legal_move(struct chess_game *game, struct move *mv, struct chess_game *child, int in_check)
+{
+    if(mv->type == KING_CASTLE || mv->type == QUEEN_CASTLE)
+    {
+        int step = mv->type == KING_CASTLE ? E : W;
+        if(in_check || is_square_attacked(game, mv->src + step, opposite_color(game->turn)))
+        {
+            return 0;
+        }
+    }
+    *child = *game;
+    make_move(child, mv);
+    return !is_in_check(child, game->turn);
+}
+
+void update_pv(struct search_thread *st, int ply, struct move *mv)
+{
+    st->pv[ply][0] = *mv;
+    for(int i = 0; i < st->pv_length[ply + 1]; i++)
+    {
+        st->pv[ply][i + 1] = st->pv[ply + 1][i];
+    }
+    st->pv_length[ply] = st->pv_length[ply + 1] + 1;
+}
+
+long long total_search_nodes(struct search_shared *shared)
+{
+    long long nodes = 0;
+    for(int i = 0; i < shared->no_of_threads; i++)
+    {
+        nodes += __atomic_load_n(&shared->threads[i].nodes, __ATOMIC_RELAXED);
+    }
+    return nodes;
+}
+
+//every node checks the flag, the first thread also watches the clock and node limit
+int search_stopped(struct search_thread *st)
+{
+    struct search_shared *shared = st->shared;
+    if(__atomic_load_n(&shared->stop, __ATOMIC_RELAXED))
+    {
+        return 1;
+    }
+    if(st->id == 0 && (st->nodes & 1023) == 0)
+    {
+        int pondering = __atomic_load_n(&shared->pondering, __ATOMIC_ACQUIRE);
+        if((!pondering && shared->hard_time > 0 && now_seconds() - shared->start >= shared->hard_time) ||
+            (shared->limits.nodes > 0 && total_search_nodes(shared) >= shared->limits.nodes))
+        {
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void count_node(struct search_thread *st)
+{
+    __atomic_store_n(&st->nodes, st->nodes + 1, __ATOMIC_RELAXED);
+}
+
+int quiescence(struct search_thread *st, struct chess_game *game, int alpha, int beta, int ply)
+{
+    st->pv_length[ply] = 0;
+    if(search_stopped(st))
+    {
+        return 0;
+    }
+    count_node(st);
+    STAT_INC(qsearch_nodes);
+    TRACE_EVENT(TRACE_QUIESCENCE, ply, 0, alpha, beta, 0, 0, 0, 0);
+
+    int in_check = is_in_check(game, game->turn);
+    int best = -INFINITE_SCORE;
+    if(!in_check || ply >= MAX_PLY - 1)
+    {
+        best = evaluate(game, st->shared->params, &st->pawns);
+        if(best >= beta || ply >= MAX_PLY - 1)
+        {
+            return best;
+        }
+        alpha = best > alpha ? best : alpha;
+    }
+
+    //in check every evasion is searched, otherwise only captures and queen promotions
+    struct move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int count = generate_scored_moves(st, game, ply, 0, moves, scores);
+    int legal = 0;
+    struct chess_game child;
+    for(int i = 0; i < count; i++)
+    {
+        pick_move(moves, scores, i, count);
+        if(!in_check && !is_capture(&moves[i]) && moves[i].type != QUEEN_PROMOTION)
+        {
+            continue;
+        }
+        if(!make_legal_move(game, &moves[i], &child, in_check))
+        {
+            continue;
+        }
+        legal++;
+        int score = -quiescence(st, &child, -beta, -alpha, ply + 1);
+        if(__atomic_load_n(&st->shared->stop, __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+        if(score > best)
+        {
+            best = score;
+            if(score > alpha)
+            {
+                alpha = score;
+                update_pv(st, ply, &moves[i]);
+                if(score >= beta)
+                {
+                    STAT_INC(beta_cutoffs);
+                    STAT_INC(cutoffs_by_index[legal < 8 ? legal - 1 : 7]);
+                    break;
+                }
+            }
+        }
+    }
+    return in_check && legal == 0 ? -MATE_SCORE + ply : best;
+}
+
+int search(struct search_thread *st, struct chess_game *game, int depth, int alpha, int beta, int ply, int allow_null)
+{
+    st->pv_length[ply] = 0;
+    if(search_stopped(st))
+    {
+        return 0;
+    }
+    if(ply > 0 && is_draw(game))
+    {
+        return 0;
+    }
+    int in_check = is_in_check(game, game->turn);
+    depth += in_check;
+    if(depth <= 0 || ply >= MAX_PLY - 1)
+    {
+        return quiescence(st, game, alpha, beta, ply);
+    }
+    count_node(st);
+    STAT_INC(search_nodes);
+
+    //no line from here can beat a mate already found closer to the root
+    alpha = alpha > -MATE_SCORE + ply ? alpha : -MATE_SCORE + ply;
+    beta = beta < MATE_SCORE - ply - 1 ? beta : MATE_SCORE - ply - 1;
+    if(alpha >= beta)
+    {
+        return alpha;
+    }
+
+    struct transposition_table *table = st->shared->table;
+    struct analysis_cache *cache = st->shared->cache;
+    int tt_move = 0, tt_score, tt_depth, tt_bound;
+    int cache_move, cache_score, cache_depth, cache_bound;
+    int pv_node = beta - alpha > 1;
+    int hit = probe_tt(table, game->hash, &tt_move, &tt_score, &tt_depth, &tt_bound);
+    if(cache != NULL && (!hit || tt_depth < depth) &&
+        probe_tt(&cache->table, game->hash, &cache_move, &cache_score, &cache_depth, &cache_bound) && (!hit || cache_depth > tt_depth))
+    {
+        hit = 1;
+        tt_move = cache_move;
+        tt_score = cache_score;
+        tt_depth = cache_depth;
+        tt_bound = cache_bound;
+    }
+    if(hit && ply > 0 && !pv_node && tt_depth >= depth)
+    {
+        tt_score = score_from_tt(tt_score, ply);
+        if(tt_bound == BOUND_EXACT || (tt_bound == BOUND_LOWER && tt_score >= beta) || (tt_bound == BOUND_UPPER && tt_score <= alpha))
+        {
+            TRACE_EVENT(TRACE_ENTER, ply, depth, alpha, beta, tt_move, TRACE_TT_CUTOFF, 0, -in_check);
+            return tt_score;
+        }
+    }
+    TRACE_EVENT(TRACE_ENTER, ply, depth, alpha, beta, tt_move, hit ? TRACE_TT_HIT : TRACE_TT_MISS, 0, -in_check);
+
+    if(allow_null && !pv_node && !in_check && depth >= 3 && beta < MATE_BOUND && has_non_pawn_material(game) &&
+        evaluate(game, st->shared->params, &st->pawns) >= beta)
+    {
+        struct chess_game child = *game;
+        make_null_move(&child);
+        int score = -search(st, &child, depth - 3, -beta, -beta + 1, ply + 1, 0);
+        if(__atomic_load_n(&st->shared->stop, __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+        TRACE_EVENT(TRACE_NULL_MOVE, ply, depth, score, beta, 0, score >= beta, 0, 2);
+        if(score >= beta)
+        {
+            return score < MATE_BOUND ? score : beta;
+        }
+    }
+
+    struct move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int count = generate_scored_moves(st, game, ply, tt_move, moves, scores);
+    int legal = 0, best = -INFINITE_SCORE, best_move = 0, original_alpha = alpha;
+    struct chess_game child;
+    for(int i = 0; i < count; i++)
+    {
+        pick_move(moves, scores, i, count);
+        struct move *mv = &moves[i];
+        if(!make_legal_move(game, mv, &child, in_check))
+        {
+            continue;
+        }
+        legal++;
+
+        int score;
+        if(legal == 1)
+        {
+            score = -search(st, &child, depth - 1, -beta, -alpha, ply + 1, 1);
+        }
+        else
+        {
+            score = -search(st, &child, depth - 1, -alpha - 1, -alpha, ply + 1, 1);
+            if(score > alpha && score < beta)
+            {
+                score = -search(st, &child, depth - 1, -beta, -alpha, ply + 1, 1);
+            }
+        }
+        if(__atomic_load_n(&st->shared->stop, __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+
+        if(score > best)
+        {
+            best = score;
+            best_move = pack_move(mv);
+            if(score > alpha)
+            {
+                alpha = score;
+                update_pv(st, ply, mv);
+                if(score >= beta)
+                {
+                    STAT_INC(beta_cutoffs);
+                    STAT_INC(cutoffs_by_index[legal < 8 ? legal - 1 : 7]);
+                    if(!is_capture(mv))
+                    {
+                        if(!same_move(mv, &st->killers[ply][0]))
+                        {
+                            st->killers[ply][1] = st->killers[ply][0];
+                            st->killers[ply][0] = *mv;
+                        }
+                        st->history_scores[mv->src][mv->dest] += depth * depth;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    TRACE_EVENT(TRACE_EXIT, ply, depth, best, original_alpha, best_move, best >= beta ? legal - 1 : 255, legal, 0);
+    if(legal == 0)
+    {
+        return in_check ? -MATE_SCORE + ply : 0;
+    }
+    int bound = best >= beta ? BOUND_LOWER : best > original_alpha ? BOUND_EXACT : BOUND_UPPER;
+    store_tt(table, game->hash, best_move, score_to_tt(best, ply), depth, bound);
+    if(cache != NULL && depth >= CACHE_MIN_DEPTH)
+    {
+        store_analysis_cache(cache, game->hash, best_move, score_to_tt(best, ply), depth, bound);
+    }
+    return best;
+}
+
+//adds the line for mv at its place in the sorted lines, dropping the last one when they are full
+void insert_root_line(struct search_thread *st, int *found, int no_of_lines, struct move *mv, int score)
+{
+    int index = *found < no_of_lines ? (*found)++ : no_of_lines - 1;
+    while(index > 0 && st->lines[index - 1].score < score)
+    {
+        st->lines[index] = st->lines[index - 1];
+        index--;
+    }
+    struct root_line *line = &st->lines[index];
+    line->score = score;
+    line->pv[0] = *mv;
+    line->pv_length = st->pv_length[1] + 1;
+    memcpy(&line->pv[1], st->pv[1], sizeof(struct move) * st->pv_length[1]);
+}
+
+//the root of a multi pv search: one pass over the moves with the score of the worst of the
+//best lines as the bound. A move is searched exactly only when it beats that, the others are
+//refuted by a null window search as in a single pv search. Moves of the last iteration's lines
+//go first so the bound is tight early. Returns the number of lines, sorted best first.
+int search_root_lines(struct search_thread *st, int depth, int no_of_lines)
+{
+    struct chess_game *game = &st->root;
+    int in_check = is_in_check(game, game->turn);
+    struct move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int count = generate_scored_moves(st, game, 0, 0, moves, scores);
+    for(int i = 0; i < count; i++)
+    {
+        for(int k = 0; k < st->no_of_best_lines; k++)
+        {
+            scores[i] = same_move(&moves[i], &st->best_lines[k].pv[0]) ? 5000000 - k : scores[i];
+        }
+    }
+    count_node(st);
+    depth += in_check;
+    int found = 0;
+    struct chess_game child;
+    for(int i = 0; i < count; i++)
+    {
+        pick_move(moves, scores, i, count);
+        struct move *mv = &moves[i];
+        if(!make_legal_move(game, mv, &child, in_check))
+        {
+            continue;
+        }
+        int score;
+        if(found < no_of_lines)
+        {
+            score = -search(st, &child, depth - 1, -INFINITE_SCORE, INFINITE_SCORE, 1, 1);
+        }
+        else
+        {
+            int bound = st->lines[no_of_lines - 1].score;
+            score = -search(st, &child, depth - 1, -bound - 1, -bound, 1, 1);
+            if(score > bound)
+            {
+                score = -search(st, &child, depth - 1, -INFINITE_SCORE, -bound, 1, 1);
+            }
+        }
+        if(__atomic_load_n(&st->shared->stop, __ATOMIC_RELAXED))
+        {
+            return found;
+        }
+        if(found < no_of_lines || score > st->lines[no_of_lines - 1].score)
+        {
+            insert_root_line(st, &found, no_of_lines, mv, score);
+        }
+    }
+    if(found > 0)
+    {
+        struct move *best = &st->lines[0].pv[0];
+        store_tt(st->shared->table, game->hash, pack_move(best), score_to_tt(st->lines[0].score, 0), depth, BOUND_EXACT);
+        if(!is_capture(best))
+        {
+            st->history_scores[best->src][best->dest] += depth * depth;
+        }
+    }
+    return found;
+}
+
+void print_search_info(struct search_thread *st, int depth)
+{
+    struct search_shared *shared = st->shared;
+    double elapsed = now_seconds() - shared->start;
+    long long nodes = total_search_nodes(shared);
+    char line[MAX_PLY * 6 + 200], text[6];
+    for(int k = 0; k < st->no_of_best_lines; k++)
+    {
+        struct root_line *best = &st->best_lines[k];
+        int length = sprintf(line, "info depth %d", depth);
+        if(shared->multi_pv > 1)
+        {
+            length += sprintf(line + length, " multipv %d", k + 1);
+        }
+        if(best->score > MATE_BOUND || best->score < -MATE_BOUND)
+        {
+            int moves = best->score > 0 ? (MATE_SCORE - best->score + 1) / 2 : -(MATE_SCORE + best->score) / 2;
+            length += sprintf(line + length, " score mate %d", moves);
+        }
+        else
+        {
+            length += sprintf(line + length, " score cp %d", best->score);
+        }
+        length += sprintf(line + length, " nodes %lld nps %.0f time %.0f hashfull %d pv", nodes, nodes / (elapsed > 0 ? elapsed : 1e-9),
+            elapsed * 1000, tt_hashfull(shared->table));
+        for(int i = 0; i < best->pv_length; i++)
+        {
+            move_to_string(&best->pv[i], text);
+            length += sprintf(line + length, " %s", text);
+        }
+        printf("%s\n", line);
+    }
+    fflush(stdout);
+}
+
+void* search_worker(void *arg)
+{
+    struct search_thread *st = (struct search_thread*)arg;
+    struct search_shared *shared = st->shared;
+    pin_thread_to_node(st->id);
+    int max_depth = shared->limits.depth > 0 && shared->limits.depth < MAX_PLY - 1 ? shared->limits.depth : MAX_PLY - 2;
+    int no_of_lines = count_legal_moves(&st->root);
+    no_of_lines = shared->multi_pv < no_of_lines ? shared->multi_pv : no_of_lines;
+    no_of_lines = no_of_lines < 1 ? 1 : no_of_lines > MAX_MULTI_PV ? MAX_MULTI_PV : no_of_lines;
+    for(int depth = 1 + (st->id & 1); depth <= max_depth; depth++)
+    {
+        int found;
+        if(no_of_lines > 1)
+        {
+            found = search_root_lines(st, depth, no_of_lines);
+        }
+        else
+        {
+            st->lines[0].score = search(st, &st->root, depth, -INFINITE_SCORE, INFINITE_SCORE, 0, 0);
+            st->lines[0].pv_length = st->pv_length[0];
+            memcpy(st->lines[0].pv, st->pv[0], sizeof(struct move) * st->pv_length[0]);
+            found = st->pv_length[0] > 0;
+        }
+        if(__atomic_load_n(&shared->stop, __ATOMIC_RELAXED) && st->completed_depth > 0)
+        {
+            break;
+        }
+        if(found > 0)
+        {
+            memcpy(st->best_lines, st->lines, sizeof(struct root_line) * found);
+            st->no_of_best_lines = found;
+            st->completed_depth = depth;
+        }
+        if(st->id != 0)
+        {
+            continue;
+        }
+        if(shared->verbose)
+        {
+            print_search_info(st, depth);
+        }
+        if(shared->on_iteration != NULL)
+        {
+            shared->on_iteration(st, depth);
+        }
+        int pondering = __atomic_load_n(&shared->pondering, __ATOMIC_ACQUIRE);
+        if(!pondering && shared->soft_time > 0 && now_seconds() - shared->start >= shared->soft_time)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+//a share of the remaining time, the search stops after an iteration past the soft limit and
+//anywhere past the hard one
+void set_search_time(struct search_shared *shared)
+{
+    struct search_limits *limits = &shared->limits;
+    int us = color_index(shared->root.turn);
+    shared->soft_time = shared->hard_time = 0;
+    if(limits->movetime > 0)
+    {
+        shared->soft_time = shared->hard_time = limits->movetime / 1000.0;
+    }
+    else if(limits->time[us] > 0)
+    {
+        double remaining = limits->time[us] / 1000.0, increment = limits->increment[us] / 1000.0;
+        double budget = remaining / (limits->movestogo > 0 ? limits->movestogo : 30) + increment * 0.75;
+        double most = remaining - 0.05 > 0.001 ? remaining - 0.05 : 0.001;
+        shared->soft_time = budget < most ? budget : most;
+        shared->hard_time = budget * 4 < most ? budget * 4 : most;
+    }
+}
+
+//runs every thread of a search and returns the deepest completed result in bestmove
+struct search_thread* run_search(struct search_shared *shared)
+{
+    pthread_t threads[256];
+    int started = 0;
+    for(int i = 1; i < shared->no_of_threads; i++)
+    {
+        if(pthread_create(&threads[started], NULL, search_worker, &shared->threads[i]) == 0)
+        {
+            started++;
+        }
+    }
+    search_worker(&shared->threads[0]);
+
+    //infinite and ponder searches report only once they are stopped or the ponder move is played
+    struct timespec pause = {0, 100000};
+    while(!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED) &&
+        (shared->limits.infinite || __atomic_load_n(&shared->pondering, __ATOMIC_ACQUIRE)))
+    {
+        nanosleep(&pause, NULL);
+    }
+    __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct search_thread *best = &shared->threads[0];
+    for(int i = 1; i < shared->no_of_threads; i++)
+    {
+        struct search_thread *st = &shared->threads[i];
+        if(st->completed_depth > best->completed_depth && st->no_of_best_lines > 0)
+        {
+            best = st;
+        }
+    }
+    return best;
+}
+
+//resets the per search state of every thread from shared->root and shared->history
+int prepare_search(struct search_shared *shared, struct search_thread *threads, int no_of_threads)
+{
+    shared->threads = threads;
+    shared->no_of_threads = no_of_threads;
+    shared->stop = 0;
+    shared->pondering = shared->limits.ponder;
+    shared->start = now_seconds();
+    shared->table->generation = (shared->table->generation + 1) & 63;
+    set_search_time(shared);
+    for(int i = 0; i < no_of_threads; i++)
+    {
+        struct search_thread *st = &threads[i];
+        st->shared = shared;
+        st->id = i;
+        st->history = shared->history;
+        st->root = shared->root;
+        st->root.history = &st->history;
+        st->nodes = 0;
+        st->no_of_best_lines = 0;
+        st->completed_depth = 0;
+        memset(st->killers, 0, sizeof(st->killers));
+        memset(st->history_scores, 0, sizeof(st->history_scores));
+        if(st->pawns.entries == NULL && !init_pawn_table(&st->pawns, 1 << 14))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Cooperative analysis tasks: a shallow alpha-beta search that keeps its recursion in an explicit
+//stack of frames, so it can stop after any node and carry on later. Every core runs a scheduler
+//thread with a heap of tasks, most urgent first (priority, then deadline), and gives the first a
+//slice of nodes at a time. New tasks are picked up between slices, so thousands of analyses share
+//a few threads and an urgent one waits at most a slice. A task past its deadline finishes with
+//its last completed iteration.
+#define TASK_MAX_PLY 64
+#define TASK_SWEEP_SECONDS 0.001
+
+struct task_frame
+{
+    struct chess_game game;
+    uint16_t moves[MAX_MOVES];
+    int no_of_moves;
+    int index;
+    int legal;
+    int in_check;
+    int depth;
+    int alpha;
+    int beta;
+    int original_alpha;
+    int best;
+    int best_move;
+};
+
+//frames are allocated on the first slice and freed when the task finishes
+struct analysis_task
+{
+    int id;
+    int priority;
+    int max_depth;
+    double arrival;
+    double deadline;
+    double finished;
+    struct chess_game root;
+    struct key_history history;
+    struct task_frame *frames;
+    int capacity;
+    int top;
+    int entering;
+    int depth;
+    long long nodes;
+    int best_move;
+    int score;
+    int completed_depth;
+    int done;
+};
+
+struct task_core
+{
+    struct task_scheduler *scheduler;
+    pthread_t thread;
+    struct analysis_task **heap;
+    int size;
+    int capacity;
+    struct pawn_table pawns;
+    double next_sweep;
+    long long nodes;
+    long long slices;
+};
+
+struct task_scheduler
+{
+    struct transposition_table *table;
+    struct eval_params *params;
+    struct analysis_task **inbox;
+    int inbox_size;
+    int inbox_capacity;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int closed;
+    int slice_nodes;
+    struct task_core *cores;
+    int no_of_cores;
+    void (*complete)(void *context, struct analysis_task *task);
+    void *context;
+};
+
+void init_analysis_task(struct analysis_task *task, struct chess_game *game, int max_depth, int priority, double deadline)
+{
+    memset(task, 0, sizeof(struct analysis_task));
+    task->priority = priority;
+    task->max_depth = max_depth < 1 ? 1 : max_depth > TASK_MAX_PLY / 2 ? TASK_MAX_PLY / 2 : max_depth;
+    task->arrival = now_seconds();
+    task->deadline = deadline;
+    task->root = *game;
+    attach_key_history(&task->root, &task->history);
+}
+
+//pseudo legal moves sorted for search: table move, captures by most valuable victim then least
+//valuable attacker, queen promotions, the rest. Quiescence frames keep only the tactical moves.
+int generate_task_moves(struct task_frame *frame, struct eval_params *params, int tt_move, int tactical_only)
+{
+    struct queue *q = generate_moves(&frame->game);
+    if(q == NULL)
+    {
+        return 0;
+    }
+    int scores[MAX_MOVES];
+    int count = 0;
+    struct move *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        if(count < MAX_MOVES && (!tactical_only || is_capture(mv) || mv->type == QUEEN_PROMOTION))
+        {
+            int packed = pack_move(mv), score = 0;
+            if(packed == tt_move)
+            {
+                score = 4000000;
+            }
+            else if(is_capture(mv))
+            {
+                int victim = mv->type == ENPASSANT_CAPTURE ? PAWN : piece_type(frame->game.board[mv->dest]);
+                score = 2000000 + params->piece_value[victim] * 10 + piece_type(frame->game.board[mv->src]);
+            }
+            else if(mv->type == QUEEN_PROMOTION)
+            {
+                score = 1900000;
+            }
+            int i = count++;
+            while(i > 0 && scores[i - 1] < score)
+            {
+                scores[i] = scores[i - 1];
+                frame->moves[i] = frame->moves[i - 1];
+                i--;
+            }
+            scores[i] = score;
+            frame->moves[i] = (uint16_t)packed;
+        }
+        free(mv);
+    }
+    free(q);
+    return count;
+}
+
+//visits the node on top of the stack, returns 1 with its value when it needs no moves searched
+int enter_task_frame(struct task_core *core, struct analysis_task *task, int *value)
+{
+    struct task_scheduler *scheduler = core->scheduler;
+    struct task_frame *frame = &task->frames[task->top];
+    struct chess_game *game = &frame->game;
+    int ply = task->top;
+    task->nodes++;
+    if(ply > 0 && is_draw(game))
+    {
+        *value = 0;
+        return 1;
+    }
+    if(ply >= TASK_MAX_PLY - 1)
+    {
+        *value = evaluate(game, scheduler->params, &core->pawns);
+        return 1;
+    }
+    frame->in_check = is_in_check(game, game->turn);
+    frame->depth += frame->in_check;
+    frame->original_alpha = frame->alpha;
+    frame->best = -INFINITE_SCORE;
+    frame->best_move = 0;
+    frame->legal = 0;
+    frame->index = 0;
+
+    int tt_move = 0;
+    if(frame->depth > 0)
+    {
+        int tt_score, tt_depth, tt_bound;
+        if(probe_tt(scheduler->table, game->hash, &tt_move, &tt_score, &tt_depth, &tt_bound) && ply > 0 && tt_depth >= frame->depth)
+        {
+            tt_score = score_from_tt(tt_score, ply);
+            if(tt_bound == BOUND_EXACT || (tt_bound == BOUND_LOWER && tt_score >= frame->beta) || (tt_bound == BOUND_UPPER && tt_score <= frame->alpha))
+            {
+                *value = tt_score;
+                return 1;
+            }
+        }
+    }
+    else if(!frame->in_check)
+    {
+        frame->best = evaluate(game, scheduler->params, &core->pawns);
+        if(frame->best >= frame->beta)
+        {
+            *value = frame->best;
+            return 1;
+        }
+        frame->alpha = frame->best > frame->alpha ? frame->best : frame->alpha;
+    }
+    frame->no_of_moves = generate_task_moves(frame, scheduler->params, tt_move, frame->depth <= 0 && !frame->in_check);
+    return 0;
+}
+
+//pushes the position after the frame's next legal move, returns 0 when the moves have run out
+int push_task_child(struct analysis_task *task)
+{
+    if(task->top + 1 >= task->capacity)
+    {
+        int capacity = task->capacity * 2;
+        struct task_frame *frames = (struct task_frame*)realloc(task->frames, sizeof(struct task_frame) * capacity);
+        if(frames == NULL)
+        {
+            return 0;
+        }
+        task->frames = frames;
+        task->capacity = capacity;
+    }
+    struct task_frame *frame = &task->frames[task->top];
+    struct task_frame *child = frame + 1;
+    struct move mv;
+    while(frame->index < frame->no_of_moves)
+    {
+        unpack_move(frame->moves[frame->index++], &mv);
+        if(make_legal_move(&frame->game, &mv, &child->game, frame->in_check))
+        {
+            frame->legal++;
+            child->depth = frame->depth - 1;
+            child->alpha = -frame->beta;
+            child->beta = -frame->alpha;
+            task->top++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//value of a frame whose moves are done, full width results go to the transposition table
+int finish_task_frame(struct task_core *core, struct analysis_task *task)
+{
+    struct task_frame *frame = &task->frames[task->top];
+    int ply = task->top;
+    if(frame->legal == 0 && (frame->in_check || frame->depth > 0))
+    {
+        return frame->in_check ? -MATE_SCORE + ply : 0;
+    }
+    if(frame->depth > 0)
+    {
+        int bound = frame->best >= frame->beta ? BOUND_LOWER : frame->best > frame->original_alpha ? BOUND_EXACT : BOUND_UPPER;
+        store_tt(core->scheduler->table, frame->game.hash, frame->best_move, score_to_tt(frame->best, ply), frame->depth, bound);
+    }
+    return frame->best;
+}
+
+void start_task_iteration(struct analysis_task *task)
+{
+    task->top = 0;
+    task->entering = 1;
+    task->frames[0].depth = task->depth;
+    task->frames[0].alpha = -INFINITE_SCORE;
+    task->frames[0].beta = INFINITE_SCORE;
+}
+
+//the task's answer once it stops: the last completed iteration, else what the root has found so
+//far, else its first legal move
+void finish_analysis_task(struct analysis_task *task)
+{
+    if(task->completed_depth == 0 && task->frames != NULL && task->frames[0].best_move != 0)
+    {
+        task->best_move = task->frames[0].best_move;
+        task->score = task->frames[0].best;
+    }
+    if(task->best_move == 0)
+    {
+        struct queue *q = generate_legal_moves(&task->root);
+        struct move *mv = q == NULL ? NULL : dequeue(q);
+        task->best_move = mv == NULL ? 0 : pack_move(mv);
+        free(mv);
+        if(q != NULL)
+        {
+            free_queue(q);
+        }
+    }
+    free(task->frames);
+    task->frames = NULL;
+    task->done = 1;
+    task->finished = now_seconds();
+}
+
+//runs the task for about budget nodes, returns 1 once every iteration is done
+int run_task_slice(struct task_core *core, struct analysis_task *task, int budget)
+{
+    if(task->frames == NULL)
+    {
+        task->capacity = 8;
+        task->frames = (struct task_frame*)malloc(sizeof(struct task_frame) * task->capacity);
+        if(task->frames == NULL)
+        {
+            return 1;
+        }
+        task->frames[0].game = task->root;
+        task->depth = 1;
+        start_task_iteration(task);
+    }
+    long long stop = task->nodes + budget;
+    while(task->nodes < stop)
+    {
+        int value;
+        if(task->entering)
+        {
+            task->entering = 0;
+            if(!enter_task_frame(core, task, &value))
+            {
+                continue;
+            }
+        }
+        else if(push_task_child(task))
+        {
+            task->entering = 1;
+            continue;
+        }
+        else
+        {
+            value = finish_task_frame(core, task);
+        }
+
+        //the top frame has its value, it is handed up until a frame has moves left to try
+        int root_done = task->top == 0;
+        while(task->top > 0)
+        {
+            task->top--;
+            struct task_frame *parent = &task->frames[task->top];
+            if(-value > parent->best)
+            {
+                parent->best = -value;
+                parent->best_move = parent->moves[parent->index - 1];
+                parent->alpha = -value > parent->alpha ? -value : parent->alpha;
+            }
+            if(parent->alpha < parent->beta)
+            {
+                break;
+            }
+            value = finish_task_frame(core, task);
+            root_done = task->top == 0;
+        }
+        if(!root_done)
+        {
+            continue;
+        }
+
+        task->best_move = task->frames[0].best_move;
+        task->score = value;
+        task->completed_depth = task->depth;
+        if(task->depth >= task->max_depth || task->frames[0].legal == 0)
+        {
+            return 1;
+        }
+        task->depth++;
+        start_task_iteration(task);
+    }
+    return 0;
+}
+
+//most urgent first: the higher priority, then the earlier deadline
+int task_before(struct analysis_task *a, struct analysis_task *b)
+{
+    return a->priority != b->priority ? a->priority > b->priority : a->deadline < b->deadline;
+}
+
+int push_core_task(struct task_core *core, struct analysis_task *task)
+{
+    if(core->size == core->capacity)
+    {
+        int capacity = core->capacity == 0 ? 64 : core->capacity * 2;
+        struct analysis_task **heap = (struct analysis_task**)realloc(core->heap, sizeof(struct analysis_task*) * capacity);
+        if(heap == NULL)
+        {
+            return 0;
+        }
+        core->heap = heap;
+        core->capacity = capacity;
+    }
+    int i = core->size++;
+    while(i > 0 && task_before(task, core->heap[(i - 1) / 2]))
+    {
+        core->heap[i] = core->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    core->heap[i] = task;
+    return 1;
+}
+
+void pop_core_task(struct task_core *core)
+{
+    struct analysis_task *last = core->heap[--core->size];
+    int i = 0;
+    while(2 * i + 1 < core->size)
+    {
+        int child = 2 * i + 1;
+        if(child + 1 < core->size && task_before(core->heap[child + 1], core->heap[child]))
+        {
+            child++;
+        }
+        if(!task_before(core->heap[child], last))
+        {
+            break;
+        }
+        core->heap[i] = core->heap[child];
+        i = child;
+    }
+    core->heap[i] = last;
+}
+
+void complete_analysis_task(struct task_scheduler *scheduler, struct analysis_task *task)
+{
+    finish_analysis_task(task);
+    scheduler->complete(scheduler->context, task);
+}
+
+//answers every task that is out of time wherever it is in the heap, then rebuilds the heap
+void reap_expired_tasks(struct task_core *core, double now)
+{
+    int kept = 0;
+    for(int i = 0; i < core->size; i++)
+    {
+        if(now >= core->heap[i]->deadline)
+        {
+            complete_analysis_task(core->scheduler, core->heap[i]);
+        }
+        else
+        {
+            core->heap[kept++] = core->heap[i];
+        }
+    }
+    core->size = 0;
+    for(int i = 0; i < kept; i++)
+    {
+        push_core_task(core, core->heap[i]);
+    }
+}
+
+//takes a share of the new tasks between slices, the first of the heap keeps running until it
+//finishes or a more urgent task arrives
+void* task_core_loop(void *arg)
+{
+    struct task_core *core = (struct task_core*)arg;
+    struct task_scheduler *scheduler = core->scheduler;
+    while(1)
+    {
+        if(core->size == 0 || __atomic_load_n(&scheduler->inbox_size, __ATOMIC_RELAXED) > 0)
+        {
+            pthread_mutex_lock(&scheduler->lock);
+            while(core->size == 0 && scheduler->inbox_size == 0 && !scheduler->closed)
+            {
+                pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+            }
+            int share = scheduler->inbox_size / scheduler->no_of_cores + 1;
+            for(int i = 0; i < share && i < scheduler->inbox_size; i++)
+            {
+                struct analysis_task *task = scheduler->inbox[i];
+                if(!push_core_task(core, task))
+                {
+                    complete_analysis_task(scheduler, task);
+                }
+            }
+            share = share < scheduler->inbox_size ? share : scheduler->inbox_size;
+            memmove(scheduler->inbox, scheduler->inbox + share, sizeof(struct analysis_task*) * (scheduler->inbox_size - share));
+            __atomic_store_n(&scheduler->inbox_size, scheduler->inbox_size - share, __ATOMIC_RELAXED);
+            int finished = core->size == 0 && scheduler->closed;
+            pthread_mutex_unlock(&scheduler->lock);
+            if(finished)
+            {
+                break;
+            }
+            if(core->size == 0)
+            {
+                continue;
+            }
+        }
+
+        //tasks out of time are answered without running them, so an overloaded core sheds work
+        //instead of making every task late
+        double now = now_seconds();
+        if(now >= core->next_sweep)
+        {
+            reap_expired_tasks(core, now);
+            core->next_sweep = now + TASK_SWEEP_SECONDS;
+            if(core->size == 0)
+            {
+                continue;
+            }
+        }
+        struct analysis_task *task = core->heap[0];
+        long long nodes = task->nodes;
+        int done = run_task_slice(core, task, scheduler->slice_nodes);
+        core->nodes += task->nodes - nodes;
+        core->slices++;
+        if(done || now_seconds() >= task->deadline)
+        {
+            pop_core_task(core);
+            complete_analysis_task(scheduler, task);
+        }
+    }
+    return NULL;
+}
+
+//complete is called from the core that finished a task
+int start_task_scheduler(struct task_scheduler *scheduler, struct transposition_table *table, struct eval_params *params, int no_of_cores,
+    int slice_nodes, void (*complete)(void*, struct analysis_task*), void *context)
+{
+    memset(scheduler, 0, sizeof(struct task_scheduler));
+    scheduler->table = table;
+    scheduler->params = params;
+    scheduler->slice_nodes = slice_nodes < 1 ? 1 : slice_nodes;
+    scheduler->complete = complete;
+    scheduler->context = context;
+    scheduler->cores = (struct task_core*)calloc(no_of_cores, sizeof(struct task_core));
+    if(scheduler->cores == NULL)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->wake, NULL);
+    for(int i = 0; i < no_of_cores; i++)
+    {
+        struct task_core *core = &scheduler->cores[scheduler->no_of_cores];
+        core->scheduler = scheduler;
+        if(!init_pawn_table(&core->pawns, 1 << 14) || pthread_create(&core->thread, NULL, task_core_loop, core) != 0)
+        {
+            break;
+        }
+        scheduler->no_of_cores++;
+    }
+    if(scheduler->no_of_cores == 0)
+    {
+        printf("cannot start threads\n");
+        return 0;
+    }
+    return 1;
+}
+
+int submit_analysis_task(struct task_scheduler *scheduler, struct analysis_task *task)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    if(scheduler->inbox_size == scheduler->inbox_capacity)
+    {
+        int capacity = scheduler->inbox_capacity == 0 ? 1024 : scheduler->inbox_capacity * 2;
+        struct analysis_task **inbox = (struct analysis_task**)realloc(scheduler->inbox, sizeof(struct analysis_task*) * capacity);
+        if(inbox == NULL)
+        {
+            pthread_mutex_unlock(&scheduler->lock);
+            return 0;
+        }
+        scheduler->inbox = inbox;
+        scheduler->inbox_capacity = capacity;
+    }
+    scheduler->inbox[scheduler->inbox_size] = task;
+    __atomic_store_n(&scheduler->inbox_size, scheduler->inbox_size + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->lock);
+    return 1;
+}
+
+//waits for every submitted task to finish
+void stop_task_scheduler(struct task_scheduler *scheduler)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->closed = 1;
+    pthread_cond_broadcast(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->lock);
+    for(int i = 0; i < scheduler->no_of_cores; i++)
+    {
+        pthread_join(scheduler->cores[i].thread, NULL);
+        free(scheduler->cores[i].heap);
+        free_pawn_table(&scheduler->cores[i].pawns);
+    }
+    pthread_mutex_destroy(&scheduler->lock);
+    pthread_cond_destroy(&scheduler->wake);
+    free(scheduler->inbox);
+    free(scheduler->cores);
+}
+
+//Monte Carlo tree search: PUCT selection over a tree whose nodes live in an arena. Every thread
+//walks the same tree (tree parallelism) and marks its path with a virtual loss so the others
+//spread out. Leaves are scored by the static evaluation or by a short random playout. A node's
+//value is the sum of the results for the side that moved into it, in thousandths.
+#define MCTS_PLAYOUT_PLIES 24
+#define MCTS_DEFAULT_PLAYOUTS 100000
+
+const int MCTS_NEW = 0, MCTS_EXPANDING = 1, MCTS_EXPANDED = 2, MCTS_WIN = 3, MCTS_DRAW = 4;
+const int MCTS_LEAF_EVAL = 0, MCTS_LEAF_PLAYOUT = 1;
+const int MCTS_VIRTUAL_LOSS = 1000;
+
+struct mcts_node
+{
+    int64_t value;
+    uint32_t first_child;
+    int visits;
+    float prior;
+    uint16_t move;
+    uint8_t no_of_children;
+    uint8_t state;
+};
+
+//nodes are handed out by bumping used. Keeping a subtree copies it to the other arena and
+//empties this one, so the memory is allocated once and recycled for every move of a game.
+struct mcts_arena
+{
+    struct mcts_node *nodes;
+    uint32_t capacity;
+    uint32_t used;
+};
+
+struct mcts_tree
+{
+    struct mcts_arena arenas[2];
+    int current;
+    struct chess_game root;
+    int has_root;
+    float exploration;
+    int leaf_mode;
+    int full;
+    uint32_t reused;
+    long long playouts;
+};
+
+struct mcts_worker
+{
+    struct mcts_tree *tree;
+    struct search_shared *shared;
+    int id;
+    struct key_history history;
+    struct pawn_table pawns;
+    uint64_t seed;
+    long long playouts;
+    double seconds;
+};
+
+int init_mcts_tree(struct mcts_tree *tree, int megabytes)
+{
+    uint64_t capacity = ((uint64_t)megabytes << 20) / 2 / sizeof(struct mcts_node);
+    capacity = capacity < 1024 ? 1024 : capacity > 0x7FFFFFFF ? 0x7FFFFFFF : capacity;
+    memset(tree, 0, sizeof(struct mcts_tree));
+    for(int i = 0; i < 2; i++)
+    {
+        tree->arenas[i].nodes = (struct mcts_node*)malloc(capacity * sizeof(struct mcts_node));
+        tree->arenas[i].capacity = capacity;
+        if(tree->arenas[i].nodes == NULL)
+        {
+            printf("memory not allocated\n");
+            free(tree->arenas[0].nodes);
+            return 0;
+        }
+    }
+    tree->exploration = 1.5;
+    tree->leaf_mode = MCTS_LEAF_EVAL;
+    return 1;
+}
+
+void free_mcts_tree(struct mcts_tree *tree)
+{
+    free(tree->arenas[0].nodes);
+    free(tree->arenas[1].nodes);
+    tree->arenas[0].nodes = tree->arenas[1].nodes = NULL;
+}
+
+struct mcts_node* mcts_nodes(struct mcts_tree *tree)
+{
+    return tree->arenas[tree->current].nodes;
+}
+
+uint32_t mcts_tree_size(struct mcts_tree *tree)
+{
+    struct mcts_arena *arena = &tree->arenas[tree->current];
+    return arena->used < arena->capacity ? arena->used : arena->capacity;
+}
+
+void reset_mcts_tree(struct mcts_tree *tree, struct chess_game *game)
+{
+    struct mcts_arena *arena = &tree->arenas[tree->current];
+    memset(&arena->nodes[0], 0, sizeof(struct mcts_node));
+    arena->used = 1;
+    tree->root = *game;
+    tree->has_root = 1;
+    tree->full = 0;
+    tree->reused = 0;
+}
+
+//node index of game among the root and the two plies below it, -1 when it is not there
+int64_t find_mcts_subtree(struct mcts_tree *tree, struct chess_game *game)
+{
+    struct mcts_node *nodes = mcts_nodes(tree);
+    if(!tree->has_root || tree->root.hash == game->hash)
+    {
+        return tree->has_root ? 0 : -1;
+    }
+    struct chess_game child, grandchild;
+    struct move mv;
+    struct mcts_node *root = &nodes[0];
+    for(int i = 0; root->state == MCTS_EXPANDED && i < root->no_of_children; i++)
+    {
+        struct mcts_node *node = &nodes[root->first_child + i];
+        child = tree->root;
+        unpack_move(node->move, &mv);
+        make_move(&child, &mv);
+        if(child.hash == game->hash)
+        {
+            return root->first_child + i;
+        }
+        for(int j = 0; node->state == MCTS_EXPANDED && j < node->no_of_children; j++)
+        {
+            grandchild = child;
+            unpack_move(nodes[node->first_child + j].move, &mv);
+            make_move(&grandchild, &mv);
+            if(grandchild.hash == game->hash)
+            {
+                return node->first_child + j;
+            }
+        }
+    }
+    return -1;
+}
+
+//copies the subtree under index to the other arena breadth first, each node's children stay
+//contiguous, and makes it the tree
+void keep_mcts_subtree(struct mcts_tree *tree, uint32_t index)
+{
+    struct mcts_node *source = mcts_nodes(tree);
+    struct mcts_arena *target = &tree->arenas[tree->current ^ 1];
+    target->nodes[0] = source[index];
+    target->used = 1;
+    for(uint32_t i = 0; i < target->used; i++)
+    {
+        struct mcts_node *node = &target->nodes[i];
+        if(node->state != MCTS_EXPANDED)
+        {
+            continue;
+        }
+        memcpy(&target->nodes[target->used], &source[node->first_child], sizeof(struct mcts_node) * node->no_of_children);
+        node->first_child = target->used;
+        target->used += node->no_of_children;
+    }
+    tree->arenas[tree->current].used = 0;
+    tree->current ^= 1;
+}
+
+//makes game the root, keeping what was searched below it when it follows the last root
+void set_mcts_root(struct mcts_tree *tree, struct chess_game *game)
+{
+    int64_t index = find_mcts_subtree(tree, game);
+    if(index < 0)
+    {
+        reset_mcts_tree(tree, game);
+        return;
+    }
+    if(index > 0)
+    {
+        keep_mcts_subtree(tree, index);
+    }
+    tree->root = *game;
+    tree->full = 0;
+    tree->reused = tree->arenas[tree->current].used;
+}
+
+//prior weight of a move: captures by material gained, queen promotions and checks first
+float mcts_move_weight(struct chess_game *game, struct chess_game *child, struct move *mv, struct eval_params *params)
+{
+    float weight = 1;
+    if(is_capture(mv))
+    {
+        int victim = mv->type == ENPASSANT_CAPTURE ? PAWN : piece_type(game->board[mv->dest]);
+        int gain = params->piece_value[victim] - params->piece_value[piece_type(game->board[mv->src])] / 10;
+        weight += gain > 0 ? gain / 100.0f : 0;
+    }
+    if(mv->type == QUEEN_PROMOTION || mv->type == QUEEN_PROMO_CAPTURE)
+    {
+        weight += 8;
+    }
+    if(is_in_check(child, child->turn))
+    {
+        weight += 1;
+    }
+    return weight;
+}
+
+//gives the node its children, or marks it mate or stalemate. Returns the new state, MCTS_NEW
+//when the arena is full
+int expand_mcts_node(struct mcts_worker *worker, struct mcts_node *node, struct chess_game *game)
+{
+    struct mcts_tree *tree = worker->tree;
+    struct mcts_arena *arena = &tree->arenas[tree->current];
+    struct queue *q = generate_moves(game);
+    struct move moves[MAX_MOVES];
+    float weights[MAX_MOVES], total = 0;
+    int count = 0;
+    int in_check = is_in_check(game, game->turn);
+    struct chess_game child;
+    struct move *mv;
+    while(q != NULL && (mv = dequeue(q)) != NULL)
+    {
+        if(count < 255 && make_legal_move(game, mv, &child, in_check))
+        {
+            moves[count] = *mv;
+            weights[count] = mcts_move_weight(game, &child, mv, worker->shared->params);
+            total += weights[count++];
+        }
+        free(mv);
+    }
+    free(q);
+
+    int state = in_check ? MCTS_WIN : MCTS_DRAW;
+    uint32_t first = 0;
+    if(count > 0)
+    {
+        state = MCTS_NEW;
+        if(__atomic_load_n(&arena->used, __ATOMIC_RELAXED) + count <= arena->capacity)
+        {
+            first = __atomic_fetch_add(&arena->used, count, __ATOMIC_RELAXED);
+            state = first + count <= arena->capacity ? MCTS_EXPANDED : MCTS_NEW;
+        }
+        tree->full |= state == MCTS_NEW;
+    }
+    for(int i = 0; state == MCTS_EXPANDED && i < count; i++)
+    {
+        struct mcts_node *new_node = &arena->nodes[first + i];
+        memset(new_node, 0, sizeof(struct mcts_node));
+        new_node->prior = weights[i] / total;
+        new_node->move = pack_move(&moves[i]);
+    }
+    node->first_child = first;
+    node->no_of_children = state == MCTS_EXPANDED ? count : 0;
+    __atomic_store_n(&node->state, state, __ATOMIC_RELEASE);
+    return state;
+}
+
+float square_root(float x)
+{
+    if(x <= 0)
+    {
+        return 0;
+    }
+    union { float f; uint32_t i; } guess = {x};
+    guess.i = (guess.i >> 1) + 0x1FC00000;
+    for(int i = 0; i < 3; i++)
+    {
+        guess.f = 0.5f * (guess.f + x / guess.f);
+    }
+    return guess.f;
+}
+
+//child with the best value plus exploration bonus, unvisited children count as a draw
+uint32_t select_mcts_child(struct mcts_tree *tree, struct mcts_node *node)
+{
+    struct mcts_node *children = &mcts_nodes(tree)[node->first_child];
+    float bonus = tree->exploration * square_root(__atomic_load_n(&node->visits, __ATOMIC_RELAXED));
+    float best_score = -1e30f;
+    int best = 0;
+    for(int i = 0; i < node->no_of_children; i++)
+    {
+        int visits = __atomic_load_n(&children[i].visits, __ATOMIC_RELAXED);
+        int64_t value = __atomic_load_n(&children[i].value, __ATOMIC_RELAXED);
+        float score = (visits > 0 ? value / (1000.0f * visits) : 0) + bonus * children[i].prior / (1 + visits);
+        if(score > best_score)
+        {
+            best_score = score;
+            best = i;
+        }
+    }
+    return node->first_child + best;
+}
+
+//the evaluation squashed into (-1, 1) for the side to move
+float mcts_static_value(struct mcts_worker *worker, struct chess_game *game)
+{
+    int score = evaluate(game, worker->shared->params, &worker->pawns);
+    return score / (float)((score < 0 ? -score : score) + 400);
+}
+
+//plays random legal moves, mate and stalemate end it and the evaluation scores where it stops
+float mcts_random_playout(struct mcts_worker *worker, struct chess_game *game)
+{
+    struct chess_game current = *game, child;
+    struct move moves[MAX_MOVES];
+    float sign = 1;
+    current.history = NULL;
+    for(int ply = 0; ply < MCTS_PLAYOUT_PLIES; ply++)
+    {
+        struct queue *q = generate_moves(&current);
+        int count = 0;
+        struct move *mv;
+        while(q != NULL && (mv = dequeue(q)) != NULL)
+        {
+            if(count < MAX_MOVES)
+            {
+                moves[count++] = *mv;
+            }
+            free(mv);
+        }
+        free(q);
+        int in_check = is_in_check(&current, current.turn);
+        int start = count > 0 ? random_u64(&worker->seed) % count : 0;
+        int played = 0;
+        for(int i = 0; i < count && !played; i++)
+        {
+            played = make_legal_move(&current, &moves[(start + i) % count], &child, in_check);
+        }
+        if(!played)
+        {
+            return in_check ? -sign : 0;
+        }
+        current = child;
+        sign = -sign;
+        if(current.half_moves >= 100)
+        {
+            return 0;
+        }
+    }
+    return sign * mcts_static_value(worker, &current);
+}
+
+//one descent from the root: select down to a leaf, expand it, score it and back the result up
+void run_mcts_playout(struct mcts_worker *worker)
+{
+    struct mcts_tree *tree = worker->tree;
+    struct mcts_node *nodes = mcts_nodes(tree);
+    struct chess_game game = worker->shared->root;
+    uint32_t path[MAX_PLY];
+    struct move mv;
+    int length = 0;
+    float value;
+    game.history = &worker->history;
+    uint32_t index = 0;
+    while(1)
+    {
+        struct mcts_node *node = &nodes[index];
+        __atomic_add_fetch(&node->visits, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&node->value, -MCTS_VIRTUAL_LOSS, __ATOMIC_RELAXED);
+        path[length++] = index;
+        int state = __atomic_load_n(&node->state, __ATOMIC_ACQUIRE);
+        if(state == MCTS_WIN || state == MCTS_DRAW)
+        {
+            value = state == MCTS_WIN ? -1 : 0;
+            break;
+        }
+        if(length > 1 && is_draw(&game))
+        {
+            value = 0;
+            break;
+        }
+        uint8_t expected = MCTS_NEW;
+        if(state == MCTS_NEW && __atomic_compare_exchange_n(&node->state, &expected, MCTS_EXPANDING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            state = expand_mcts_node(worker, node, &game);
+            if(state == MCTS_WIN || state == MCTS_DRAW)
+            {
+                value = state == MCTS_WIN ? -1 : 0;
+                break;
+            }
+            state = MCTS_NEW;
+        }
+        //a new leaf, one another thread is expanding or one the full arena could not take
+        if(state != MCTS_EXPANDED || length == MAX_PLY)
+        {
+            value = tree->leaf_mode == MCTS_LEAF_PLAYOUT ? mcts_random_playout(worker, &game) : mcts_static_value(worker, &game);
+            break;
+        }
+        index = select_mcts_child(tree, node);
+        unpack_move(nodes[index].move, &mv);
+        make_move(&game, &mv);
+    }
+
+    //value is for the side to move at the leaf, each node keeps it for the side that moved into it
+    for(int i = length - 1; i >= 0; i--)
+    {
+        value = -value;
+        __atomic_add_fetch(&nodes[path[i]].value, MCTS_VIRTUAL_LOSS + (int64_t)(value * 1000), __ATOMIC_RELAXED);
+    }
+}
+
+long long total_mcts_playouts(struct mcts_worker *workers, int no_of_workers)
+{
+    long long playouts = 0;
+    for(int i = 0; i < no_of_workers; i++)
+    {
+        playouts += __atomic_load_n(&workers[i].playouts, __ATOMIC_RELAXED);
+    }
+    return playouts;
+}
+
+uint32_t best_mcts_child(struct mcts_tree *tree, uint32_t index)
+{
+    struct mcts_node *nodes = mcts_nodes(tree);
+    struct mcts_node *node = &nodes[index];
+    uint32_t best = node->first_child;
+    for(int i = 1; i < node->no_of_children; i++)
+    {
+        best = nodes[node->first_child + i].visits > nodes[best].visits ? node->first_child + i : best;
+    }
+    return best;
+}
+
+//most visited line, at most max_length moves
+int mcts_principal_variation(struct mcts_tree *tree, struct move *pv, int max_length)
+{
+    struct mcts_node *nodes = mcts_nodes(tree);
+    uint32_t index = 0;
+    int length = 0;
+    while(length < max_length && nodes[index].state == MCTS_EXPANDED && nodes[index].no_of_children > 0)
+    {
+        index = best_mcts_child(tree, index);
+        if(nodes[index].visits == 0)
+        {
+            break;
+        }
+        unpack_move(nodes[index].move, &pv[length++]);
+    }
+    return length;
+}
+
+void print_mcts_info(struct mcts_worker *workers, int no_of_workers)
+{
+    struct mcts_tree *tree = workers[0].tree;
+    struct search_shared *shared = workers[0].shared;
+    struct mcts_node *nodes = mcts_nodes(tree);
+    struct move pv[16];
+    char text[6];
+    double elapsed = now_seconds() - shared->start;
+    long long playouts = total_mcts_playouts(workers, no_of_workers);
+    int length = mcts_principal_variation(tree, pv, 16);
+    int score = 0;
+    struct mcts_node *best = &nodes[best_mcts_child(tree, 0)];
+    if(length > 0 && best->visits > 0)
+    {
+        float q = best->value / (1000.0f * best->visits);
+        q = q > 0.99f ? 0.99f : q < -0.99f ? -0.99f : q;
+        score = 400 * q / (1 - (q < 0 ? -q : q));
+    }
+    printf("info depth %d score cp %d nodes %lld nps %.0f time %.0f pv", length, score, playouts,
+        playouts / (elapsed > 0 ? elapsed : 1e-9), elapsed * 1000);
+    for(int i = 0; i < length; i++)
+    {
+        move_to_string(&pv[i], text);
+        printf(" %s", text);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+//every worker claims its playouts from the tree's counter and stops at the limit, the first one
+//watches the clock, pondering and infinite searches run until they are stopped
+void* mcts_worker_loop(void *arg)
+{
+    struct mcts_worker *worker = (struct mcts_worker*)arg;
+    struct search_shared *shared = worker->shared;
+    struct search_limits *limits = &shared->limits;
+    long long limit = limits->nodes > 0 ? limits->nodes : shared->soft_time > 0 || limits->infinite || limits->ponder ? 0 : MCTS_DEFAULT_PLAYOUTS;
+    double start = now_seconds(), last_info = start;
+    while(!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED))
+    {
+        if(limit > 0 && __atomic_fetch_add(&worker->tree->playouts, 1, __ATOMIC_RELAXED) >= limit &&
+            !limits->infinite && !__atomic_load_n(&shared->pondering, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        run_mcts_playout(worker);
+        __atomic_store_n(&worker->playouts, worker->playouts + 1, __ATOMIC_RELAXED);
+        if(worker->id != 0 || (worker->playouts & 63) != 0)
+        {
+            continue;
+        }
+        double now = now_seconds();
+        if(shared->verbose && now - last_info >= 1)
+        {
+            print_mcts_info(worker - worker->id, shared->no_of_threads);
+            last_info = now;
+        }
+        int pondering = __atomic_load_n(&shared->pondering, __ATOMIC_ACQUIRE);
+        if(!pondering && !limits->infinite && shared->soft_time > 0 && now - shared->start >= shared->soft_time)
+        {
+            __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+        }
+    }
+    worker->seconds = now_seconds() - start;
+    return NULL;
+}
+
+//searches shared->root with the workers and returns the most visited root move in bestmove,
+//0 when the root has no moves. The tree keeps what it can from the previous search.
+int run_mcts(struct mcts_tree *tree, struct search_shared *shared, struct mcts_worker *workers, int no_of_workers, struct move *bestmove)
+{
+    shared->no_of_threads = no_of_workers;
+    shared->stop = 0;
+    shared->pondering = shared->limits.ponder;
+    shared->start = now_seconds();
+    set_search_time(shared);
+    set_mcts_root(tree, &shared->root);
+    tree->playouts = 0;
+    for(int i = 0; i < no_of_workers; i++)
+    {
+        struct mcts_worker *worker = &workers[i];
+        worker->tree = tree;
+        worker->shared = shared;
+        worker->id = i;
+        worker->history = shared->history;
+        worker->history.keys[shared->root.history_ply & (HISTORY_SIZE - 1)] = shared->root.hash;
+        worker->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        worker->playouts = 0;
+        if(worker->pawns.entries == NULL && !init_pawn_table(&worker->pawns, 1 << 14))
+        {
+            return 0;
+        }
+    }
+    pthread_t threads[256];
+    int started = 0;
+    for(int i = 1; i < no_of_workers; i++)
+    {
+        if(pthread_create(&threads[started], NULL, mcts_worker_loop, &workers[i]) == 0)
+        {
+            started++;
+        }
+    }
+    mcts_worker_loop(&workers[0]);
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    if(shared->verbose)
+    {
+        print_mcts_info(workers, no_of_workers);
+    }
+    struct mcts_node *root = &mcts_nodes(tree)[0];
+    if(root->state != MCTS_EXPANDED || root->no_of_children == 0)
+    {
+        return 0;
+    }
+    unpack_move(mcts_nodes(tree)[best_mcts_child(tree, 0)].move, bestmove);
+    return 1;
+}
+
+//UCI front end. The input thread owns the game and the options, go starts a controller thread
+//that runs the search threads and prints bestmove. stop and ponderhit only flip flags the search
+//reads at every node. A position command that extends the previous one only plays the new moves.
+struct uci_state
+{
+    struct chess_game game;
+    struct key_history history;
+    char *position;
+    char *moves;
+    struct transposition_table table;
+    int hash_mb;
+    struct analysis_cache cache;
+    int cache_open;
+    int cache_mb;
+    int no_of_threads;
+    struct search_shared shared;
+    struct search_thread *threads;
+    int threads_allocated;
+    struct mcts_tree mcts;
+    struct mcts_worker *mcts_workers;
+    int use_mcts;
+    int mcts_leaf_mode;
+    int mcts_mb;
+    int attack_maps;
+    pthread_t controller;
+    int searching;
+};
+
+void* uci_search_controller(void *arg)
+{
+    struct uci_state *uci = (struct uci_state*)arg;
+    struct search_thread *best = run_search(&uci->shared);
+    char text[6], ponder[6];
+    struct root_line *line = &best->best_lines[0];
+    if(best->no_of_best_lines == 0 || line->pv_length == 0)
+    {
+        //stopped before the first iteration finished, any legal move beats none
+        struct queue *q = generate_legal_moves(&uci->shared.root);
+        struct move *mv = q == NULL ? NULL : dequeue(q);
+        if(mv != NULL)
+        {
+            move_to_string(mv, text);
+        }
+        printf("bestmove %s\n", mv != NULL ? text : "0000");
+        free(mv);
+        if(q != NULL)
+        {
+            free_queue(q);
+        }
+    }
+    else if(line->pv_length == 1)
+    {
+        move_to_string(&line->pv[0], text);
+        printf("bestmove %s\n", text);
+    }
+    else
+    {
+        move_to_string(&line->pv[0], text);
+        move_to_string(&line->pv[1], ponder);
+        printf("bestmove %s ponder %s\n", text, ponder);
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+void* uci_mcts_controller(void *arg)
+{
+    struct uci_state *uci = (struct uci_state*)arg;
+    struct move bestmove;
+    char text[6];
+    int found = run_mcts(&uci->mcts, &uci->shared, uci->mcts_workers, uci->no_of_threads, &bestmove);
+    printf("info string tree %u nodes, %u kept from the last move, playouts/s per thread", mcts_tree_size(&uci->mcts), uci->mcts.reused);
+    for(int i = 0; i < uci->no_of_threads; i++)
+    {
+        struct mcts_worker *worker = &uci->mcts_workers[i];
+        printf(" %.0f", worker->seconds > 0 ? worker->playouts / worker->seconds : 0.0);
+    }
+    if(found)
+    {
+        move_to_string(&bestmove, text);
+    }
+    printf("\nbestmove %s\n", found ? text : "0000");
+    fflush(stdout);
+    return NULL;
+}
+
+//stops a running search and waits for its bestmove
+void finish_uci_search(struct uci_state *uci)
+{
+    if(uci->searching)
+    {
+        __atomic_store_n(&uci->shared.stop, 1, __ATOMIC_RELAXED);
+        pthread_join(uci->controller, NULL);
+        uci->searching = 0;
+    }
+}
+
+//the moves of text as single spaced words in out, so move lists compare as strings
+char* normalize_moves(char *text)
+{
+    char *out = (char*)malloc(strlen(text) + 1);
+    char word[16];
+    int length = 0;
+    if(out == NULL)
+    {
+        return NULL;
+    }
+    while((text = next_word(text, word, sizeof(word))) != NULL)
+    {
+        length += sprintf(out + length, length == 0 ? "%s" : " %s", word);
+    }
+    out[length] = '\0';
+    return out;
+}
+
+int set_uci_position(struct uci_state *uci, char *line)
+{
+    char *moves_start = strstr(line, "moves");
+    char *moves = normalize_moves(moves_start == NULL ? "" : moves_start + 5);
+    char *position = (char*)malloc(strlen(line) + 1);
+    if(moves == NULL || position == NULL)
+    {
+        printf("memory not allocated\n");
+        free(moves);
+        free(position);
+        return 0;
+    }
+    int length = moves_start == NULL ? (int)strlen(line) : (int)(moves_start - line);
+    copy_string_range(position, line, 0, length - 1);
+    while(length > 0 && position[length - 1] == ' ')
+    {
+        position[--length] = '\0';
+    }
+
+    //the previous move list is a prefix of the new one: only the moves after it are played
+    char *new_moves = moves;
+    int old_length = uci->moves == NULL ? 0 : strlen(uci->moves);
+    if(uci->position == NULL || strcmp(position, uci->position) != 0 || strncmp(moves, uci->moves, old_length) != 0 ||
+        (moves[old_length] != ' ' && moves[old_length] != '\0'))
+    {
+        struct chess_game game;
+        if(parse_position_line(&game, position) == NULL)
+        {
+            printf("info string invalid position %s\n", position);
+            free(moves);
+            free(position);
+            return 0;
+        }
+        uci->game = game;
+        attach_key_history(&uci->game, &uci->history);
+        old_length = 0;
+    }
+    new_moves += old_length;
+
+    char word[16];
+    char *rest = new_moves;
+    while((rest = next_word(rest, word, sizeof(word))) != NULL)
+    {
+        struct move *mv = parse_move(&uci->game, word);
+        if(mv == NULL)
+        {
+            printf("info string illegal move %s\n", word);
+            //keep only the moves that were played
+            moves[rest - moves - strlen(word)] = '\0';
+            length = strlen(moves);
+            while(length > 0 && moves[length - 1] == ' ')
+            {
+                moves[--length] = '\0';
+            }
+            break;
+        }
+        make_move(&uci->game, mv);
+        free(mv);
+    }
+    free(uci->position);
+    free(uci->moves);
+    uci->position = position;
+    uci->moves = moves;
+    return 1;
+}
+
+void start_uci_search(struct uci_state *uci, char *line)
+{
+    struct search_limits *limits = &uci->shared.limits;
+    memset(limits, 0, sizeof(*limits));
+    char word[32], value[32];
+    char *rest = line;
+    while((rest = next_word(rest, word, sizeof(word))) != NULL)
+    {
+        if(strcmp(word, "infinite") == 0 || strcmp(word, "ponder") == 0)
+        {
+            limits->infinite |= word[0] == 'i';
+            limits->ponder |= word[0] == 'p';
+            continue;
+        }
+        char *next = next_word(rest, value, sizeof(value));
+        long long number = next == NULL ? 0 : atoll(value);
+        int known = 1;
+        if(strcmp(word, "depth") == 0)
+        {
+            limits->depth = number;
+        }
+        else if(strcmp(word, "nodes") == 0)
+        {
+            limits->nodes = number;
+        }
+        else if(strcmp(word, "movetime") == 0)
+        {
+            limits->movetime = number;
+        }
+        else if(strcmp(word, "wtime") == 0 || strcmp(word, "btime") == 0)
+        {
+            limits->time[word[0] == 'b'] = number;
+        }
+        else if(strcmp(word, "winc") == 0 || strcmp(word, "binc") == 0)
+        {
+            limits->increment[word[0] == 'b'] = number;
+        }
+        else if(strcmp(word, "movestogo") == 0)
+        {
+            limits->movestogo = number;
+        }
+        else
+        {
+            known = 0;
+        }
+        rest = known && next != NULL ? next : rest;
+    }
+
+    if(uci->threads_allocated != uci->no_of_threads)
+    {
+        for(int i = 0; i < uci->threads_allocated; i++)
+        {
+            free_pawn_table(&uci->threads[i].pawns);
+        }
+        free(uci->threads);
+        uci->threads = (struct search_thread*)calloc(uci->no_of_threads, sizeof(struct search_thread));
+        uci->threads_allocated = uci->threads == NULL ? 0 : uci->no_of_threads;
+    }
+    uci->shared.table = &uci->table;
+    uci->shared.cache = uci->cache_open ? &uci->cache : NULL;
+    uci->shared.params = &default_eval_params;
+    uci->shared.verbose = 1;
+    uci->shared.root = uci->game;
+    uci->shared.history = uci->history;
+    if(uci->attack_maps)
+    {
+        enable_attack_maps(&uci->shared.root);
+    }
+    if(uci->use_mcts)
+    {
+        //the tree and the workers are set up on the first tree search and kept for the game
+        if(uci->mcts_workers == NULL)
+        {
+            uci->mcts_workers = (struct mcts_worker*)calloc(256, sizeof(struct mcts_worker));
+        }
+        if(uci->mcts_workers == NULL || (uci->mcts.arenas[0].nodes == NULL && !init_mcts_tree(&uci->mcts, uci->mcts_mb)))
+        {
+            printf("memory not allocated\n");
+            return;
+        }
+        uci->mcts.leaf_mode = uci->mcts_leaf_mode;
+        uci->searching = pthread_create(&uci->controller, NULL, uci_mcts_controller, uci) == 0;
+        return;
+    }
+    if(uci->threads == NULL || !prepare_search(&uci->shared, uci->threads, uci->no_of_threads))
+    {
+        printf("memory not allocated\n");
+        return;
+    }
+    uci->searching = pthread_create(&uci->controller, NULL, uci_search_controller, uci) == 0;
+}
+
+void set_uci_option(struct uci_state *uci, char *line)
+{
+    char name[64] = "", value[4096] = "", word[4096];
+    char *rest = line;
+    char *target = NULL;
+    while((rest = next_word(rest, word, sizeof(word))) != NULL)
+    {
+        if(strcmp(word, "name") == 0 || strcmp(word, "value") == 0)
+        {
+            target = word[0] == 'n' ? name : value;
+        }
+        else if(target != NULL && strlen(target) + strlen(word) + 2 < (target == name ? sizeof(name) : sizeof(value)))
+        {
+            strcat(target, target[0] == '\0' ? "" : " ");
+            strcat(target, word);
+        }
+    }
+
+    if((strcmp(name, "Hash") == 0 && atoi(value) > 0) || strcmp(name, "LargePages") == 0)
+    {
+        //the old table stays in use until the new one is allocated
+        struct transposition_table table;
+        int megabytes = name[0] == 'H' ? atoi(value) : uci->hash_mb, large_pages = memory_settings.large_pages;
+        memory_settings.large_pages = name[0] == 'H' ? large_pages : strcmp(value, "true") == 0;
+        if(init_transposition_table(&table, megabytes))
+        {
+            free_transposition_table(&uci->table);
+            uci->table = table;
+            uci->hash_mb = megabytes;
+        }
+        else
+        {
+            memory_settings.large_pages = large_pages;
+        }
+        char text[256];
+        describe_table_memory(&uci->table, text, sizeof(text));
+        printf("info string %s\n", text);
+    }
+    else if(strcmp(name, "NumaPin") == 0)
+    {
+        memory_settings.numa_pin = strcmp(value, "true") == 0;
+    }
+    else if(strcmp(name, "AnalysisCacheSize") == 0 && atoi(value) > 0)
+    {
+        uci->cache_mb = atoi(value);
+    }
+    else if(strcmp(name, "AnalysisCache") == 0)
+    {
+        if(uci->cache_open)
+        {
+            close_analysis_cache(&uci->cache);
+        }
+        uci->cache_open = value[0] != '\0' && strcmp(value, "<empty>") != 0 && open_analysis_cache(value, uci->cache_mb, &uci->cache);
+    }
+    else if(strcmp(name, "AttackMaps") == 0)
+    {
+        uci->attack_maps = strcmp(value, "true") == 0;
+    }
+    else if(strcmp(name, "UseMCTS") == 0)
+    {
+        uci->use_mcts = strcmp(value, "true") == 0;
+    }
+    else if(strcmp(name, "MCTSLeaf") == 0)
+    {
+        uci->mcts_leaf_mode = strcmp(value, "playout") == 0 ? MCTS_LEAF_PLAYOUT : MCTS_LEAF_EVAL;
+    }
+    else if(strcmp(name, "MCTSTree") == 0 && atoi(value) > 0)
+    {
+        free_mcts_tree(&uci->mcts);
+        uci->mcts_mb = atoi(value);
+    }
+    else if(strcmp(name, "MultiPV") == 0 && atoi(value) > 0)
+    {
+        uci->shared.multi_pv = atoi(value) > MAX_MULTI_PV ? MAX_MULTI_PV : atoi(value);
+    }
+    else if(strcmp(name, "Threads") == 0 && atoi(value) > 0)
+    {
+        uci->no_of_threads = atoi(value) > 256 ? 256 : atoi(value);
+    }
+    else if(strcmp(name, "Ponder") != 0)
+    {
+        printf("info string unknown option %s\n", name);
+    }
+}
+
+int run_uci()
+{
+    struct uci_state *uci = (struct uci_state*)calloc(1, sizeof(struct uci_state));
+    if(uci == NULL || !init_transposition_table(&uci->table, 16))
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    uci->hash_mb = 16;
+    uci->cache_mb = 256;
+    uci->mcts_mb = 256;
+    uci->no_of_threads = 1;
+    uci->shared.multi_pv = 1;
+    set_uci_position(uci, START_POSITION_LINE);
+
+    char *line = NULL, command[32];
+    size_t capacity = 0;
+    while(getline(&line, &capacity, stdin) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *rest = next_word(line, command, sizeof(command));
+        if(rest == NULL)
+        {
+            continue;
+        }
+        if(strcmp(command, "uci") == 0)
+        {
+            printf("id name chess-remake\nid author hemaprakashreddy1\n");
+            printf("option name Hash type spin default 16 min 1 max 65536\n");
+            printf("option name Threads type spin default 1 min 1 max 256\n");
+            printf("option name LargePages type check default true\n");
+            printf("option name NumaPin type check default false\n");
+            printf("option name MultiPV type spin default 1 min 1 max %d\n", MAX_MULTI_PV);
+            printf("option name Ponder type check default false\n");
+            printf("option name AnalysisCache type string default <empty>\n");
+            printf("option name AnalysisCacheSize type spin default 256 min 1 max 65536\n");
+            printf("option name AttackMaps type check default false\n");
+            printf("option name UseMCTS type check default false\n");
+            printf("option name MCTSLeaf type combo default eval var eval var playout\n");
+            printf("option name MCTSTree type spin default 256 min 1 max 65536\n");
+            printf("uciok\n");
+        }
+        else if(strcmp(command, "isready") == 0)
+        {
+            printf("readyok\n");
+        }
+        else if(strcmp(command, "stop") == 0)
+        {
+            __atomic_store_n(&uci->shared.stop, 1, __ATOMIC_RELAXED);
+        }
+        else if(strcmp(command, "ponderhit") == 0)
+        {
+            //the clock starts now, the search keeps what it found while pondering
+            uci->shared.start = now_seconds();
+            __atomic_store_n(&uci->shared.pondering, 0, __ATOMIC_RELEASE);
+        }
+        else if(strcmp(command, "quit") == 0)
+        {
+            break;
+        }
+        else
+        {
+            finish_uci_search(uci);
+            if(strcmp(command, "position") == 0)
+            {
+                set_uci_position(uci, rest);
+            }
+            else if(strcmp(command, "go") == 0)
+            {
+                start_uci_search(uci, rest);
+            }
+            else if(strcmp(command, "setoption") == 0)
+            {
+                set_uci_option(uci, rest);
+            }
+            else if(strcmp(command, "ucinewgame") == 0)
+            {
+                clear_transposition_table(&uci->table);
+                uci->mcts.has_root = 0;
+            }
+            else if(strcmp(command, "d") == 0)
+            {
+                generate_fen(&uci->game);
+                display_name_board(uci->game.board);
+                printf("%s\n", uci->game.fen);
+            }
+            else
+            {
+                printf("info string unknown command %s\n", command);
+            }
+        }
+        fflush(stdout);
+    }
+
+    finish_uci_search(uci);
+    if(uci->cache_open)
+    {
+        close_analysis_cache(&uci->cache);
+    }
+    for(int i = 0; i < uci->threads_allocated; i++)
+    {
+        free_pawn_table(&uci->threads[i].pawns);
+    }
+    free(uci->threads);
+    for(int i = 0; uci->mcts_workers != NULL && i < 256; i++)
+    {
+        free_pawn_table(&uci->mcts_workers[i].pawns);
+    }
+    free(uci->mcts_workers);
+    free_mcts_tree(&uci->mcts);
+    free_transposition_table(&uci->table);
+    free(uci->position);
+    free(uci->moves);
+    free(line);
+    free(uci);
+    return 0;
+}
+
+//usage: analyse <fen file> [depth] [cache file | -] [cache MB] [lines]
+//searches every position to a fixed depth for the best lines, with the cache a second run
+//starts warm
+int run_analysis(int argc, char *argv[])
+{
+    int lines = argc > 4 ? atoi(argv[4]) : 1;
+    if(argc < 1 || lines < 1)
+    {
+        printf("usage: analyse <fen file> [depth] [cache file | -] [cache MB] [lines]\n");
+        return 1;
+    }
+    char **fens;
+    int no_of_fens = load_fen_lines(argv[0], &fens);
+    int depth = argc > 1 ? atoi(argv[1]) : 8;
+    struct transposition_table table;
+    struct analysis_cache cache;
+    struct search_shared *shared = (struct search_shared*)calloc(1, sizeof(struct search_shared));
+    struct search_thread *thread = (struct search_thread*)calloc(1, sizeof(struct search_thread));
+    if(shared == NULL || thread == NULL || !init_transposition_table(&table, 64))
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    int use_cache = argc > 2 && strcmp(argv[2], "-") != 0;
+    if(use_cache && !open_analysis_cache(argv[2], argc > 3 ? atoi(argv[3]) : 256, &cache))
+    {
+        return 1;
+    }
+    shared->table = &table;
+    shared->cache = use_cache ? &cache : NULL;
+    shared->params = &default_eval_params;
+    shared->multi_pv = lines;
+
+    struct fen fn;
+    char text[6];
+    long long total_nodes = 0;
+    double start = now_seconds();
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            continue;
+        }
+        init_chess_game(&shared->root, &fn);
+        attach_key_history(&shared->root, &shared->history);
+        memset(&shared->limits, 0, sizeof(shared->limits));
+        shared->limits.depth = depth;
+        if(!prepare_search(shared, thread, 1))
+        {
+            return 1;
+        }
+        double position_start = now_seconds();
+        struct search_thread *best = run_search(shared);
+        for(int k = 0; k < best->no_of_best_lines || k == 0; k++)
+        {
+            struct root_line *line = &best->best_lines[k];
+            if(k < best->no_of_best_lines && line->pv_length > 0)
+            {
+                move_to_string(&line->pv[0], text);
+            }
+            else
+            {
+                string_cpy(text, "0000");
+            }
+            if(k == 0)
+            {
+                printf("%d bestmove %s score %d depth %d nodes %lld ms %.1f\n", i, text, line->score, best->completed_depth, best->nodes,
+                    (now_seconds() - position_start) * 1000);
+            }
+            else
+            {
+                printf("  multipv %d %s score %d\n", k + 1, text, line->score);
+            }
+        }
+        total_nodes += best->nodes;
+    }
+    printf("{\"positions\": %d, \"depth\": %d, \"lines\": %d, \"nodes\": %lld, \"seconds\": %.3f, \"cache\": %s}\n", no_of_fens, depth,
+        shared->multi_pv, total_nodes, now_seconds() - start, use_cache ? "true" : "false");
+
+    if(use_cache)
+    {
+        close_analysis_cache(&cache);
+    }
+    free_pawn_table(&thread->pawns);
+    free_transposition_table(&table);
+    free_strings(fens, no_of_fens);
+    free(fens);
+    free(shared);
+    free(thread);
+    return 0;
+}
+
+//fixed positions searched by bench. The total node count is a signature of the search: a change
+//meant only to be faster must leave it as it is.
+char *BENCH_FENS[] =
+{
+    //openings
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pp1ppppp/8/2p5/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2",
+    "r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+    //middlegames
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "2kr3r/pp1q1ppp/2n1bn2/2bpp3/4P3/2NP1N2/PPPBBPPP/R2QK2R b KQ - 3 9",
+    "r1b2rk1/2q1bppp/p2ppn2/1p6/3BPP2/2N2B2/PPPQ2PP/R4R1K w - - 0 15",
+    "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+    "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+    "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+    "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+    "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    //endgames
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "8/5pk1/6p1/7p/1R5P/6P1/r4PK1/8 w - - 0 40",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    //promotions
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1"
+};
+
+#define NO_OF_BENCH_FENS ((int)(sizeof(BENCH_FENS) / sizeof(BENCH_FENS[0])))
+#define BENCH_DEPTH 6
+#define BENCH_HASH_MB 16
+
+//usage: bench [depth] [hash MB] [threads] [large pages 1|0] [numa pin 0|1]
+//searches every bench position from an empty table and prints the total nodes and nps. Only a
+//one thread run has a fixed node count, more threads are for measuring the speed of the search.
+int run_bench(int argc, char *argv[])
+{
+    int depth = argc > 0 ? atoi(argv[0]) : BENCH_DEPTH;
+    depth = depth < 1 ? 1 : depth > MAX_PLY - 2 ? MAX_PLY - 2 : depth;
+    int no_of_threads = argc > 2 ? atoi(argv[2]) : 1;
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    memory_settings.large_pages = argc > 3 ? atoi(argv[3]) != 0 : 1;
+    memory_settings.numa_pin = argc > 4 ? atoi(argv[4]) != 0 : 0;
+    struct transposition_table table;
+    struct search_shared *shared = (struct search_shared*)calloc(1, sizeof(struct search_shared));
+    struct search_thread *threads = (struct search_thread*)calloc(no_of_threads, sizeof(struct search_thread));
+    if(shared == NULL || threads == NULL || !init_transposition_table(&table, argc > 1 ? atoi(argv[1]) : BENCH_HASH_MB))
+    {
+        printf("memory not allocated\n");
+        free(shared);
+        free(threads);
+        return 1;
+    }
+    char memory[256];
+    describe_table_memory(&table, memory, sizeof(memory));
+    printf("%s\n", memory);
+    shared->table = &table;
+    shared->params = &default_eval_params;
+    shared->multi_pv = 1;
+
+    struct fen fn;
+    char text[6];
+    long long total_nodes = 0;
+    double start = now_seconds();
+    for(int i = 0; i < NO_OF_BENCH_FENS; i++)
+    {
+        init_fen(&fn, BENCH_FENS[i]);
+        init_chess_game(&shared->root, &fn);
+        attach_key_history(&shared->root, &shared->history);
+        memset(&shared->limits, 0, sizeof(shared->limits));
+        shared->limits.depth = depth;
+        clear_transposition_table(&table);
+        if(!prepare_search(shared, threads, no_of_threads))
+        {
+            printf("memory not allocated\n");
+            return 1;
+        }
+        struct search_thread *best = run_search(shared);
+        string_cpy(text, "0000");
+        if(best->no_of_best_lines > 0 && best->best_lines[0].pv_length > 0)
+        {
+            move_to_string(&best->best_lines[0].pv[0], text);
+        }
+        long long nodes = 0;
+        for(int k = 0; k < no_of_threads; k++)
+        {
+            nodes += threads[k].nodes;
+        }
+        printf("%d bestmove %s score %d nodes %lld\n", i, text, best->best_lines[0].score, nodes);
+        total_nodes += nodes;
+    }
+    double elapsed = now_seconds() - start;
+    printf("{\"positions\": %d, \"depth\": %d, \"threads\": %d, \"nodes\": %lld, \"seconds\": %.3f, \"nps\": %.0f}\n", NO_OF_BENCH_FENS, depth,
+        no_of_threads, total_nodes, elapsed, elapsed > 0 ? total_nodes / elapsed : 0);
+
+    for(int i = 0; i < no_of_threads; i++)
+    {
+        free_pawn_table(&threads[i].pawns);
+    }
+    free_transposition_table(&table);
+    free(shared);
+    free(threads);
+    return 0;
+}
+
+//usage: mcts <fen file> [playouts] [threads] [eval|playout] [tree MB]
+//searches every position with the tree search, the output lines up with analyse for comparison
+int run_mcts_benchmark(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: mcts <fen file> [playouts] [threads] [eval|playout] [tree MB]\n");
+        return 1;
+    }
+    char **fens;
+    int no_of_fens = load_fen_lines(argv[0], &fens);
+    int playouts = argc > 1 ? atoi(argv[1]) : 100000;
+    int no_of_threads = argc > 2 ? atoi(argv[2]) : 1;
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    struct mcts_tree tree;
+    struct search_shared *shared = (struct search_shared*)calloc(1, sizeof(struct search_shared));
+    struct mcts_worker *workers = (struct mcts_worker*)calloc(no_of_threads, sizeof(struct mcts_worker));
+    double *seconds = (double*)calloc(no_of_threads, sizeof(double));
+    long long *thread_playouts = (long long*)calloc(no_of_threads, sizeof(long long));
+    if(shared == NULL || workers == NULL || seconds == NULL || thread_playouts == NULL || !init_mcts_tree(&tree, argc > 4 ? atoi(argv[4]) : 256))
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    tree.leaf_mode = argc > 3 && strcmp(argv[3], "playout") == 0 ? MCTS_LEAF_PLAYOUT : MCTS_LEAF_EVAL;
+    shared->params = &default_eval_params;
+
+    struct fen fn;
+    struct move bestmove;
+    char text[6];
+    long long total_playouts = 0;
+    double start = now_seconds();
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            continue;
+        }
+        init_chess_game(&shared->root, &fn);
+        attach_key_history(&shared->root, &shared->history);
+        memset(&shared->limits, 0, sizeof(shared->limits));
+        shared->limits.nodes = playouts;
+        double position_start = now_seconds();
+        if(!run_mcts(&tree, shared, workers, no_of_threads, &bestmove))
+        {
+            string_cpy(text, "0000");
+        }
+        else
+        {
+            move_to_string(&bestmove, text);
+        }
+        long long position_playouts = total_mcts_playouts(workers, no_of_threads);
+        printf("%d bestmove %s playouts %lld tree %u%s ms %.1f\n", i, text, position_playouts, mcts_tree_size(&tree),
+            tree.full ? " full" : "", (now_seconds() - position_start) * 1000);
+        total_playouts += position_playouts;
+        for(int j = 0; j < no_of_threads; j++)
+        {
+            thread_playouts[j] += workers[j].playouts;
+            seconds[j] += workers[j].seconds;
+        }
+    }
+    printf("{\"positions\": %d, \"threads\": %d, \"leaf\": \"%s\", \"playouts\": %lld, \"seconds\": %.3f, \"playouts_per_second\": [",
+        no_of_fens, no_of_threads, tree.leaf_mode == MCTS_LEAF_PLAYOUT ? "playout" : "eval", total_playouts, now_seconds() - start);
+    for(int i = 0; i < no_of_threads; i++)
+    {
+        printf(i == 0 ? "%.0f" : ", %.0f", seconds[i] > 0 ? thread_playouts[i] / seconds[i] : 0.0);
+    }
+    printf("]}\n");
+
+    for(int i = 0; i < no_of_threads; i++)
+    {
+        free_pawn_table(&workers[i].pawns);
+    }
+    free_mcts_tree(&tree);
+    free_strings(fens, no_of_fens);
+    free(fens);
+    free(shared);
+    free(workers);
+    free(seconds);
+    free(thread_playouts);
+    return 0;
+}
+
+struct task_results
+{
+    double *latencies;
+    int *priorities;
+    int no_of_results;
+    long long depths;
+    long long nodes;
+    double late;
+    pthread_mutex_t lock;
+};
+
+void record_task_result(void *context, struct analysis_task *task)
+{
+    struct task_results *results = (struct task_results*)context;
+    pthread_mutex_lock(&results->lock);
+    results->latencies[results->no_of_results] = task->finished - task->arrival;
+    results->priorities[results->no_of_results++] = task->priority;
+    results->depths += task->completed_depth;
+    results->nodes += task->nodes;
+    results->late = task->finished - task->deadline > results->late ? task->finished - task->deadline : results->late;
+    pthread_mutex_unlock(&results->lock);
+}
+
+//usage: tasks <fen file> [tasks] [depth] [deadline ms] [cores] [slice nodes] [arrivals per second]
+//a load test of the task scheduler: the positions are submitted as shallow analyses, every eighth
+//one urgent, all at once or at the given rate, and the latencies are reported per priority
+int run_task_benchmark(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: tasks <fen file> [tasks] [depth] [deadline ms] [cores] [slice nodes] [arrivals per second]\n");
+        return 1;
+    }
+    char **fens;
+    int no_of_fens = load_fen_lines(argv[0], &fens);
+    int no_of_tasks = argc > 1 ? atoi(argv[1]) : 1000;
+    int depth = argc > 2 ? atoi(argv[2]) : 4;
+    double deadline = (argc > 3 ? atoi(argv[3]) : 1000) / 1000.0;
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int no_of_cores = argc > 4 ? atoi(argv[4]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    no_of_cores = no_of_cores < 1 ? 1 : no_of_cores > 256 ? 256 : no_of_cores;
+    int slice_nodes = argc > 5 ? atoi(argv[5]) : 1000;
+    double rate = argc > 6 ? atof(argv[6]) : 0;
+    if(no_of_fens == 0 || no_of_tasks <= 0)
+    {
+        return 1;
+    }
+
+    struct analysis_task *tasks = (struct analysis_task*)malloc(sizeof(struct analysis_task) * no_of_tasks);
+    struct chess_game *games = (struct chess_game*)malloc(sizeof(struct chess_game) * no_of_fens);
+    struct task_results results;
+    memset(&results, 0, sizeof(results));
+    results.latencies = (double*)malloc(sizeof(double) * no_of_tasks);
+    results.priorities = (int*)malloc(sizeof(int) * no_of_tasks);
+    struct transposition_table table;
+    if(tasks == NULL || games == NULL || results.latencies == NULL || results.priorities == NULL || !init_transposition_table(&table, 64))
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    struct fen fn;
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            return 1;
+        }
+        init_chess_game(&games[i], &fn);
+    }
+    pthread_mutex_init(&results.lock, NULL);
+
+    struct task_scheduler scheduler;
+    if(!start_task_scheduler(&scheduler, &table, &default_eval_params, no_of_cores, slice_nodes, record_task_result, &results))
+    {
+        return 1;
+    }
+    double start = now_seconds();
+    for(int i = 0; i < no_of_tasks; i++)
+    {
+        if(rate > 0)
+        {
+            double wait = start + i / rate - now_seconds();
+            struct timespec pause = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+            if(wait > 0)
+            {
+                nanosleep(&pause, NULL);
+            }
+        }
+        init_analysis_task(&tasks[i], &games[i % no_of_fens], depth, i % 8 == 0, now_seconds() + deadline);
+        tasks[i].id = i;
+        if(!submit_analysis_task(&scheduler, &tasks[i]))
+        {
+            printf("memory not allocated\n");
+            break;
+        }
+    }
+    stop_task_scheduler(&scheduler);
+    double elapsed = now_seconds() - start;
+
+    //latencies sorted within each priority
+    double *urgent = (double*)malloc(sizeof(double) * (results.no_of_results + 1)), *normal = (double*)malloc(sizeof(double) * (results.no_of_results + 1));
+    int no_of_urgent = 0, no_of_normal = 0;
+    for(int i = 0; urgent != NULL && normal != NULL && i < results.no_of_results; i++)
+    {
+        if(results.priorities[i] > 0)
+        {
+            urgent[no_of_urgent++] = results.latencies[i];
+        }
+        else
+        {
+            normal[no_of_normal++] = results.latencies[i];
+        }
+    }
+    qsort(urgent, no_of_urgent, sizeof(double), compare_doubles);
+    qsort(normal, no_of_normal, sizeof(double), compare_doubles);
+    printf("{\"tasks\": %d, \"cores\": %d, \"slice\": %d, \"depth\": %.2f, \"nodes\": %lld, \"nps\": %.0f, \"tasks_per_s\": %.1f, "
+        "\"urgent_p50_ms\": %.1f, \"urgent_p99_ms\": %.1f, \"normal_p50_ms\": %.1f, \"normal_p99_ms\": %.1f, \"max_late_ms\": %.1f}\n",
+        results.no_of_results, scheduler.no_of_cores, slice_nodes, (double)results.depths / (results.no_of_results > 0 ? results.no_of_results : 1),
+        results.nodes, results.nodes / elapsed, results.no_of_results / elapsed,
+        no_of_urgent > 0 ? urgent[no_of_urgent / 2] * 1000 : 0, no_of_urgent > 0 ? urgent[no_of_urgent * 99 / 100] * 1000 : 0,
+        no_of_normal > 0 ? normal[no_of_normal / 2] * 1000 : 0, no_of_normal > 0 ? normal[no_of_normal * 99 / 100] * 1000 : 0, results.late * 1000);
+
+    pthread_mutex_destroy(&results.lock);
+    free(urgent);
+    free(normal);
+    free(results.latencies);
+    free(results.priorities);
+    free(tasks);
+    free(games);
+    free_transposition_table(&table);
+    free_strings(fens, no_of_fens);
+    free(fens);
+    return 0;
+}
+
+//Mate solver: depth first proof number search (df-pn). Every node keeps phi and delta, the
+//proof and disproof numbers seen from its side to move, so phi is the proof number where the
+//attacker moves and the disproof number where the defender moves. The attacker has a fixed
+//number of moves, which keeps the search graph free of cycles, and by default only plays checks.
+#define PN_BUCKET_SIZE 4
+#define MAX_MATE_MOVES 32
+
+const uint32_t PN_INFINITE = 100000000;
+
+//amount is the number of nodes searched below the entry, garbage collection drops the
+//cheapest entries first
+struct pn_entry
+{
+    uint64_t key;
+    uint32_t phi;
+    uint32_t delta;
+    uint32_t amount;
+    uint32_t move;
+};
+
+struct pn_table
+{
+    struct pn_entry *entries;
+    uint64_t mask;
+    uint64_t used;
+    uint64_t peak;
+    uint64_t capacity;
+    long long collections;
+    long long collected;
+};
+
+struct pn_child
+{
+    struct move mv;
+    uint64_t key;
+};
+
+struct mate_solver
+{
+    struct pn_table table;
+    int attacker;
+    int checks_only;
+    long long nodes;
+    long long max_nodes;
+};
+
+int init_pn_table(struct pn_table *table, int megabytes)
+{
+    uint64_t no_of_buckets = 1;
+    while(no_of_buckets * 2 * PN_BUCKET_SIZE * sizeof(struct pn_entry) <= ((uint64_t)megabytes << 20))
+    {
+        no_of_buckets *= 2;
+    }
+    table->entries = (struct pn_entry*)calloc(no_of_buckets * PN_BUCKET_SIZE, sizeof(struct pn_entry));
+    if(table->entries == NULL)
+    {
+        printf("memory not allocated\n");
+        return 0;
+    }
+    table->mask = no_of_buckets - 1;
+    table->capacity = no_of_buckets * PN_BUCKET_SIZE;
+    table->used = table->peak = 0;
+    table->collections = table->collected = 0;
+    return 1;
+}
+
+void clear_pn_table(struct pn_table *table)
+{
+    memset(table->entries, 0, sizeof(struct pn_entry) * table->capacity);
+    table->used = table->peak = 0;
+    table->collections = table->collected = 0;
+}
+
+void free_pn_table(struct pn_table *table)
+{
+    free(table->entries);
+    table->entries = NULL;
+}
+
+struct pn_entry* probe_pn(struct pn_table *table, uint64_t key)
+{
+    struct pn_entry *bucket = &table->entries[(key & table->mask) * PN_BUCKET_SIZE];
+    for(int i = 0; i < PN_BUCKET_SIZE; i++)
+    {
+        if(bucket[i].key == key)
+        {
+            return &bucket[i];
+        }
+    }
+    return NULL;
+}
+
+int amount_class(uint32_t amount)
+{
+    int class = 0;
+    while(amount > 1)
+    {
+        amount >>= 1;
+        class++;
+    }
+    return class;
+}
+
+//removes the entries with the smallest amounts, at least half of the table's entries
+void collect_pn_garbage(struct pn_table *table)
+{
+    uint64_t histogram[33] = {0};
+    for(uint64_t i = 0; i < table->capacity; i++)
+    {
+        if(table->entries[i].key != 0)
+        {
+            histogram[amount_class(table->entries[i].amount)]++;
+        }
+    }
+    int limit = 0;
+    uint64_t removed = histogram[0];
+    while(limit < 32 && removed < table->used / 2)
+    {
+        removed += histogram[++limit];
+    }
+    for(uint64_t i = 0; i < table->capacity; i++)
+    {
+        if(table->entries[i].key != 0 && amount_class(table->entries[i].amount) <= limit)
+        {
+            table->entries[i].key = 0;
+        }
+    }
+    table->used -= removed;
+    table->collections++;
+    table->collected += removed;
+}
+
+//a full bucket gives up its smallest entry, a table three quarters full is collected
+void store_pn(struct pn_table *table, uint64_t key, uint32_t phi, uint32_t delta, uint32_t amount, uint32_t move)
+{
+    struct pn_entry *bucket = &table->entries[(key & table->mask) * PN_BUCKET_SIZE];
+    struct pn_entry *entry = NULL;
+    for(int i = 0; i < PN_BUCKET_SIZE && entry == NULL; i++)
+    {
+        if(bucket[i].key == key)
+        {
+            entry = &bucket[i];
+        }
+    }
+    for(int i = 0; i < PN_BUCKET_SIZE && entry == NULL; i++)
+    {
+        if(bucket[i].key == 0)
+        {
+            entry = &bucket[i];
+            table->used++;
+            table->peak = table->used > table->peak ? table->used : table->peak;
+        }
+    }
+    if(entry == NULL)
+    {
+        entry = &bucket[0];
+        for(int i = 1; i < PN_BUCKET_SIZE; i++)
+        {
+            entry = bucket[i].amount < entry->amount ? &bucket[i] : entry;
+        }
+    }
+    entry->key = key;
+    entry->phi = phi;
+    entry->delta = delta;
+    entry->amount = amount;
+    entry->move = move;
+    if(table->used * 4 > table->capacity * 3)
+    {
+        collect_pn_garbage(table);
+    }
+}
+
+//the same position with a different number of attacker moves left is a different node
+uint64_t mate_key(struct chess_game *game, int moves_left)
+{
+    uint64_t key = game->hash ^ ((uint64_t)(moves_left + 1) * 0x9E3779B97F4A7C15ULL);
+    return key == 0 ? 1 : key;
+}
+
+void look_up_pn(struct pn_table *table, uint64_t key, uint32_t *phi, uint32_t *delta)
+{
+    struct pn_entry *entry = probe_pn(table, key);
+    *phi = entry != NULL ? entry->phi : 1;
+    *delta = entry != NULL ? entry->delta : 1;
+}
+
+int child_moves_left(struct mate_solver *solver, struct chess_game *game, int moves_left)
+{
+    return game->turn == solver->attacker ? moves_left - 1 : moves_left;
+}
+
+//legal moves, for the attacker only the checking ones unless checks_only is off
+int generate_mate_children(struct mate_solver *solver, struct chess_game *game, int moves_left, struct pn_child *children)
+{
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return 0;
+    }
+    int attacking = game->turn == solver->attacker;
+    int in_check = is_in_check(game, game->turn);
+    int next_moves_left = child_moves_left(solver, game, moves_left);
+    int count = 0;
+    struct chess_game child;
+    struct move *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        if(count < MAX_MOVES && make_legal_move(game, mv, &child, in_check) && (!attacking || !solver->checks_only || is_in_check(&child, child.turn)))
+        {
+            children[count].mv = *mv;
+            children[count].key = mate_key(&child, next_moves_left);
+            count++;
+        }
+        free(mv);
+    }
+    free(q);
+    return count;
+}
+
+//expands the node until its phi or delta reaches the limit. phi is the smallest delta of the
+//children and delta the sum of their phis, the most proving child is searched with limits just
+//past the second best (the 1 + epsilon trick, a quarter here) so it is not left too soon
+void mate_mid(struct mate_solver *solver, struct chess_game *game, uint64_t key, int moves_left, uint32_t phi_limit, uint32_t delta_limit)
+{
+    long long start_nodes = solver->nodes++;
+    struct pn_entry *entry = probe_pn(&solver->table, key);
+    uint32_t amount = entry != NULL ? entry->amount : 0;
+    int attacking = game->turn == solver->attacker;
+    if(attacking && moves_left == 0)
+    {
+        store_pn(&solver->table, key, PN_INFINITE, 0, amount + 1, 0);
+        return;
+    }
+
+    struct pn_child children[MAX_MOVES];
+    int count = generate_mate_children(solver, game, moves_left, children);
+    //the attacker without a move has failed, the defender without one is mated unless stalemated
+    int lost = count == 0 && (attacking || is_in_check(game, game->turn));
+    if(count == 0 || (!attacking && moves_left == 0))
+    {
+        store_pn(&solver->table, key, lost ? PN_INFINITE : 0, lost ? 0 : PN_INFINITE, amount + 1, 0);
+        return;
+    }
+
+    int next_moves_left = child_moves_left(solver, game, moves_left);
+    uint32_t phi, delta;
+    int best;
+    struct chess_game child;
+    while(1)
+    {
+        uint32_t second = PN_INFINITE, best_phi = 0;
+        phi = PN_INFINITE;
+        delta = 0;
+        best = 0;
+        for(int i = 0; i < count; i++)
+        {
+            uint32_t child_phi, child_delta;
+            look_up_pn(&solver->table, children[i].key, &child_phi, &child_delta);
+            if(child_delta < phi)
+            {
+                second = phi;
+                phi = child_delta;
+                best_phi = child_phi;
+                best = i;
+            }
+            else if(child_delta < second)
+            {
+                second = child_delta;
+            }
+            delta = delta + child_phi < PN_INFINITE ? delta + child_phi : PN_INFINITE;
+        }
+        if(phi >= phi_limit || delta >= delta_limit || solver->nodes >= solver->max_nodes)
+        {
+            break;
+        }
+        uint64_t widened = (uint64_t)second + second / 4 + 1;
+        uint32_t child_delta_limit = widened < phi_limit ? widened : phi_limit;
+        uint32_t child_phi_limit = delta_limit - (delta - best_phi);
+        child = *game;
+        make_move(&child, &children[best].mv);
+        mate_mid(solver, &child, children[best].key, next_moves_left, child_phi_limit, child_delta_limit);
+    }
+    uint64_t spent = amount + (uint64_t)(solver->nodes - start_nodes);
+    store_pn(&solver->table, key, phi, delta, spent < 0xFFFFFFFF ? spent : 0xFFFFFFFF, pack_move(&children[best].mv));
+}
+
+int is_proven_mate(struct mate_solver *solver, uint64_t key)
+{
+    struct pn_entry *entry = probe_pn(&solver->table, key);
+    return entry != NULL && entry->phi == 0;
+}
+
+//the fewest attacker moves that mate in the position, proving each bound in turn, moves_left
+//when none shorter is found
+int shortest_mate(struct mate_solver *solver, struct chess_game *game, int moves_left)
+{
+    for(int moves = 1; moves < moves_left; moves++)
+    {
+        uint64_t key = mate_key(game, moves);
+        if(!is_proven_mate(solver, key))
+        {
+            mate_mid(solver, game, key, moves, PN_INFINITE, PN_INFINITE);
+        }
+        if(is_proven_mate(solver, key))
+        {
+            return moves;
+        }
+    }
+    return moves_left;
+}
+
+//follows the proof from the table: a proven move of the attacker, and the defence that holds out
+//longest. Stops early where an entry was collected.
+int extract_mate_line(struct mate_solver *solver, struct chess_game *game, int moves_left, struct move *line)
+{
+    struct chess_game current = *game;
+    struct chess_game child;
+    struct pn_child children[MAX_MOVES];
+    int length = 0;
+    while(length < 2 * MAX_MATE_MOVES)
+    {
+        int count = generate_mate_children(solver, &current, moves_left, children);
+        int attacking = current.turn == solver->attacker;
+        int best = -1, best_moves = 0;
+        for(int i = 0; i < count && !(attacking && best != -1); i++)
+        {
+            struct pn_entry *entry = probe_pn(&solver->table, children[i].key);
+            if(entry == NULL || (attacking ? entry->delta != 0 : entry->phi != 0))
+            {
+                continue;
+            }
+            int moves = moves_left - attacking;
+            if(!attacking)
+            {
+                child = current;
+                make_move(&child, &children[i].mv);
+                moves = shortest_mate(solver, &child, moves_left);
+            }
+            if(best == -1 || moves > best_moves)
+            {
+                best = i;
+                best_moves = moves;
+            }
+        }
+        if(best == -1)
+        {
+            break;
+        }
+        line[length++] = children[best].mv;
+        moves_left = best_moves;
+        make_move(&current, &children[best].mv);
+    }
+    return length;
+}
+
+//the number of moves of the shortest mate for the side to move up to max_moves, 0 when there
+//is none, -1 when the node limit ran out first. Each bound is proved in turn on the same table,
+//so the longer ones start from what the shorter ones found. The mating line goes to line.
+int solve_mate(struct mate_solver *solver, struct chess_game *game, int max_moves, struct move *line, int *line_length)
+{
+    solver->attacker = game->turn;
+    solver->nodes = 0;
+    *line_length = 0;
+    for(int moves = 1; moves <= max_moves; moves++)
+    {
+        uint64_t key = mate_key(game, moves);
+        mate_mid(solver, game, key, moves, PN_INFINITE, PN_INFINITE);
+        struct pn_entry *entry = probe_pn(&solver->table, key);
+        if(entry == NULL || (entry->phi != 0 && entry->delta != 0))
+        {
+            return -1;
+        }
+        if(entry->phi == 0)
+        {
+            *line_length = extract_mate_line(solver, game, moves, line);
+            return moves;
+        }
+    }
+    return 0;
+}
+
+//usage: mate <fen file> [moves] [table MB] [node limit] [checks|all]
+//finds the shortest mate up to the given number of moves for every position
+int run_mate_solver(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: mate <fen file> [moves] [table MB] [node limit] [checks|all]\n");
+        return 1;
+    }
+    char **fens;
+    int no_of_fens = load_fen_lines(argv[0], &fens);
+    int max_moves = argc > 1 ? atoi(argv[1]) : 3;
+    max_moves = max_moves < 1 ? 1 : max_moves > MAX_MATE_MOVES ? MAX_MATE_MOVES : max_moves;
+    struct mate_solver solver;
+    if(!init_pn_table(&solver.table, argc > 2 ? atoi(argv[2]) : 64))
+    {
+        return 1;
+    }
+    solver.max_nodes = argc > 3 ? atoll(argv[3]) : 10000000;
+    solver.checks_only = argc < 5 || strcmp(argv[4], "all") != 0;
+
+    struct fen fn;
+    struct chess_game game;
+    struct move line[2 * MAX_MATE_MOVES];
+    char text[6];
+    int solved = 0;
+    long long total_nodes = 0;
+    double start = now_seconds();
+    for(int i = 0; i < no_of_fens; i++)
+    {
+        if(!init_fen(&fn, fens[i]))
+        {
+            printf("invalid fen %s\n", fens[i]);
+            continue;
+        }
+        init_chess_game(&game, &fn);
+        clear_pn_table(&solver.table);
+        int line_length;
+        double position_start = now_seconds();
+        int result = solve_mate(&solver, &game, max_moves, line, &line_length);
+        double seconds = now_seconds() - position_start;
+        printf("%d %s nodes %lld nps %.0f table %.1f MB gc %lld", i, result > 0 ? "mate" : result == 0 ? "nomate" : "unknown",
+            solver.nodes, seconds > 0 ? solver.nodes / seconds : 0.0, solver.table.peak * sizeof(struct pn_entry) / 1048576.0,
+            solver.table.collections);
+        if(result > 0)
+        {
+            printf(" in %d pv", result);
+            for(int j = 0; j < line_length; j++)
+            {
+                move_to_string(&line[j], text);
+                printf(" %s", text);
+            }
+            solved++;
+        }
+        printf("\n");
+        total_nodes += solver.nodes;
+    }
+    double seconds = now_seconds() - start;
+    printf("{\"positions\": %d, \"mates\": %d, \"moves\": %d, \"nodes\": %lld, \"seconds\": %.3f, \"table_mb\": %.1f}\n",
+        no_of_fens, solved, max_moves, total_nodes, seconds, solver.table.capacity * sizeof(struct pn_entry) / 1048576.0);
+
+    free_pn_table(&solver.table);
+    free_strings(fens, no_of_fens);
+    free(fens);
+    return 0;
+}
+
+#define NO_OF_EVAL_PARAMS ((int)(sizeof(struct eval_params) / sizeof(int)))
+#define EVAL_PARAM(field) ((int)(&default_eval_params.field - (int*)&default_eval_params))
+#define TUNING_BLOCK 256
+#define TUNING_LANES 8
+#define TUNING_BLOCKS_PER_BATCH 64
+#define TUNING_READ_SIZE (64 << 20)
+#define TUNING_CHUNK_SIZE (1 << 20)
+const int TUNING_COEFFICIENT_BIAS = 64;
+
+//a position is the sparse list of (parameter, white count minus black count) pairs that its
+//evaluation is linear in, each packed as a 9 bit parameter index and a biased 7 bit count
+struct tuning_set
+{
+    uint16_t *features;
+    uint64_t *offsets;
+    uint8_t *results;
+    long long no_of_positions;
+    long long no_of_features;
+    long long capacity;
+    long long feature_capacity;
+};
+
+struct tuning_chunk
+{
+    char *text;
+    int length;
+    struct tuning_set set;
+    long long rejected;
+};
+
+struct tuning_loader
+{
+    struct tuning_chunk *chunks;
+    int no_of_chunks;
+    int next_chunk;
+};
+
+struct tuning_job
+{
+    struct tuning_set *set;
+    float *weights;
+    float *gradients;
+    double *errors;
+    uint32_t *blocks;
+    int first_block;
+    int no_of_blocks;
+    int no_of_threads;
+    int next_thread;
+    float scale;
+};
+
+//white's and black's counts cancel, so a parameter can come back to zero and is tracked by seen
+struct feature_counts
+{
+    int counts[NO_OF_EVAL_PARAMS];
+    uint8_t seen[NO_OF_EVAL_PARAMS];
+    int touched[NO_OF_EVAL_PARAMS];
+    int no_of_touched;
+};
+
+void add_eval_feature(struct feature_counts *fc, int index, int count)
+{
+    if(!fc->seen[index])
+    {
+        fc->seen[index] = 1;
+        fc->touched[fc->no_of_touched++] = index;
+    }
+    fc->counts[index] += count;
+}
+
+//the features of evaluate() from white's point of view, returns how many were written
+int extract_eval_features(struct chess_game *game, uint16_t *features)
+{
+    struct feature_counts fc;
+    memset(fc.counts, 0, sizeof(fc.counts));
+    memset(fc.seen, 0, sizeof(fc.seen));
+    fc.no_of_touched = 0;
+
+    uint64_t pawns[2] = {pawn_bitboard(&game->white_piece_list), pawn_bitboard(&game->black_piece_list)};
+    for(int side = 0; side < 2; side++)
+    {
+        int color = side == 0 ? WHITE : BLACK;
+        int sign = side == 0 ? 1 : -1;
+        struct piece_list *p_list = side == 0 ? &game->white_piece_list : &game->black_piece_list;
+        for(int type = 1; type < 7; type++)
+        {
+            for(int i = 0; i < p_list->no_of_pieces[type]; i++)
+            {
+                int square = piece_square_index(color, p_list->list[type][i]);
+                add_eval_feature(&fc, EVAL_PARAM(piece_value[type]), sign);
+                add_eval_feature(&fc, EVAL_PARAM(piece_square[type][square]), sign);
+            }
+        }
+
+        uint64_t bits = pawns[side];
+        while(bits != 0)
+        {
+            int position = pop_lsb(&bits);
+            int kind = classify_pawn(pawns[side], pawns[1 - side], side, position);
+            if(kind & PAWN_PASSED)
+            {
+                add_eval_feature(&fc, EVAL_PARAM(passed_pawn[side == 0 ? rank(position) : 7 - rank(position)]), sign);
+            }
+            if(kind & PAWN_ISOLATED)
+            {
+                add_eval_feature(&fc, EVAL_PARAM(isolated_pawn), sign);
+            }
+            if(kind & PAWN_BACKWARD)
+            {
+                add_eval_feature(&fc, EVAL_PARAM(backward_pawn), sign);
+            }
+            if(kind & PAWN_DOUBLED)
+            {
+                add_eval_feature(&fc, EVAL_PARAM(doubled_pawn), sign);
+            }
+        }
+
+        if(p_list->no_of_pieces[KING] > 0)
+        {
+            int shield = __builtin_popcountll(pawns[side] & pawn_shield_masks[side][p_list->list[KING][0]]);
+            if(shield > 0)
+            {
+                add_eval_feature(&fc, EVAL_PARAM(pawn_shield), sign * shield);
+            }
+        }
+    }
+
+    int no_of_features = 0;
+    for(int i = 0; i < fc.no_of_touched; i++)
+    {
+        int count = fc.counts[fc.touched[i]];
+        if(count != 0)
+        {
+            features[no_of_features++] = (uint16_t)(fc.touched[i] << 7 | (count + TUNING_COEFFICIENT_BIAS));
+        }
+    }
+    return no_of_features;
+}
+
+//"<fen> <result>" where the result is the last word, 1-0 0-1 1/2-1/2 or 1 0 0.5, optionally quoted,
+//bracketed or followed by ';', returns the result in half points for white or -1
+int parse_labelled_position(char *line, struct chess_game *game)
+{
+    char fields[4][100], result[32], fen_string[420];
+    char *rest = line;
+    for(int i = 0; i < 4; i++)
+    {
+        rest = rest == NULL ? NULL : next_word(rest, fields[i], sizeof(fields[i]));
+    }
+    if(rest == NULL)
+    {
+        return -1;
+    }
+    result[0] = '\0';
+    char word[100];
+    while((rest = next_word(rest, word, sizeof(word))) != NULL)
+    {
+        string_cpy(result, word);
+    }
+
+    char *r = result;
+    while(*r == '[' || *r == '"' || *r == '(')
+    {
+        r++;
+    }
+    r[strcspn(r, "]\";)")] = '\0';
+    int half_points;
+    if(strcmp(r, "1-0") == 0 || strcmp(r, "1") == 0 || strcmp(r, "1.0") == 0)
+    {
+        half_points = 2;
+    }
+    else if(strcmp(r, "0-1") == 0 || strcmp(r, "0") == 0 || strcmp(r, "0.0") == 0)
+    {
+        half_points = 0;
+    }
+    else if(strcmp(r, "1/2-1/2") == 0 || strcmp(r, "0.5") == 0)
+    {
+        half_points = 1;
+    }
+    else
+    {
+        return -1;
+    }
+
+    //the clocks do not matter to the evaluation
+    struct fen fn;
+    snprintf(fen_string, sizeof(fen_string), "%s %s %s %s 0 1", fields[0], fields[1], fields[2], fields[3]);
+    if(!init_fen(&fn, fen_string))
+    {
+        return -1;
+    }
+    init_chess_game(game, &fn);
+    return half_points;
+}
+
+int add_tuning_position(struct tuning_set *set, uint16_t *features, int no_of_features, int result)
+{
+    if(set->no_of_positions == set->capacity)
+    {
+        long long capacity = set->capacity == 0 ? 4096 : set->capacity * 2;
+        uint64_t *offsets = (uint64_t*)realloc(set->offsets, sizeof(uint64_t) * (capacity + 1));
+        set->offsets = offsets != NULL ? offsets : set->offsets;
+        uint8_t *results = (uint8_t*)realloc(set->results, capacity);
+        set->results = results != NULL ? results : set->results;
+        if(offsets == NULL || results == NULL)
+        {
+            return 0;
+        }
+        set->capacity = capacity;
+        set->offsets[0] = 0;
+    }
+    if(set->no_of_features + no_of_features > set->feature_capacity)
+    {
+        long long capacity = set->feature_capacity == 0 ? 65536 : set->feature_capacity * 2;
+        uint16_t *grown = (uint16_t*)realloc(set->features, sizeof(uint16_t) * capacity);
+        if(grown == NULL)
+        {
+            return 0;
+        }
+        set->features = grown;
+        set->feature_capacity = capacity;
+    }
+    memcpy(set->features + set->no_of_features, features, sizeof(uint16_t) * no_of_features);
+    set->no_of_features += no_of_features;
+    set->results[set->no_of_positions++] = (uint8_t)result;
+    set->offsets[set->no_of_positions] = set->no_of_features;
+    return 1;
+}
+
+int append_tuning_set(struct tuning_set *set, struct tuning_set *part)
+{
+    for(long long i = 0; i < part->no_of_positions; i++)
+    {
+        uint64_t start = part->offsets[i];
+        if(!add_tuning_position(set, part->features + start, (int)(part->offsets[i + 1] - start), part->results[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void free_tuning_set(struct tuning_set *set)
+{
+    free(set->features);
+    free(set->offsets);
+    free(set->results);
+    memset(set, 0, sizeof(struct tuning_set));
+}
+
+void *tuning_load_worker(void *arg)
+{
+    struct tuning_loader *loader = (struct tuning_loader*)arg;
+    struct chess_game game;
+    uint16_t features[NO_OF_EVAL_PARAMS];
+    while(1)
+    {
+        int index = __atomic_fetch_add(&loader->next_chunk, 1, __ATOMIC_RELAXED);
+        if(index >= loader->no_of_chunks)
+        {
+            break;
+        }
+        struct tuning_chunk *chunk = &loader->chunks[index];
+        char *line = chunk->text, *end = chunk->text + chunk->length;
+        while(line < end)
+        {
+            char *newline = (char*)memchr(line, '\n', end - line);
+            newline = newline == NULL ? end : newline;
+            *newline = '\0';
+            line[strcspn(line, "\r")] = '\0';
+            if(line[0] != '\0' && line[0] != '#')
+            {
+                int result = parse_labelled_position(line, &game);
+                if(result < 0)
+                {
+                    chunk->rejected++;
+                }
+                else if(!add_tuning_position(&chunk->set, features, extract_eval_features(&game, features), result))
+                {
+                    chunk->rejected++;
+                }
+            }
+            line = newline + 1;
+        }
+    }
+    return NULL;
+}
+
+//reads the file a window at a time, the lines of a window are parsed by all threads and the
+//positions are appended in file order
+int load_tuning_set(char *path, struct tuning_set *set, int no_of_threads, long long *rejected)
+{
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    char *buffer = (char*)malloc(TUNING_READ_SIZE + 1);
+    int max_chunks = TUNING_READ_SIZE / TUNING_CHUNK_SIZE + 1;
+    struct tuning_chunk *chunks = (struct tuning_chunk*)calloc(max_chunks, sizeof(struct tuning_chunk));
+    if(buffer == NULL || chunks == NULL)
+    {
+        printf("memory not allocated\n");
+        fclose(fp);
+        free(buffer);
+        free(chunks);
+        return 0;
+    }
+
+    int ok = 1, carried = 0;
+    *rejected = 0;
+    memset(set, 0, sizeof(struct tuning_set));
+    while(ok)
+    {
+        int length = carried + (int)fread(buffer + carried, 1, TUNING_READ_SIZE - carried, fp);
+        if(length == 0)
+        {
+            break;
+        }
+        //a partial last line waits for the next window unless the file has ended
+        int used = length;
+        if(length == TUNING_READ_SIZE)
+        {
+            while(used > 0 && buffer[used - 1] != '\n')
+            {
+                used--;
+            }
+            if(used == 0)
+            {
+                printf("line too long in %s\n", path);
+                ok = 0;
+                break;
+            }
+        }
+
+        struct tuning_loader loader = {chunks, 0, 0};
+        for(int start = 0; start < used; )
+        {
+            int stop = start + TUNING_CHUNK_SIZE < used ? start + TUNING_CHUNK_SIZE : used;
+            while(stop < used && buffer[stop - 1] != '\n')
+            {
+                stop++;
+            }
+            chunks[loader.no_of_chunks].text = buffer + start;
+            chunks[loader.no_of_chunks++].length = stop - start;
+            start = stop;
+        }
+        ok = run_worker_threads(no_of_threads, tuning_load_worker, &loader);
+        for(int i = 0; i < loader.no_of_chunks; i++)
+        {
+            ok = ok && append_tuning_set(set, &chunks[i].set);
+            *rejected += chunks[i].rejected;
+            free_tuning_set(&chunks[i].set);
+            chunks[i].rejected = 0;
+        }
+        carried = length - used;
+        memmove(buffer, buffer + used, carried);
+    }
+    if(!ok)
+    {
+        printf("memory not allocated\n");
+    }
+    fclose(fp);
+    free(buffer);
+    free(chunks);
+    return ok;
+}
+
+//e^x without libm, 2^(x log2 e) split into an exponent and a polynomial for the fraction
+static inline float fast_exp(float x)
+{
+    x = x < -80.0f ? -80.0f : x > 80.0f ? 80.0f : x;
+    float t = x * 1.44269504f;
+    int whole = (int)t - (t < 0);
+    float f = t - whole;
+    float p = 1.0f + f * (0.693147f + f * (0.240227f + f * (0.0555041f + f * (0.00961813f + f * 0.00133336f))));
+    union { uint32_t i; float f; } power = {(uint32_t)(whole + 127) << 23};
+    return p * power.f;
+}
+
+typedef float tuning_lanes __attribute__((vector_size(4 * TUNING_LANES)));
+typedef int32_t tuning_ints __attribute__((vector_size(4 * TUNING_LANES)));
+
+//fast_exp on every lane in place. Comparisons give lane masks, so the clamps are selects, and
+//t + 128 is positive after them, so the truncating conversion floors it.
+static inline void fast_exp_lanes(tuning_lanes *x)
+{
+    tuning_lanes limit = (tuning_lanes){0} + 80.0f;
+    tuning_ints low = *x < -limit, high = *x > limit;
+    tuning_ints clamped = ((tuning_ints)*x & ~(low | high)) | ((tuning_ints)-limit & low) | ((tuning_ints)limit & high);
+    tuning_lanes t = (tuning_lanes)clamped * 1.44269504f;
+    tuning_ints whole = __builtin_convertvector(t + 128.0f, tuning_ints) - 128;
+    tuning_lanes f = t - __builtin_convertvector(whole, tuning_lanes);
+    tuning_lanes p = 1.0f + f * (0.693147f + f * (0.240227f + f * (0.0555041f + f * (0.00961813f + f * 0.00133336f))));
+    *x = p * (tuning_lanes)((whole + 127) << 23);
+}
+
+static inline float tuning_score(uint16_t *features, int no_of_features, float *weights)
+{
+    float score = 0;
+    for(int i = 0; i < no_of_features; i++)
+    {
+        score += weights[features[i] >> 7] * ((features[i] & 127) - TUNING_COEFFICIENT_BIAS);
+    }
+    return score;
+}
+
+//squared error of the block, with the gradient added to gradients when it is not NULL
+double tuning_block_error(struct tuning_set *set, long long first, int count, float *weights, float scale, float *gradients)
+{
+    //the tail of a partial block is padded to whole lanes, its errors are never summed
+    float scores[TUNING_BLOCK], targets[TUNING_BLOCK], errors[TUNING_BLOCK], slopes[TUNING_BLOCK];
+    int padded = (count + TUNING_LANES - 1) / TUNING_LANES * TUNING_LANES;
+    for(int i = 0; i < padded; i++)
+    {
+        uint64_t start = i < count ? set->offsets[first + i] : 0;
+        scores[i] = i < count ? tuning_score(set->features + start, (int)(set->offsets[first + i + 1] - start), weights) : 0;
+        targets[i] = i < count ? set->results[first + i] * 0.5f : 0.5f;
+    }
+    for(int i = 0; i < padded; i += TUNING_LANES)
+    {
+        tuning_lanes score, target, predicted;
+        memcpy(&score, &scores[i], sizeof(score));
+        memcpy(&target, &targets[i], sizeof(target));
+        predicted = score * -scale;
+        fast_exp_lanes(&predicted);
+        predicted = 1.0f / (1.0f + predicted);
+        tuning_lanes difference = predicted - target;
+        tuning_lanes error = difference * difference, slope = 2.0f * difference * predicted * (1.0f - predicted) * scale;
+        memcpy(&errors[i], &error, sizeof(error));
+        memcpy(&slopes[i], &slope, sizeof(slope));
+    }
+    double error = 0;
+    for(int i = 0; i < count; i++)
+    {
+        error += errors[i];
+    }
+    if(gradients != NULL)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            uint64_t start = set->offsets[first + i], stop = set->offsets[first + i + 1];
+            for(uint64_t j = start; j < stop; j++)
+            {
+                uint16_t feature = set->features[j];
+                gradients[feature >> 7] += slopes[i] * ((feature & 127) - TUNING_COEFFICIENT_BIAS);
+            }
+        }
+    }
+    return error;
+}
+
+void *tuning_worker(void *arg)
+{
+    struct tuning_job *job = (struct tuning_job*)arg;
+    int id = __atomic_fetch_add(&job->next_thread, 1, __ATOMIC_RELAXED);
+    float *gradients = job->gradients == NULL ? NULL : job->gradients + (size_t)id * NO_OF_EVAL_PARAMS;
+    double error = 0;
+    if(gradients != NULL)
+    {
+        memset(gradients, 0, sizeof(float) * NO_OF_EVAL_PARAMS);
+    }
+    for(int b = job->first_block + id; b < job->first_block + job->no_of_blocks; b += job->no_of_threads)
+    {
+        long long first = (long long)(job->blocks == NULL ? (uint32_t)b : job->blocks[b]) * TUNING_BLOCK;
+        long long count = job->set->no_of_positions - first;
+        error += tuning_block_error(job->set, first, count < TUNING_BLOCK ? (int)count : TUNING_BLOCK, job->weights, job->scale, gradients);
+    }
+    job->errors[id] = error;
+    return NULL;
+}
+
+int tuning_block_count(struct tuning_set *set)
+{
+    return (int)((set->no_of_positions + TUNING_BLOCK - 1) / TUNING_BLOCK);
+}
+
+//mean squared error over the whole set
+double tuning_error(struct tuning_job *job, float scale)
+{
+    job->scale = scale;
+    job->gradients = NULL;
+    job->blocks = NULL;
+    job->first_block = 0;
+    job->no_of_blocks = tuning_block_count(job->set);
+    job->next_thread = 0;
+    if(!run_worker_threads(job->no_of_threads, tuning_worker, job))
+    {
+        return 1;
+    }
+    double error = 0;
+    for(int i = 0; i < job->no_of_threads; i++)
+    {
+        error += job->errors[i];
+    }
+    return error / job->set->no_of_positions;
+}
+
+//the sigmoid scale that fits the current evaluation best, the error is unimodal in it
+float find_tuning_scale(struct tuning_job *job)
+{
+    float low = 0.0f, high = 0.05f;
+    for(int i = 0; i < 30; i++)
+    {
+        float a = low + (high - low) / 3, b = high - (high - low) / 3;
+        if(tuning_error(job, a) < tuning_error(job, b))
+        {
+            high = b;
+        }
+        else
+        {
+            low = a;
+        }
+    }
+    return (low + high) / 2;
+}
+
+int write_eval_params(char *path, float *weights)
+{
+    FILE *fp = fopen(path, "w");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    int values[NO_OF_EVAL_PARAMS];
+    for(int i = 0; i < NO_OF_EVAL_PARAMS; i++)
+    {
+        values[i] = (int)(weights[i] < 0 ? weights[i] - 0.5f : weights[i] + 0.5f);
+    }
+    struct eval_params *params = (struct eval_params*)values;
+
+    fprintf(fp, "struct eval_params default_eval_params =\n{\n    {");
+    for(int type = 0; type < 7; type++)
+    {
+        fprintf(fp, "%d%s", params->piece_value[type], type < 6 ? ", " : "},\n    {\n        {0},\n");
+    }
+    for(int type = 1; type < 7; type++)
+    {
+        fprintf(fp, "        {\n");
+        for(int square = 0; square < 64; square++)
+        {
+            fprintf(fp, "%s%3d%s", square % 8 == 0 ? "            " : "", params->piece_square[type][square],
+                square == 63 ? "\n" : square % 8 == 7 ? ",\n" : ",");
+        }
+        fprintf(fp, "        }%s\n", type < 6 ? "," : "");
+    }
+    fprintf(fp, "    },\n    {");
+    for(int r = 0; r < 8; r++)
+    {
+        fprintf(fp, "%d%s", params->passed_pawn[r], r < 7 ? ", " : "},\n");
+    }
+    fprintf(fp, "    %d,\n    %d,\n    %d,\n    %d\n};\n", params->isolated_pawn, params->doubled_pawn, params->backward_pawn, params->pawn_shield);
+    return fclose(fp) == 0;
+}
+
+//usage: tune <labelled file> <params out> [epochs] [threads] [learning rate]
+//each line is a fen followed by the game result, the material, piece square and pawn terms are
+//fitted to the results with adam on mini batches and written out as a default_eval_params initializer
+int run_tuner(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printf("usage: tune <labelled file> <params out> [epochs] [threads] [learning rate]\n");
+        return 1;
+    }
+    init_tables();
+    int epochs = argc > 2 ? atoi(argv[2]) : 20;
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int no_of_threads = argc > 3 ? atoi(argv[3]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    float learning_rate = argc > 4 ? atof(argv[4]) : 1.0f;
+
+    struct tuning_set set;
+    long long rejected;
+    double start = now_seconds();
+    if(!load_tuning_set(argv[0], &set, no_of_threads, &rejected))
+    {
+        return 1;
+    }
+    if(set.no_of_positions == 0)
+    {
+        printf("no positions in %s\n", argv[0]);
+        return 1;
+    }
+    printf("loaded %lld positions, %.1f features each, %lld rejected, %.2f s\n", set.no_of_positions,
+        (double)set.no_of_features / set.no_of_positions, rejected, now_seconds() - start);
+
+    int no_of_blocks = tuning_block_count(&set);
+    float *weights = (float*)malloc(sizeof(float) * NO_OF_EVAL_PARAMS * 3);
+    float *gradients = (float*)malloc(sizeof(float) * NO_OF_EVAL_PARAMS * no_of_threads);
+    double *errors = (double*)malloc(sizeof(double) * no_of_threads);
+    uint32_t *blocks = (uint32_t*)malloc(sizeof(uint32_t) * no_of_blocks);
+    if(weights == NULL || gradients == NULL || errors == NULL || blocks == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    float *first_moment = weights + NO_OF_EVAL_PARAMS, *second_moment = weights + 2 * NO_OF_EVAL_PARAMS;
+    for(int i = 0; i < NO_OF_EVAL_PARAMS; i++)
+    {
+        weights[i] = ((int*)&default_eval_params)[i];
+        first_moment[i] = second_moment[i] = 0;
+    }
+    for(int i = 0; i < no_of_blocks; i++)
+    {
+        blocks[i] = i;
+    }
+
+    struct tuning_job job = {&set, weights, NULL, errors, NULL, 0, 0, no_of_threads, 0, 0};
+    float scale = find_tuning_scale(&job);
+    printf("scale %.6f error %.6f\n", scale, tuning_error(&job, scale));
+
+    const float beta1 = 0.9f, beta2 = 0.999f;
+    float beta1_power = 1, beta2_power = 1;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for(int epoch = 1; epoch <= epochs; epoch++)
+    {
+        double epoch_start = now_seconds(), epoch_error = 0;
+        for(int i = no_of_blocks - 1; i > 0; i--)
+        {
+            int j = (int)(random_u64(&seed) % (uint64_t)(i + 1));
+            uint32_t block = blocks[i];
+            blocks[i] = blocks[j];
+            blocks[j] = block;
+        }
+        for(int first = 0; first < no_of_blocks; first += TUNING_BLOCKS_PER_BATCH)
+        {
+            job.gradients = gradients;
+            job.blocks = blocks;
+            job.first_block = first;
+            job.no_of_blocks = no_of_blocks - first < TUNING_BLOCKS_PER_BATCH ? no_of_blocks - first : TUNING_BLOCKS_PER_BATCH;
+            job.next_thread = 0;
+            if(!run_worker_threads(no_of_threads, tuning_worker, &job))
+            {
+                return 1;
+            }
+            for(int t = 1; t < no_of_threads; t++)
+            {
+                for(int i = 0; i < NO_OF_EVAL_PARAMS; i++)
+                {
+                    gradients[i] += gradients[(size_t)t * NO_OF_EVAL_PARAMS + i];
+                }
+            }
+            for(int t = 0; t < no_of_threads; t++)
+            {
+                epoch_error += errors[t];
+            }
+
+            beta1_power *= beta1;
+            beta2_power *= beta2;
+            //the shuffled partial block can be in any batch
+            long long batch_size = 0;
+            for(int b = first; b < first + job.no_of_blocks; b++)
+            {
+                long long left = set.no_of_positions - (long long)blocks[b] * TUNING_BLOCK;
+                batch_size += left < TUNING_BLOCK ? left : TUNING_BLOCK;
+            }
+            for(int i = 0; i < NO_OF_EVAL_PARAMS; i++)
+            {
+                float gradient = gradients[i] / batch_size;
+                first_moment[i] = beta1 * first_moment[i] + (1 - beta1) * gradient;
+                second_moment[i] = beta2 * second_moment[i] + (1 - beta2) * gradient * gradient;
+                weights[i] -= learning_rate * (first_moment[i] / (1 - beta1_power)) / (square_root(second_moment[i] / (1 - beta2_power)) + 1e-8f);
+            }
+        }
+        printf("epoch %d error %.6f %.2f s\n", epoch, epoch_error / set.no_of_positions, now_seconds() - epoch_start);
+        fflush(stdout);
+    }
+    printf("final error %.6f\n", tuning_error(&job, scale));
+
+    int ok = write_eval_params(argv[1], weights);
+    free(weights);
+    free(gradients);
+    free(errors);
+    free(blocks);
+    free_tuning_set(&set);
+    return ok ? 0 : 1;
+}
+
+//Self-play matches between two parameter sets. Every game slot is a thread with its own pair of
+//engines, the openings are played twice with colours swapped and the result is tested with a
+//sequential probability ratio test after every game.
+#define MATCH_MAX_PLIES 600
+const int MATCH_RESIGN_SCORE = 1000, MATCH_RESIGN_PLIES = 8;
+
+struct match_engine
+{
+    struct search_shared shared;
+    struct search_thread thread;
+    struct transposition_table table;
+};
+
+struct match
+{
+    char **openings;
+    int no_of_openings;
+    struct eval_params *params[2];
+    int no_of_games;
+    int next_game;
+    int stopped;
+    long long nodes;
+    int base_ms;
+    int increment_ms;
+    int hash_mb;
+    float elo0;
+    float elo1;
+    FILE *log;
+    pthread_mutex_t lock;
+    int wins;
+    int draws;
+    int losses;
+    int played;
+    double start;
+};
+
+//reads "{a, b, ...}" into values, missing trailing values are zero as in a c initializer
+char* read_int_group(char *text, int *values, int size)
+{
+    text = text == NULL ? NULL : strchr(text, '{');
+    if(text == NULL)
+    {
+        return NULL;
+    }
+    text++;
+    int count = 0;
+    while(1)
+    {
+        text += strspn(text, " \t\r\n,");
+        if(*text == '}')
+        {
+            break;
+        }
+        char *end;
+        long value = strtol(text, &end, 10);
+        if(end == text || count == size)
+        {
+            return NULL;
+        }
+        values[count++] = (int)value;
+        text = end;
+    }
+    while(count < size)
+    {
+        values[count++] = 0;
+    }
+    return text + 1;
+}
+
+//a default_eval_params initializer as written by tune
+int load_eval_params(char *path, struct eval_params *params)
+{
+    char text[16384];
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 0;
+    }
+    text[fread(text, 1, sizeof(text) - 1, fp)] = '\0';
+    fclose(fp);
+
+    char *cursor = strchr(text, '{');
+    cursor = read_int_group(cursor == NULL ? NULL : cursor + 1, params->piece_value, 7);
+    cursor = cursor == NULL ? NULL : strchr(cursor, '{');
+    for(int type = 0; type < 7 && cursor != NULL; type++)
+    {
+        cursor = read_int_group(cursor + (type == 0), params->piece_square[type], 64);
+    }
+    cursor = cursor == NULL ? NULL : strchr(cursor, '}');
+    cursor = read_int_group(cursor, params->passed_pawn, 8);
+    int *scalars[4] = {&params->isolated_pawn, &params->doubled_pawn, &params->backward_pawn, &params->pawn_shield};
+    for(int i = 0; i < 4 && cursor != NULL; i++)
+    {
+        cursor += strspn(cursor, " \t\r\n,");
+        char *end;
+        *scalars[i] = (int)strtol(cursor, &end, 10);
+        cursor = end == cursor ? NULL : end;
+    }
+    if(cursor == NULL)
+    {
+        printf("%s is not an eval_params initializer\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+//bare kings, or a single minor piece against a bare king
+int is_insufficient_material(struct chess_game *game)
+{
+    struct piece_list *lists[2] = {&game->white_piece_list, &game->black_piece_list};
+    int minors = 0;
+    for(int side = 0; side < 2; side++)
+    {
+        struct piece_list *p_list = lists[side];
+        if(p_list->no_of_pieces[QUEEN] + p_list->no_of_pieces[ROOK] + p_list->no_of_pieces[PAWN] > 0)
+        {
+            return 0;
+        }
+        minors += p_list->no_of_pieces[BISHOP] + p_list->no_of_pieces[KNIGHT];
+    }
+    return minors <= 1;
+}
+
+double natural_log(double x)
+{
+    union { double d; uint64_t i; } bits = {x};
+    int exponent = (int)((bits.i >> 52) & 0x7FF) - 1023;
+    bits.i = (bits.i & 0xFFFFFFFFFFFFFULL) | (1023ULL << 52);
+    double t = (bits.d - 1) / (bits.d + 1), t2 = t * t, term = t, sum = 0;
+    for(int k = 1; k < 40; k += 2)
+    {
+        sum += term / k;
+        term *= t2;
+    }
+    return exponent * 0.69314718055994531 + 2 * sum;
+}
+
+float elo_to_score(float elo)
+{
+    return 1.0f / (1.0f + fast_exp(-elo * 0.0057564627f));
+}
+
+float score_to_elo(double score)
+{
+    score = score < 1e-6 ? 1e-6 : score > 1 - 1e-6 ? 1 - 1e-6 : score;
+    return -173.71779f * natural_log(1 / score - 1);
+}
+
+//log likelihood ratio of elo1 against elo0 for the games so far, normal approximation of the trinomial
+double match_llr(int wins, int draws, int losses, float elo0, float elo1)
+{
+    int n = wins + draws + losses;
+    if(n == 0 || wins + losses == 0)
+    {
+        return 0;
+    }
+    double score = (wins + 0.5 * draws) / n;
+    double variance = (wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score) + losses * score * score) / n;
+    double s0 = elo_to_score(elo0), s1 = elo_to_score(elo1);
+    return variance <= 0 ? 0 : n * (s1 - s0) * (2 * score - s0 - s1) / (2 * variance);
+}
+
+int init_match_engine(struct match_engine *engine, struct eval_params *params, int hash_mb)
+{
+    memset(engine, 0, sizeof(struct match_engine));
+    if(!init_transposition_table(&engine->table, hash_mb))
+    {
+        return 0;
+    }
+    engine->shared.table = &engine->table;
+    engine->shared.params = params;
+    engine->shared.multi_pv = 1;
+    return 1;
+}
+
+void free_match_engine(struct match_engine *engine)
+{
+    free_pawn_table(&engine->thread.pawns);
+    free_transposition_table(&engine->table);
+}
+
+//plays one game and returns the result for white in half points, reason says how it ended
+int play_match_game(struct match *match, struct match_engine *engines[2], char *opening, char **reason, int *plies)
+{
+    struct fen fn;
+    struct chess_game game;
+    struct key_history history;
+    if(!init_fen(&fn, opening))
+    {
+        *reason = "invalid";
+        return -1;
+    }
+    init_chess_game(&game, &fn);
+    attach_key_history(&game, &history);
+    for(int side = 0; side < 2; side++)
+    {
+        clear_transposition_table(&engines[side]->table);
+    }
+
+    int clock[2] = {match->base_ms, match->base_ms};
+    int winning[2] = {0, 0};
+    for(*plies = 0; ; (*plies)++)
+    {
+        int us = color_index(game.turn);
+        if(count_legal_moves(&game) == 0)
+        {
+            *reason = is_in_check(&game, game.turn) ? "mate" : "stalemate";
+            return *reason[0] == 'm' ? (us == 0 ? 0 : 2) : 1;
+        }
+        if(is_fifty_move_draw(&game) || count_repetitions(&game) >= 2 || is_insufficient_material(&game) || *plies >= MATCH_MAX_PLIES)
+        {
+            *reason = is_fifty_move_draw(&game) ? "fifty" : count_repetitions(&game) >= 2 ? "repetition" :
+                *plies >= MATCH_MAX_PLIES ? "length" : "material";
+            return 1;
+        }
+
+        struct match_engine *engine = engines[us];
+        struct search_shared *shared = &engine->shared;
+        shared->root = game;
+        shared->history = history;
+        memset(&shared->limits, 0, sizeof(shared->limits));
+        shared->limits.nodes = match->nodes;
+        shared->limits.time[us] = match->base_ms > 0 ? (clock[us] > 1 ? clock[us] : 1) : 0;
+        shared->limits.increment[us] = match->increment_ms;
+        if(!prepare_search(shared, &engine->thread, 1))
+        {
+            *reason = "memory";
+            return -1;
+        }
+        double start = now_seconds();
+        struct search_thread *best = run_search(shared);
+        if(match->base_ms > 0)
+        {
+            clock[us] -= (int)((now_seconds() - start) * 1000);
+            if(clock[us] < 0)
+            {
+                *reason = "time";
+                return us == 0 ? 0 : 2;
+            }
+            clock[us] += match->increment_ms;
+        }
+        if(best->no_of_best_lines == 0 || best->best_lines[0].pv_length == 0)
+        {
+            //stopped before the first iteration finished, as in uci any legal move is played
+            struct queue *q = generate_legal_moves(&game);
+            struct move *mv = q == NULL ? NULL : dequeue(q);
+            if(mv == NULL)
+            {
+                *reason = "memory";
+                return -1;
+            }
+            make_move(&game, mv);
+            free(mv);
+            free_queue(q);
+            winning[us] = 0;
+            continue;
+        }
+
+        //both engines have to agree on the outcome for a number of moves in a row
+        int score = best->best_lines[0].score;
+        winning[us] = score >= MATCH_RESIGN_SCORE ? (winning[us] > 0 ? winning[us] + 1 : 1) :
+            score <= -MATCH_RESIGN_SCORE ? (winning[us] < 0 ? winning[us] - 1 : -1) : 0;
+        if(winning[us] >= MATCH_RESIGN_PLIES / 2 && winning[1 - us] <= -MATCH_RESIGN_PLIES / 2)
+        {
+            *reason = "adjudicated";
+            return us == 0 ? 2 : 0;
+        }
+        if(winning[us] <= -MATCH_RESIGN_PLIES / 2 && winning[1 - us] >= MATCH_RESIGN_PLIES / 2)
+        {
+            *reason = "adjudicated";
+            return us == 0 ? 0 : 2;
+        }
+        make_move(&game, &best->best_lines[0].pv[0]);
+    }
+}
+
+void print_match_status(struct match *match, double llr, double lower, double upper)
+{
+    int n = match->wins + match->draws + match->losses;
+    double score = (match->wins + 0.5 * match->draws) / n;
+    double variance = (match->wins * (1 - score) * (1 - score) + match->draws * (0.5 - score) * (0.5 - score) +
+        match->losses * score * score) / n;
+    double margin = 1.96 * square_root(variance / n);
+    printf("games %d +%d =%d -%d elo %.1f [%.1f, %.1f] llr %.2f (%.2f, %.2f) %.1f games/s\n", n, match->wins, match->draws,
+        match->losses, score_to_elo(score), score_to_elo(score - margin), score_to_elo(score + margin), llr, lower, upper,
+        n / (now_seconds() - match->start));
+    fflush(stdout);
+}
+
+void* match_worker(void *arg)
+{
+    struct match *match = (struct match*)arg;
+    struct match_engine *pair = (struct match_engine*)malloc(sizeof(struct match_engine) * 2);
+    if(pair == NULL || !init_match_engine(&pair[0], match->params[0], match->hash_mb) || !init_match_engine(&pair[1], match->params[1], match->hash_mb))
+    {
+        printf("memory not allocated\n");
+        __atomic_store_n(&match->stopped, 1, __ATOMIC_RELAXED);
+        free(pair);
+        return NULL;
+    }
+    double lower = natural_log(0.05 / 0.95), upper = natural_log(0.95 / 0.05);
+    while(!__atomic_load_n(&match->stopped, __ATOMIC_RELAXED))
+    {
+        int index = __atomic_fetch_add(&match->next_game, 1, __ATOMIC_RELAXED);
+        if(index >= match->no_of_games)
+        {
+            break;
+        }
+        //even games give the first parameter set white
+        int a_is_white = (index & 1) == 0;
+        struct match_engine *engines[2] = {a_is_white ? &pair[0] : &pair[1], a_is_white ? &pair[1] : &pair[0]};
+        char *reason;
+        int plies;
+        int opening = (index / 2) % match->no_of_openings;
+        int result = play_match_game(match, engines, match->openings[opening], &reason, &plies);
+        if(result < 0)
+        {
+            printf("game %d: %s opening %d\n", index, reason, opening);
+            continue;
+        }
+        int for_a = a_is_white ? result : 2 - result;
+
+        pthread_mutex_lock(&match->lock);
+        match->wins += for_a == 2;
+        match->draws += for_a == 1;
+        match->losses += for_a == 0;
+        match->played++;
+        if(match->log != NULL)
+        {
+            fprintf(match->log, "%d %d %s %s %s %d\n", index, opening, a_is_white ? "ab" : "ba",
+                result == 2 ? "1-0" : result == 0 ? "0-1" : "1/2-1/2", reason, plies);
+        }
+        double llr = match_llr(match->wins, match->draws, match->losses, match->elo0, match->elo1);
+        if(llr <= lower || llr >= upper)
+        {
+            __atomic_store_n(&match->stopped, 1, __ATOMIC_RELAXED);
+        }
+        if(match->played % 20 == 0 && match->played < match->no_of_games && !match->stopped)
+        {
+            print_match_status(match, llr, lower, upper);
+        }
+        pthread_mutex_unlock(&match->lock);
+    }
+    free_match_engine(&pair[0]);
+    free_match_engine(&pair[1]);
+    free(pair);
+    return NULL;
+}
+
+//usage: match <opening fens> <params a|default> <params b|default> [games] [nodes=N | tc=base+inc] [slots] [log file] [elo0] [elo1] [hash MB]
+//plays a against b from every opening with both colours, base and increment are in seconds. The
+//parameter files are default_eval_params initializers as written by tune.
+int run_match(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        printf("usage: match <opening fens> <params a|default> <params b|default> [games] [nodes=N | tc=base+inc] [slots] [log file] [elo0] [elo1] [hash MB]\n");
+        return 1;
+    }
+    init_tables();
+    struct match match;
+    struct eval_params params[2];
+    memset(&match, 0, sizeof(match));
+    match.no_of_openings = load_fen_lines(argv[0], &match.openings);
+    if(match.no_of_openings == 0)
+    {
+        return 1;
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        params[i] = default_eval_params;
+        if(strcmp(argv[1 + i], "default") != 0 && !load_eval_params(argv[1 + i], &params[i]))
+        {
+            return 1;
+        }
+        match.params[i] = &params[i];
+    }
+    match.no_of_games = argc > 3 ? atoi(argv[3]) : 2 * match.no_of_openings;
+    match.nodes = 20000;
+    if(argc > 4 && strncmp(argv[4], "nodes=", 6) == 0)
+    {
+        match.nodes = atoll(argv[4] + 6);
+    }
+    else if(argc > 4 && strncmp(argv[4], "tc=", 3) == 0)
+    {
+        char *increment = strchr(argv[4], '+');
+        match.nodes = 0;
+        match.base_ms = (int)(atof(argv[4] + 3) * 1000);
+        match.increment_ms = increment == NULL ? 0 : (int)(atof(increment + 1) * 1000);
+    }
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int no_of_slots = argc > 5 ? atoi(argv[5]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    no_of_slots = no_of_slots < 1 ? 1 : no_of_slots > 256 ? 256 : no_of_slots;
+    if(argc > 6 && strcmp(argv[6], "-") != 0 && (match.log = fopen(argv[6], "w")) == NULL)
+    {
+        printf("cannot open %s\n", argv[6]);
+        return 1;
+    }
+    match.elo0 = argc > 7 ? atof(argv[7]) : 0;
+    match.elo1 = argc > 8 ? atof(argv[8]) : 5;
+    match.hash_mb = argc > 9 ? atoi(argv[9]) : 16;
+    pthread_mutex_init(&match.lock, NULL);
+
+    match.start = now_seconds();
+    int ok = run_worker_threads(no_of_slots, match_worker, &match);
+    double llr = match_llr(match.wins, match.draws, match.losses, match.elo0, match.elo1);
+    double lower = natural_log(0.05 / 0.95), upper = natural_log(0.95 / 0.05);
+    if(match.played > 0)
+    {
+        print_match_status(&match, llr, lower, upper);
+    }
+    printf("{\"games\": %d, \"wins\": %d, \"draws\": %d, \"losses\": %d, \"llr\": %.3f, \"sprt\": \"%s\", \"seconds\": %.3f}\n",
+        match.played, match.wins, match.draws, match.losses, llr, llr >= upper ? "H1" : llr <= lower ? "H0" : "inconclusive",
+        now_seconds() - match.start);
+
+    if(match.log != NULL)
+    {
+        fclose(match.log);
+    }
+    pthread_mutex_destroy(&match.lock);
+    free_strings(match.openings, match.no_of_openings);
+    free(match.openings);
+    return ok ? 0 : 1;
+}
+
+//Training data from self-play: every thread plays fixed node games from random openings and keeps
+//the quiet positions it passes through. Records are 32 bytes and a thread writes them a chunk
+//at a time, shuffled, to a file opened for appending, so chunks from different threads never
+//interleave, a reader can stream records as they land and a trainer can shuffle by picking chunks.
+#define DATAGEN_CHUNK_RECORDS 2048
+#define DATAGEN_MAX_PLIES 400
+const int DATAGEN_RESIGN_SCORE = 2000, DATAGEN_RESIGN_PLIES = 4, DATAGEN_OPENING_SCORE = 400, DATAGEN_OPENING_TRIES = 100;
+const char DATAGEN_FILE_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'D', 'G', '1'};
+
+//score is from the side to move's point of view, move is packed as in the transposition table
+//and result is the game's result for white in half points
+struct datagen_record
+{
+    struct packed_position position;
+    int16_t score;
+    uint16_t move;
+    uint16_t ply;
+    uint8_t result;
+    uint8_t reserved;
+};
+
+struct datagen_job
+{
+    int fd;
+    char **openings;
+    int no_of_openings;
+    long long nodes;
+    int random_plies;
+    int no_of_games;
+    int next_game;
+    int next_thread;
+    uint64_t seed;
+    long long positions;
+    long long skipped;
+    long long games;
+    int failed;
+};
+
+struct datagen_worker
+{
+    struct datagen_job *job;
+    struct match_engine engine;
+    struct datagen_record *chunk;
+    int fill;
+    struct datagen_record game_records[DATAGEN_MAX_PLIES];
+    uint64_t seed;
+};
+
+void flush_datagen_chunk(struct datagen_worker *worker)
+{
+    for(int i = worker->fill - 1; i > 0; i--)
+    {
+        int j = (int)(random_u64(&worker->seed) % (uint64_t)(i + 1));
+        struct datagen_record record = worker->chunk[i];
+        worker->chunk[i] = worker->chunk[j];
+        worker->chunk[j] = record;
+    }
+    if(worker->fill > 0 && !write_all(worker->job->fd, worker->chunk, sizeof(struct datagen_record) * worker->fill))
+    {
+        printf("cannot write training data\n");
+        worker->job->failed = 1;
+    }
+    worker->fill = 0;
+}
+
+//plays random legal moves from the opening, returns 0 when the game ends on the way
+int play_random_opening(struct datagen_worker *worker, struct chess_game *game)
+{
+    struct fen fn;
+    struct datagen_job *job = worker->job;
+    char *opening = job->openings == NULL ? START_POSITION_FEN : job->openings[random_u64(&worker->seed) % job->no_of_openings];
+    if(!init_fen(&fn, opening))
+    {
+        return 0;
+    }
+    init_chess_game(game, &fn);
+    for(int ply = 0; ply < job->random_plies; ply++)
+    {
+        struct move moves[MAX_MOVES];
+        int count = 0;
+        struct queue *q = generate_legal_moves(game);
+        struct move *mv;
+        while(q != NULL && (mv = dequeue(q)) != NULL)
+        {
+            moves[count < MAX_MOVES ? count++ : count - 1] = *mv;
+            free(mv);
+        }
+        free(q);
+        if(count == 0)
+        {
+            return 0;
+        }
+        make_move(game, &moves[random_u64(&worker->seed) % count]);
+    }
+    return count_legal_moves(game) > 0;
+}
+
+//searches a move for the side to move, returns 0 when the search found none
+int datagen_search(struct datagen_worker *worker, struct chess_game *game, struct key_history *history, int *score, struct move *best_move)
+{
+    struct search_shared *shared = &worker->engine.shared;
+    shared->root = *game;
+    shared->history = *history;
+    memset(&shared->limits, 0, sizeof(shared->limits));
+    shared->limits.nodes = worker->job->nodes;
+    if(!prepare_search(shared, &worker->engine.thread, 1))
+    {
+        return 0;
+    }
+    struct search_thread *best = run_search(shared);
+    if(best->no_of_best_lines == 0 || best->best_lines[0].pv_length == 0)
+    {
+        return 0;
+    }
+    *score = best->best_lines[0].score;
+    *best_move = best->best_lines[0].pv[0];
+    return 1;
+}
+
+//one self-play game, its quiet positions go to the chunk once the result is known
+void play_datagen_game(struct datagen_worker *worker)
+{
+    struct chess_game game;
+    struct key_history history;
+    struct move mv;
+    int score, tries = 0;
+    while(!play_random_opening(worker, &game))
+    {
+        //random plies can still mate or stalemate a valid opening every time
+        if(++tries == DATAGEN_OPENING_TRIES)
+        {
+            __atomic_fetch_add(&worker->job->games, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    attach_key_history(&game, &history);
+    clear_transposition_table(&worker->engine.table);
+
+    //openings that are already lost teach little
+    if(!datagen_search(worker, &game, &history, &score, &mv) || score > DATAGEN_OPENING_SCORE || score < -DATAGEN_OPENING_SCORE)
+    {
+        return;
+    }
+
+    int no_of_records = 0, result = 1, winning = 0, skipped = 0;
+    for(int ply = 0; ply < DATAGEN_MAX_PLIES; ply++)
+    {
+        if(count_legal_moves(&game) == 0)
+        {
+            result = !is_in_check(&game, game.turn) ? 1 : game.turn == WHITE ? 0 : 2;
+            break;
+        }
+        if(is_fifty_move_draw(&game) || count_repetitions(&game) >= 2 || is_insufficient_material(&game))
+        {
+            break;
+        }
+        if(!datagen_search(worker, &game, &history, &score, &mv))
+        {
+            break;
+        }
+        //the score stays decisive for the same colour for a few moves, counted from white's side
+        int white_score = game.turn == WHITE ? score : -score;
+        winning = white_score >= DATAGEN_RESIGN_SCORE ? (winning > 0 ? winning + 1 : 1) :
+            white_score <= -DATAGEN_RESIGN_SCORE ? (winning < 0 ? winning - 1 : -1) : 0;
+        if(winning >= DATAGEN_RESIGN_PLIES || winning <= -DATAGEN_RESIGN_PLIES)
+        {
+            result = winning > 0 ? 2 : 0;
+            break;
+        }
+
+        if(is_in_check(&game, game.turn) || is_capture(&mv) || mv.type >= 8 || score >= MATE_BOUND || score <= -MATE_BOUND)
+        {
+            skipped++;
+        }
+        else
+        {
+            struct datagen_record *record = &worker->game_records[no_of_records++];
+            encode_position(&game, &record->position);
+            record->score = (int16_t)score;
+            record->move = (uint16_t)pack_move(&mv);
+            record->ply = (uint16_t)ply;
+            record->reserved = 0;
+        }
+        make_move(&game, &mv);
+    }
+
+    for(int i = 0; i < no_of_records; i++)
+    {
+        worker->game_records[i].result = (uint8_t)result;
+        worker->chunk[worker->fill++] = worker->game_records[i];
+        if(worker->fill == DATAGEN_CHUNK_RECORDS)
+        {
+            flush_datagen_chunk(worker);
+        }
+    }
+    __atomic_fetch_add(&worker->job->positions, no_of_records, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->job->skipped, skipped, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->job->games, 1, __ATOMIC_RELAXED);
+}
+
+void* datagen_worker_loop(void *arg)
+{
+    struct datagen_job *job = (struct datagen_job*)arg;
+    struct datagen_worker *worker = (struct datagen_worker*)malloc(sizeof(struct datagen_worker));
+    struct datagen_record *chunk = (struct datagen_record*)malloc(sizeof(struct datagen_record) * DATAGEN_CHUNK_RECORDS);
+    if(worker == NULL || chunk == NULL || !init_match_engine(&worker->engine, &default_eval_params, 16))
+    {
+        printf("memory not allocated\n");
+        job->failed = 1;
+        free(worker);
+        free(chunk);
+        return NULL;
+    }
+    worker->job = job;
+    worker->chunk = chunk;
+    worker->fill = 0;
+    worker->seed = job->seed ^ (0x9E3779B97F4A7C15ULL * (__atomic_fetch_add(&job->next_thread, 1, __ATOMIC_RELAXED) + 1));
+    while(!job->failed && (job->no_of_games <= 0 || __atomic_fetch_add(&job->next_game, 1, __ATOMIC_RELAXED) < job->no_of_games))
+    {
+        play_datagen_game(worker);
+    }
+    flush_datagen_chunk(worker);
+    free_match_engine(&worker->engine);
+    free(chunk);
+    free(worker);
+    return NULL;
+}
+
+//prints the first records of a training data file
+int show_datagen_file(char *path, int count)
+{
+    init_packed_codec();
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+    struct position_file_header header;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, DATAGEN_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(struct datagen_record))
+    {
+        printf("%s is not a training data file\n", path);
+        fclose(fp);
+        return 1;
+    }
+    printf("%llu records\n", (unsigned long long)header.count);
+    struct datagen_record record;
+    struct chess_game game;
+    struct move mv;
+    char text[6];
+    for(int i = 0; i < count && fread(&record, sizeof(record), 1, fp) == 1; i++)
+    {
+        decode_position(&record.position, &game);
+        generate_fen(&game);
+        unpack_move(record.move, &mv);
+        move_to_string(&mv, text);
+        printf("%s score %d move %s ply %d result %s\n", game.fen, record.score, text, record.ply,
+            record.result == 2 ? "1-0" : record.result == 0 ? "0-1" : "1/2-1/2");
+    }
+    fclose(fp);
+    return 0;
+}
+
+//keeps the openings that parse and have a legal move, returns how many are left
+int drop_invalid_openings(char **openings, int count)
+{
+    struct fen fn;
+    struct chess_game game;
+    int kept = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(init_fen(&fn, openings[i]))
+        {
+            init_chess_game(&game, &fn);
+            if(count_legal_moves(&game) > 0)
+            {
+                openings[kept++] = openings[i];
+                continue;
+            }
+        }
+        printf("skipping opening %s\n", openings[i]);
+        free(openings[i]);
+    }
+    return kept;
+}
+
+//usage: datagen <output file> [games] [nodes] [threads] [random plies] [opening fens] [seed], or datagen show <file> [records]
+//games 0 runs until interrupted, the header's count is only filled in at the end, a reader that
+//streams the file goes by its size
+int run_datagen(int argc, char *argv[])
+{
+    if(argc > 1 && strcmp(argv[0], "show") == 0)
+    {
+        init_tables();
+        return show_datagen_file(argv[1], argc > 2 ? atoi(argv[2]) : 10);
+    }
+    if(argc < 1)
+    {
+        printf("usage: datagen <output file> [games] [nodes] [threads] [random plies] [opening fens] [seed] | datagen show <file> [records]\n");
+        return 1;
+    }
+    init_tables();
+    init_packed_codec();
+    struct datagen_job job;
+    memset(&job, 0, sizeof(job));
+    job.no_of_games = argc > 1 ? atoi(argv[1]) : 100;
+    job.nodes = argc > 2 ? atoll(argv[2]) : 5000;
+    long no_of_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int no_of_threads = argc > 3 ? atoi(argv[3]) : (int)(no_of_cpus > 0 ? no_of_cpus : 1);
+    no_of_threads = no_of_threads < 1 ? 1 : no_of_threads > 256 ? 256 : no_of_threads;
+    job.random_plies = argc > 4 ? atoi(argv[4]) : 8;
+    if(argc > 5 && strcmp(argv[5], "-") != 0)
+    {
+        job.no_of_openings = load_fen_lines(argv[5], &job.openings);
+        job.no_of_openings = drop_invalid_openings(job.openings, job.no_of_openings);
+        if(job.no_of_openings == 0)
+        {
+            printf("no usable openings in %s\n", argv[5]);
+            free(job.openings);
+            return 1;
+        }
+    }
+    job.seed = argc > 6 ? strtoull(argv[6], NULL, 10) : (uint64_t)(now_seconds() * 1e9);
+
+    job.fd = open(argv[0], O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(job.fd < 0)
+    {
+        printf("cannot open %s\n", argv[0]);
+        return 1;
+    }
+    struct position_file_header header;
+    memcpy(header.magic, DATAGEN_FILE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(struct datagen_record);
+    header.reserved = 0;
+    header.count = 0;
+    if(!write_all(job.fd, &header, sizeof(header)))
+    {
+        printf("cannot write %s\n", argv[0]);
+        return 1;
+    }
+
+    double start = now_seconds();
+    int ok = run_worker_threads(no_of_threads, datagen_worker_loop, &job) && !job.failed;
+    double elapsed = now_seconds() - start;
+    ok = close(job.fd) == 0 && ok;
+
+    //pwrite would append on a descriptor opened for appending, so the count goes in through another
+    header.count = job.positions;
+    int fd = open(argv[0], O_WRONLY);
+    ok = ok && fd >= 0 && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    ok = fd >= 0 && close(fd) == 0 && ok;
+    printf("{\"games\": %lld, \"positions\": %lld, \"skipped\": %lld, \"seconds\": %.3f, \"positions_per_s\": %.0f, \"ok\": %s}\n",
+        job.games, job.positions, job.skipped, elapsed, job.positions / elapsed, ok ? "true" : "false");
+    if(job.openings != NULL)
+    {
+        free_strings(job.openings, job.no_of_openings);
+        free(job.openings);
+    }
+    return ok ? 0 : 1;
+}
+
+//tactical test suites: every epd position is searched once by one of a pool of single threaded
+//engines to a time, node or depth limit. After each iteration the best move is checked against
+//the bm (best move) or am (avoid move) operations; the time and nodes at which a correct move
+//appeared and then stayed until the end are its time to solution.
+#define EPD_MAX_MOVES 8
+
+struct epd_position
+{
+    char id[64];
+    struct chess_game game;
+    struct move best[EPD_MAX_MOVES];
+    int no_of_best;
+    struct move avoid[EPD_MAX_MOVES];
+    int no_of_avoid;
+    int valid;
+    int solved;
+    double solve_time;
+    long long solve_nodes;
+    int solve_depth;
+    char found[8];
+};
+
+struct epd_job
+{
+    struct epd_position *positions;
+    int no_of_positions;
+    int next;
+    struct search_limits limits;
+    int hash_mb;
+    int failed;
+    pthread_mutex_t output_lock;
+};
+
+//reads the moves of a bm or am operand list, returns how many were legal moves
+int read_epd_moves(struct chess_game *game, char *operands, struct move *moves)
+{
+    char word[32];
+    int count = 0;
+    char *rest = operands;
+    while(count < EPD_MAX_MOVES && (rest = next_word(rest, word, sizeof(word))) != NULL)
+    {
+        count += parse_san_move(game, word, &moves[count]);
+    }
+    return count;
+}
+
+int parse_epd_position(struct epd_position *position, char *line, int number)
+{
+    char operations[256], operands[256];
+    struct fen fn;
+    memset(position, 0, sizeof(struct epd_position));
+    snprintf(position->id, sizeof(position->id), "%d", number);
+    if(!init_epd(&fn, line, operations, sizeof(operations)))
+    {
+        return 0;
+    }
+    init_chess_game(&position->game, &fn);
+    epd_operation(operations, "id", position->id, sizeof(position->id));
+    if(epd_operation(operations, "bm", operands, sizeof(operands)))
+    {
+        position->no_of_best = read_epd_moves(&position->game, operands, position->best);
+    }
+    if(epd_operation(operations, "am", operands, sizeof(operands)))
+    {
+        position->no_of_avoid = read_epd_moves(&position->game, operands, position->avoid);
+    }
+    return position->no_of_best + position->no_of_avoid > 0;
+}
+
+int is_epd_solution(struct epd_position *position, struct move *mv)
+{
+    for(int i = 0; i < position->no_of_avoid; i++)
+    {
+        if(same_move(mv, &position->avoid[i]))
+        {
+            return 0;
+        }
+    }
+    for(int i = 0; i < position->no_of_best; i++)
+    {
+        if(same_move(mv, &position->best[i]))
+        {
+            return 1;
+        }
+    }
+    return position->no_of_best == 0;
+}
+
+//a wrong move after a right one starts the clock again
+void track_epd_iteration(struct search_thread *st, int depth)
+{
+    struct epd_position *position = (struct epd_position*)st->shared->context;
+    if(st->no_of_best_lines == 0 || st->best_lines[0].pv_length == 0)
+    {
+        return;
+    }
+    if(!is_epd_solution(position, &st->best_lines[0].pv[0]))
+    {
+        position->solve_time = -1;
+    }
+    else if(position->solve_time < 0)
+    {
+        position->solve_time = now_seconds() - st->shared->start;
+        position->solve_nodes = st->nodes;
+        position->solve_depth = depth;
+    }
+}
+
+void* epd_worker(void *arg)
+{
+    struct epd_job *job = (struct epd_job*)arg;
+    struct match_engine *engine = (struct match_engine*)malloc(sizeof(struct match_engine));
+    if(engine == NULL || !init_match_engine(engine, &default_eval_params, job->hash_mb))
+    {
+        printf("memory not allocated\n");
+        free(engine);
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct search_shared *shared = &engine->shared;
+    shared->on_iteration = track_epd_iteration;
+    int index;
+    while((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->no_of_positions)
+    {
+        struct epd_position *position = &job->positions[index];
+        if(!position->valid)
+        {
+            continue;
+        }
+        shared->root = position->game;
+        shared->limits = job->limits;
+        shared->context = position;
+        attach_key_history(&shared->root, &shared->history);
+        clear_transposition_table(&engine->table);
+        position->solve_time = -1;
+        if(!prepare_search(shared, &engine->thread, 1))
+        {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        struct search_thread *best = run_search(shared);
+        string_cpy(position->found, "none");
+        if(best->no_of_best_lines > 0 && best->best_lines[0].pv_length > 0)
+        {
+            move_to_san(&position->game, &best->best_lines[0].pv[0], position->found);
+        }
+        position->solved = position->solve_time >= 0;
+
+        pthread_mutex_lock(&job->output_lock);
+        if(position->solved)
+        {
+            printf("%s solved %s time %.3f nodes %lld depth %d\n", position->id, position->found, position->solve_time,
+                position->solve_nodes, position->solve_depth);
+        }
+        else
+        {
+            printf("%s failed %s\n", position->id, position->found);
+        }
+        fflush(stdout);
+        pthread_mutex_unlock(&job->output_lock);
+    }
+    free_match_engine(engine);
+    free(engine);
+    return NULL;
+}
+
+//usage: epd <epd file> [movetime=ms | nodes=N | depth=N] [workers] [hash MB]
+int run_epd_suite(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: epd <epd file> [movetime=ms | nodes=N | depth=N] [workers] [hash MB]\n");
+        return 1;
+    }
+    struct epd_job job;
+    memset(&job, 0, sizeof(job));
+    job.limits.movetime = 1000;
+    if(argc > 1 && strncmp(argv[1], "nodes=", 6) == 0)
+    {
+        job.limits.movetime = 0;
+        job.limits.nodes = atoll(argv[1] + 6);
+    }
+    else if(argc > 1 && strncmp(argv[1], "depth=", 6) == 0)
+    {
+        job.limits.movetime = 0;
+        job.limits.depth = atoi(argv[1] + 6);
+    }
+    else if(argc > 1 && strncmp(argv[1], "movetime=", 9) == 0)
+    {
+        job.limits.movetime = atoi(argv[1] + 9);
+    }
+    int no_of_workers = argc > 2 ? atoi(argv[2]) : 1;
+    no_of_workers = no_of_workers < 1 ? 1 : no_of_workers > 256 ? 256 : no_of_workers;
+    job.hash_mb = argc > 3 ? atoi(argv[3]) : 16;
+    job.hash_mb = job.hash_mb < 1 ? 1 : job.hash_mb;
+
+    char **lines;
+    int no_of_lines = load_fen_lines(argv[0], &lines);
+    job.positions = (struct epd_position*)calloc(no_of_lines > 0 ? no_of_lines : 1, sizeof(struct epd_position));
+    if(job.positions == NULL)
+    {
+        printf("memory not allocated\n");
+        return 1;
+    }
+    int no_of_valid = 0;
+    for(int i = 0; i < no_of_lines; i++)
+    {
+        job.positions[i].valid = parse_epd_position(&job.positions[i], lines[i], i + 1);
+        no_of_valid += job.positions[i].valid;
+        if(!job.positions[i].valid)
+        {
+            printf("%d invalid epd %s\n", i + 1, lines[i]);
+        }
+    }
+    job.no_of_positions = no_of_lines;
+    pthread_mutex_init(&job.output_lock, NULL);
+    double start = now_seconds();
+    run_worker_threads(no_of_workers, epd_worker, &job);
+    double elapsed = now_seconds() - start;
+
+    //solved positions by time to solution, and how many were solved within each share of the limit
+    double *times = (double*)calloc(no_of_valid > 0 ? no_of_valid : 1, sizeof(double));
+    double *nodes = (double*)calloc(no_of_valid > 0 ? no_of_valid : 1, sizeof(double));
+    int solved = 0;
+    double total_time = 0, total_nodes = 0;
+    for(int i = 0; i < no_of_lines && times != NULL && nodes != NULL; i++)
+    {
+        if(job.positions[i].valid && job.positions[i].solved)
+        {
+            times[solved] = job.positions[i].solve_time;
+            nodes[solved++] = job.positions[i].solve_nodes;
+            total_time += job.positions[i].solve_time;
+            total_nodes += job.positions[i].solve_nodes;
+        }
+    }
+    qsort(times, solved, sizeof(double), compare_doubles);
+    qsort(nodes, solved, sizeof(double), compare_doubles);
+    printf("solved %d of %d in %.1f s with %d workers\n", solved, no_of_valid, elapsed, no_of_workers);
+    if(solved > 0)
+    {
+        printf("time to solution: mean %.3f s median %.3f s 90%% %.3f s max %.3f s\n", total_time / solved, times[solved / 2],
+            times[(int)(solved * 0.9) < solved ? (int)(solved * 0.9) : solved - 1], times[solved - 1]);
+        printf("nodes to solution: mean %.0f median %.0f 90%% %.0f max %.0f\n", total_nodes / solved, nodes[solved / 2],
+            nodes[(int)(solved * 0.9) < solved ? (int)(solved * 0.9) : solved - 1], nodes[solved - 1]);
+    }
+    const double shares[] = {0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1};
+    double limit = job.limits.movetime > 0 ? job.limits.movetime / 1000.0 : (double)job.limits.nodes;
+    double *values = job.limits.movetime > 0 ? times : nodes;
+    for(int i = 0; i < 7 && limit > 0 && solved > 0; i++)
+    {
+        int within = 0;
+        while(within < solved && values[within] <= limit * shares[i])
+        {
+            within++;
+        }
+        printf("  within %3.0f%% of the limit: %d\n", shares[i] * 100, within);
+    }
+
+    free(times);
+    free(nodes);
+    free(job.positions);
+    free_strings(lines, no_of_lines);
+    free(lines);
+    pthread_mutex_destroy(&job.output_lock);
+    return job.failed;
+}
+
+struct trace_ply_stats
+{
+    uint64_t nodes;
+    uint64_t qnodes;
+    uint64_t tt_hits;
+    uint64_t tt_cutoffs;
+    uint64_t exits;
+    uint64_t moves;
+    uint64_t cutoffs;
+    uint64_t first_cutoffs;
+    uint64_t null_moves;
+    uint64_t null_cutoffs;
+    uint64_t timed;
+    double ticks;
+};
+
+struct trace_depth_stats
+{
+    uint64_t iterations;
+    uint64_t nodes;
+    double ticks;
+};
+
+//replays one thread's events. A node's inclusive time runs from its enter to its exit at the
+//same ply; nodes that return early (table and null move cutoffs, a stopped search) have no exit.
+int read_trace_thread(FILE *fp, struct trace_ply_stats *plies, struct trace_depth_stats *depths)
+{
+    uint64_t count;
+    if(fread(&count, sizeof(count), 1, fp) != 1)
+    {
+        return 0;
+    }
+    uint32_t enter_time[MAX_PLY];
+    uint64_t root_nodes = 0;
+    int entered[MAX_PLY] = {0};
+    struct trace_event events[4096];
+    while(count > 0)
+    {
+        size_t wanted = count < 4096 ? count : 4096;
+        if(fread(events, sizeof(struct trace_event), wanted, fp) != wanted)
+        {
+            return 0;
+        }
+        count -= wanted;
+        for(size_t i = 0; i < wanted; i++)
+        {
+            struct trace_event *event = &events[i];
+            int ply = event->ply < MAX_PLY ? event->ply : MAX_PLY - 1;
+            struct trace_ply_stats *stats = &plies[ply];
+            if(event->kind == TRACE_QUIESCENCE)
+            {
+                stats->qnodes++;
+                root_nodes++;
+            }
+            else if(event->kind == TRACE_ENTER)
+            {
+                stats->nodes++;
+                root_nodes++;
+                stats->tt_hits += event->index != TRACE_TT_MISS;
+                stats->tt_cutoffs += event->index == TRACE_TT_CUTOFF;
+                if(event->index != TRACE_TT_CUTOFF)
+                {
+                    enter_time[ply] = event->time;
+                    entered[ply] = 1;
+                    root_nodes = ply == 0 ? 0 : root_nodes;
+                }
+            }
+            else if(event->kind == TRACE_NULL_MOVE)
+            {
+                stats->null_moves++;
+                stats->null_cutoffs += event->index;
+            }
+            else if(event->kind == TRACE_EXIT)
+            {
+                stats->exits++;
+                stats->moves += event->moves;
+                stats->cutoffs += event->index != 255;
+                stats->first_cutoffs += event->index == 0;
+                if(entered[ply])
+                {
+                    //the clock is 32 bits wide, unsigned differences survive one wrap
+                    double ticks = (uint32_t)(event->time - enter_time[ply]);
+                    stats->timed++;
+                    stats->ticks += ticks;
+                    entered[ply] = 0;
+                    if(ply == 0 && event->depth > 0)
+                    {
+                        depths[event->depth].iterations++;
+                        depths[event->depth].nodes += root_nodes;
+                        depths[event->depth].ticks += ticks;
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+double trace_percent(uint64_t part, uint64_t whole)
+{
+    return whole > 0 ? 100.0 * part / whole : 0;
+}
+
+//summarizes a trace written by a -DCHESS_TRACE build: per ply the nodes, branching factor
+//(moves searched per expanded node), cutoff rates and inclusive time, then per root iteration
+//the nodes, time and effective branching factor against the previous depth
+int run_trace_summary(int argc, char *argv[])
+{
+    if(argc < 1)
+    {
+        printf("usage: trace <trace file>\n");
+        return 1;
+    }
+    FILE *fp = fopen(argv[0], "rb");
+    if(fp == NULL)
+    {
+        printf("cannot open %s\n", argv[0]);
+        return 1;
+    }
+    struct trace_file_header header;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.event_size != sizeof(struct trace_event))
+    {
+        printf("%s is not a trace file\n", argv[0]);
+        fclose(fp);
+        return 1;
+    }
+    struct trace_ply_stats *plies = (struct trace_ply_stats*)calloc(MAX_PLY, sizeof(struct trace_ply_stats));
+    struct trace_depth_stats *depths = (struct trace_depth_stats*)calloc(MAX_PLY, sizeof(struct trace_depth_stats));
+    if(plies == NULL || depths == NULL)
+    {
+        printf("memory not allocated\n");
+        free(plies);
+        free(depths);
+        fclose(fp);
+        return 1;
+    }
+    int ok = 1;
+    for(uint32_t i = 0; i < header.no_of_threads && ok; i++)
+    {
+        ok = read_trace_thread(fp, plies, depths);
+    }
+    fclose(fp);
+    if(!ok)
+    {
+        printf("%s is truncated\n", argv[0]);
+    }
+
+    double micros = 1e6 / (header.ticks_per_second > 0 ? header.ticks_per_second : 1);
+    uint64_t nodes = 0, qnodes = 0, null_moves = 0, null_cutoffs = 0;
+    printf("threads %u\n", header.no_of_threads);
+    printf("%4s %12s %12s %8s %8s %8s %8s %8s %12s\n", "ply", "nodes", "qnodes", "branch", "tt hit", "tt cut", "cutoff", "first", "time us");
+    for(int ply = 0; ply < MAX_PLY; ply++)
+    {
+        struct trace_ply_stats *stats = &plies[ply];
+        nodes += stats->nodes;
+        qnodes += stats->qnodes;
+        null_moves += stats->null_moves;
+        null_cutoffs += stats->null_cutoffs;
+        if(stats->nodes + stats->qnodes == 0)
+        {
+            continue;
+        }
+        printf("%4d %12llu %12llu %8.2f %7.1f%% %7.1f%% %7.1f%% %7.1f%% %12.2f\n", ply,
+            (unsigned long long)stats->nodes, (unsigned long long)stats->qnodes,
+            stats->exits > 0 ? (double)stats->moves / stats->exits : 0,
+            trace_percent(stats->tt_hits, stats->nodes), trace_percent(stats->tt_cutoffs, stats->nodes),
+            trace_percent(stats->cutoffs, stats->exits), trace_percent(stats->first_cutoffs, stats->cutoffs),
+            stats->timed > 0 ? stats->ticks * micros / stats->timed : 0);
+    }
+    printf("nodes %llu qnodes %llu null move cutoffs %.1f%% of %llu\n", (unsigned long long)nodes, (unsigned long long)qnodes,
+        trace_percent(null_cutoffs, null_moves), (unsigned long long)null_moves);
+
+    printf("%5s %10s %14s %12s %8s\n", "depth", "iterations", "nodes", "time us", "ebf");
+    for(int depth = 1; depth < MAX_PLY; depth++)
+    {
+        struct trace_depth_stats *stats = &depths[depth];
+        if(stats->iterations == 0)
+        {
+            continue;
+        }
+        struct trace_depth_stats *previous = &depths[depth - 1];
+        printf("%5d %10llu %14.1f %12.2f", depth, (unsigned long long)stats->iterations,
+            (double)stats->nodes / stats->iterations, stats->ticks * micros / stats->iterations);
+        if(previous->iterations > 0 && previous->nodes > 0)
+        {
+            printf(" %8.2f", ((double)stats->nodes / stats->iterations) / ((double)previous->nodes / previous->iterations));
+        }
+        printf("\n");
+    }
+    free(plies);
+    free(depths);
+    return ok ? 0 : 1;
+}
+
+//distributed perft: the tree is split into units, the positions at the split depth, which worker
+//processes count to the full depth. Each finished unit is appended to the checkpoint file and
+//synced, so a run started again with the same checkpoint only counts the missing units.
+#define PERFT_MAX_SPLIT 4
+#define PERFT_COUNTERS 17
+const char *PERFT_TYPE_NAMES[16] = {"quiet", "double pawn push", "king castle", "queen castle", "capture", "en passant",
+    "", "", "knight promotion", "bishop promotion", "rook promotion", "queen promotion",
+    "knight promotion capture", "bishop promotion capture", "rook promotion capture", "queen promotion capture"};
+
+//leaf moves by move type, the last counter is the leaves that give check
+struct perft_counts
+{
+    uint64_t counts[PERFT_COUNTERS];
+};
+
+struct perft_unit
+{
+    uint16_t moves[PERFT_MAX_SPLIT];
+    int done;
+};
+
+struct perft_result
+{
+    int unit;
+    struct perft_counts counts;
+};
+
+struct perft_units
+{
+    struct perft_unit *units;
+    int count;
+    int capacity;
+};
+
+void perft_count(struct chess_game *game, int depth, struct perft_counts *counts)
+{
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return;
+    }
+    int in_check = is_in_check(game, game->turn);
+    struct chess_game child;
+    struct move *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        if(make_legal_move(game, mv, &child, in_check))
+        {
+            if(depth == 1)
+            {
+                counts->counts[mv->type]++;
+                counts->counts[PERFT_COUNTERS - 1] += is_in_check(&child, child.turn);
+            }
+            else
+            {
+                perft_count(&child, depth - 1, counts);
+            }
+        }
+        free(mv);
+    }
+    free(q);
+}
+
+uint64_t perft_nodes(struct perft_counts *counts)
+{
+    uint64_t nodes = 0;
+    for(int i = 0; i < PERFT_COUNTERS - 1; i++)
+    {
+        nodes += counts->counts[i];
+    }
+    return nodes;
+}
+
+//collects the move paths to every position at the split depth, in move generation order, so
+//a unit's index is the same in every run
+int collect_perft_units(struct chess_game *game, int depth, int split, uint16_t *path, struct perft_units *units)
+{
+    if(depth == split)
+    {
+        if(units->count == units->capacity)
+        {
+            int capacity = units->capacity > 0 ? units->capacity * 2 : 256;
+            struct perft_unit *grown = (struct perft_unit*)realloc(units->units, sizeof(struct perft_unit) * capacity);
+            if(grown == NULL)
+            {
+                return 0;
+            }
+            units->units = grown;
+            units->capacity = capacity;
+        }
+        struct perft_unit *unit = &units->units[units->count++];
+        memset(unit, 0, sizeof(*unit));
+        memcpy(unit->moves, path, sizeof(uint16_t) * split);
+        return 1;
+    }
+    struct queue *q = generate_moves(game);
+    if(q == NULL)
+    {
+        return 0;
+    }
+    int in_check = is_in_check(game, game->turn), ok = 1;
+    struct chess_game child;
+    struct move *mv;
+    while((mv = dequeue(q)) != NULL)
+    {
+        if(ok && make_legal_move(game, mv, &child, in_check))
+        {
+            path[depth] = pack_move(mv);
+            ok = collect_perft_units(&child, depth + 1, split, path, units);
+        }
+        free(mv);
+    }
+    free(q);
+    return ok;
+}
+
+int read_exact(int fd, void *data, size_t size)
+{
+    char *bytes = (char*)data;
+    while(size > 0)
+    {
+        ssize_t got = read(fd, bytes, size);
+        if(got <= 0)
+        {
+            return 0;
+        }
+        bytes += got;
+        size -= got;
+    }
+    return 1;
+}
+
+//a worker process reads unit numbers until its socket closes and answers each with its counts
+void perft_worker(int fd, struct chess_game *root, struct perft_units *units, int split, int depth)
+{
+    int index;
+    while(read_exact(fd, &index, sizeof(index)) && index >= 0 && index < units->count)
+    {
+        struct perft_result result;
+        memset(&result, 0, sizeof(result));
+        result.unit = index;
+        struct chess_game game = *root;
+        struct move mv;
+        for(int i = 0; i < split; i++)
+        {
+            unpack_move(units->units[index].moves[i], &mv);
+            make_move(&game, &mv);
+        }
+        perft_count(&game, depth - split, &result.counts);
+        if(!write_all(fd, &result, sizeof(result)))
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+//reads the finished units of a checkpoint into totals. The file starts with a line naming the
+//run; a line cut short by an interrupted write is dropped and the file truncated before it.
+int load_perft_checkpoint(char *path, char *run, struct perft_units *units, struct perft_counts *totals, int *done)
+{
+    FILE *fp = fopen(path, "r+");
+    if(fp == NULL)
+    {
+        fp = fopen(path, "w");
+        if(fp == NULL || fprintf(fp, "%s\n", run) < 0 || fclose(fp) != 0)
+        {
+            printf("cannot open %s\n", path);
+            return 0;
+        }
+        return 1;
+    }
+    char line[1024];
+    if(fgets(line, sizeof(line), fp) == NULL || strncmp(line, run, strlen(run)) != 0 || line[strlen(run)] != '\n')
+    {
+        printf("checkpoint %s belongs to another run\n", path);
+        fclose(fp);
+        return 0;
+    }
+    long complete = ftell(fp);
+    while(fgets(line, sizeof(line), fp) != NULL && strchr(line, '\n') != NULL)
+    {
+        struct perft_counts counts;
+        int index, length, fields = 0;
+        char *p = line;
+        if(sscanf(p, "%d%n", &index, &length) != 1 || index < 0 || index >= units->count)
+        {
+            break;
+        }
+        p += length;
+        unsigned long long count;
+        while(fields < PERFT_COUNTERS && sscanf(p, "%llu%n", &count, &length) == 1)
+        {
+            counts.counts[fields++] = count;
+            p += length;
+        }
+        if(fields != PERFT_COUNTERS)
+        {
+            break;
+        }
+        if(!units->units[index].done)
+        {
+            units->units[index].done = 1;
+            (*done)++;
+            for(int i = 0; i < PERFT_COUNTERS; i++)
+            {
+                totals->counts[i] += counts.counts[i];
+            }
+        }
+        complete = ftell(fp);
+    }
+    fclose(fp);
+    if(truncate(path, complete) != 0)
+    {
+        printf("cannot write %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+int append_perft_checkpoint(int fd, struct perft_result *result)
+{
+    char line[1024];
+    int length = sprintf(line, "%d", result->unit);
+    for(int i = 0; i < PERFT_COUNTERS; i++)
+    {
+        length += sprintf(line + length, " %llu", (unsigned long long)result->counts.counts[i]);
+    }
+    line[length++] = '\n';
+    return write_all(fd, line, length) && fsync(fd) == 0;
+}
+
+struct perft_process
+{
+    pid_t pid;
+    int fd;
+    int unit;
+};
+
+//units not yet handed out, lost units come back through the retry list
+struct perft_schedule
+{
+    int next;
+    int *retry;
+    int retries;
+};
+
+//hands the next unfinished unit to a worker, or closes its socket when none are left
+void assign_perft_unit(struct perft_process *process, struct perft_units *units, struct perft_schedule *schedule)
+{
+    while(schedule->next < units->count && units->units[schedule->next].done)
+    {
+        schedule->next++;
+    }
+    int unit = schedule->retries > 0 ? schedule->retry[schedule->retries - 1] : schedule->next;
+    if(unit < units->count && write_all(process->fd, &unit, sizeof(int)))
+    {
+        if(schedule->retries > 0)
+        {
+            schedule->retries--;
+        }
+        else
+        {
+            schedule->next++;
+        }
+        process->unit = unit;
+        return;
+    }
+    process->unit = -1;
+    close(process->fd);
+    process->fd = -1;
+}
+
+int run_perft(int argc, char *argv[])
+{
+    struct fen fn;
+    struct chess_game root;
+    int depth = argc > 1 ? atoi(argv[1]) : 0;
+    if(argc < 2 || depth < 1 || !init_fen(&fn, strcmp(argv[0], "startpos") == 0 ? START_POSITION_FEN : argv[0]))
+    {
+        printf("usage: perft <startpos | fen> <depth> [workers] [checkpoint] [split depth] [attacks]\n");
+        return 1;
+    }
+    init_chess_game(&root, &fn);
+    //counts the same tree with make_move keeping the attack maps
+    if(argc > 5 && strcmp(argv[5], "attacks") == 0)
+    {
+        enable_attack_maps(&root);
+    }
+    int no_of_workers = argc > 2 ? atoi(argv[2]) : 1;
+    no_of_workers = no_of_workers < 1 ? 1 : no_of_workers > 256 ? 256 : no_of_workers;
+    char *checkpoint = argc > 3 && strcmp(argv[3], "-") != 0 ? argv[3] : NULL;
+    int split = argc > 4 ? atoi(argv[4]) : 2;
+    split = split < 0 ? 0 : split > PERFT_MAX_SPLIT ? PERFT_MAX_SPLIT : split;
+    split = split < depth ? split : depth - 1;
+
+    struct perft_units units = {NULL, 0, 0};
+    uint16_t path[PERFT_MAX_SPLIT];
+    if(!collect_perft_units(&root, 0, split, path, &units))
+    {
+        printf("memory not allocated\n");
+        free(units.units);
+        return 1;
+    }
+
+    struct perft_counts totals;
+    memset(&totals, 0, sizeof(totals));
+    char run[256];
+    generate_fen(&root);
+    snprintf(run, sizeof(run), "perft %d split %d units %d fen %s", depth, split, units.count, root.fen);
+    int done = 0, checkpoint_fd = -1;
+    if(checkpoint != NULL)
+    {
+        if(!load_perft_checkpoint(checkpoint, run, &units, &totals, &done) || (checkpoint_fd = open(checkpoint, O_WRONLY | O_APPEND)) < 0)
+        {
+            free(units.units);
+            return 1;
+        }
+        printf("%d of %d units already counted\n", done, units.count);
+    }
+
+    double start = now_seconds();
+    uint64_t resumed = perft_nodes(&totals);
+    int remaining = units.count - done;
+    no_of_workers = no_of_workers < remaining ? no_of_workers : remaining;
+    struct perft_process processes[256];
+    struct perft_schedule schedule = {0, (int*)malloc(sizeof(int) * (units.count + 1)), 0};
+    int epoll_fd = epoll_create1(0), started = 0, failed = epoll_fd < 0 || schedule.retry == NULL;
+    for(int i = 0; i < no_of_workers && !failed; i++)
+    {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            break;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            close(fds[0]);
+            for(int k = 0; k < started; k++)
+            {
+                close(processes[k].fd);
+            }
+            perft_worker(fds[1], &root, &units, split, depth);
+            _exit(0);
+        }
+        close(fds[1]);
+        struct epoll_event event = {EPOLLIN, {.u32 = started}};
+        if(pid < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[0], &event) != 0)
+        {
+            close(fds[0]);
+            break;
+        }
+        processes[started].pid = pid;
+        processes[started].fd = fds[0];
+        assign_perft_unit(&processes[started++], &units, &schedule);
+    }
+    if(started == 0 && remaining > 0)
+    {
+        printf("cannot start workers\n");
+        failed = 1;
+    }
+
+    //a worker that dies gives only its own unit back to the others
+    int active = started, lost = 0;
+    while(active > 0 && !failed)
+    {
+        struct epoll_event events[64];
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        for(int i = 0; i < ready; i++)
+        {
+            struct perft_process *process = &processes[events[i].data.u32];
+            struct perft_result result;
+            if(process->fd < 0)
+            {
+                continue;
+            }
+            if(!read_exact(process->fd, &result, sizeof(result)) || result.unit != process->unit)
+            {
+                schedule.retry[schedule.retries++] = process->unit;
+                close(process->fd);
+                process->fd = -1;
+                active--;
+                lost++;
+                continue;
+            }
+            if(!units.units[result.unit].done)
+            {
+                units.units[result.unit].done = 1;
+                done++;
+                for(int k = 0; k < PERFT_COUNTERS; k++)
+                {
+                    totals.counts[k] += result.counts.counts[k];
+                }
+                if(checkpoint_fd >= 0 && !append_perft_checkpoint(checkpoint_fd, &result))
+                {
+                    printf("cannot write %s\n", checkpoint);
+                    failed = 1;
+                }
+            }
+            assign_perft_unit(process, &units, &schedule);
+            active -= process->fd < 0;
+        }
+        if(ready < 0)
+        {
+            failed = 1;
+        }
+    }
+    for(int i = 0; i < started; i++)
+    {
+        if(processes[i].fd >= 0)
+        {
+            close(processes[i].fd);
+        }
+        waitpid(processes[i].pid, NULL, 0);
+    }
+    if(epoll_fd >= 0)
+    {
+        close(epoll_fd);
+    }
+    if(checkpoint_fd >= 0)
+    {
+        close(checkpoint_fd);
+    }
+    double elapsed = now_seconds() - start;
+    free(schedule.retry);
+    free(units.units);
+    if(failed || done < units.count)
+    {
+        printf("perft stopped with %d of %d units counted, %d workers lost\n", done, units.count, lost);
+        return 1;
+    }
+
+    uint64_t nodes = perft_nodes(&totals);
+    for(int i = 0; i < PERFT_COUNTERS - 1; i++)
+    {
+        if(totals.counts[i] > 0)
+        {
+            printf("%-26s %llu\n", PERFT_TYPE_NAMES[i], (unsigned long long)totals.counts[i]);
+        }
+    }
+    printf("%-26s %llu\n", "checks", (unsigned long long)totals.counts[PERFT_COUNTERS - 1]);
+    printf("{\"depth\": %d, \"nodes\": %llu, \"units\": %d, \"workers\": %d, \"seconds\": %.3f, \"nps\": %.0f}\n",
+        depth, (unsigned long long)nodes, units.count, started, elapsed, elapsed > 0 ? (nodes - resumed) / elapsed : 0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef CHESS_STATS
+    atexit(dump_counters_at_exit);
+#endif
+#ifdef CHESS_TRACE
+    atexit(dump_trace_at_exit);
+#endif
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        return run_bench(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "batch") == 0)
+    {
+        return run_batch_benchmark(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "microbench") == 0)
+    {
+        return run_microbenchmarks(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "pack") == 0)
+    {
+        return run_pack_mode(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "dedup") == 0)
+    {
+        return run_dedup_mode(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "index") == 0)
+    {
+        return run_index_mode(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "mcts") == 0)
+    {
+        return run_mcts_benchmark(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "mate") == 0)
+    {
+        return run_mate_solver(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "tasks") == 0)
+    {
+        return run_task_benchmark(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "analyse") == 0)
+    {
+        return run_analysis(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "tune") == 0)
+    {
+        return run_tuner(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "match") == 0)
+    {
+        return run_match(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "datagen") == 0)
+    {
+        return run_datagen(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "epd") == 0)
+    {
+        return run_epd_suite(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "trace") == 0)
+    {
+        return run_trace_summary(argc - 2, argv + 2);
+    }
+    if(argc > 1 && strcmp(argv[1], "perft") == 0)
+    {
+        return run_perft(argc - 2, argv + 2);
+    }
+    if(argc > 2 && strcmp(argv[1], "serve") == 0 && strcmp(argv[2], "load") == 0)
+    {
+        return run_service_load(argc - 3, argv + 3);
+    }
+    if(argc > 1 && strcmp(argv[1], "serve") == 0)
+    {
+        return run_service(argc - 2, argv + 2);
+    }
+
+    return run_uci();
 }
 
 void display_number_board(int *board)